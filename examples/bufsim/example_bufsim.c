@@ -0,0 +1,417 @@
+/**
+ * \file example_bufsim.c
+ * \brief Bit rate profile and buffer occupancy simulation for an MPEG file
+ *
+ * Replays the packet arrival of a file against the decoder's consumption
+ * schedule, following the MPEG-1 system target decoder: packets are delivered
+ * at the time their pack's SCR and mux rate say, video leaves the buffer at
+ * the decode time of its pictures and audio at the time of its frames. A read
+ * bandwidth limits how fast the file source can be read, e.g. to model a CD.
+ *
+ * The demux buffer holds what has been read but not delivered yet, the video
+ * and audio buffers what has been delivered but not decoded. The peaks are
+ * the buffer sizes the file needs under this model, next to the sizes of
+ * plmpeg's rings, which are filled on demand instead; a stall is a packet
+ * that arrives after the decoder needed it, which holds up playback by the
+ * difference.
+ *
+ * Only headers are read, through plm_scan_stream(), so this runs at disk
+ * speed even for long files.
+ *
+ * Usage: mpeg_bufsim [-r KB/s] [-d bytes] [-l seconds] [-p] file.mpg
+ *   -r  read bandwidth of the source in KB/s; default unlimited
+ *   -d  demux buffer size in bytes; default what plmpeg would use
+ *   -l  how far ahead of its time audio is decoded (audio_lead_time)
+ *   -p  print a table of bit rate and buffer peaks for every second
+ *
+ * The strips at the end are a heat map with one character per second, from
+ * ' ' (nothing) to '@' (the peak of that row).
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpeg.h"
+#include "pl_mpeg.h"
+
+#define SIM_STRIP_WIDTH 72
+
+typedef struct {
+    int type;
+    size_t size;
+    size_t length;
+    double pts;
+    double arrival;     /* SCR time at which its last byte is delivered */
+    int pictures;
+} sim_packet_t;
+
+typedef struct {
+    sim_packet_t *packets;
+    int count;
+    int capacity;
+
+    double pack_scr;
+    size_t pack_bytes;
+    double first_scr;
+    bool has_scr;
+    bool failed;        /* Out of memory; packets are missing */
+} sim_trace_t;
+
+typedef struct {
+    double time;
+    long delta;
+} sim_event_t;
+
+typedef enum {
+    SIM_DEMUX,
+    SIM_VIDEO,
+    SIM_AUDIO,
+    SIM_BUFFERS
+} sim_buffer_t;
+
+static const char *sim_buffer_names[SIM_BUFFERS] = { "demux", "video", "audio" };
+
+typedef struct {
+    sim_event_t *events;
+    int count;
+    int capacity;
+    size_t peak;
+    double peak_time;
+    size_t *second_peak;
+    bool failed;        /* Out of memory; events are missing */
+} sim_occupancy_t;
+
+
+/* Trace: every packet with the time its pack header has it arrive */
+
+static void on_packet(plm_scan_packet_t *packet, void *user) {
+    sim_trace_t *trace = user;
+
+    if(!trace->has_scr || packet->scr != trace->pack_scr) {
+        if(!trace->has_scr)
+            trace->first_scr = packet->scr;
+        trace->has_scr = true;
+        trace->pack_scr = packet->scr;
+        trace->pack_bytes = 12;
+    }
+    trace->pack_bytes += packet->size;
+
+    if(trace->count == trace->capacity) {
+        int capacity = trace->capacity ? trace->capacity * 2 : 1024;
+        sim_packet_t *packets = realloc(trace->packets, capacity * sizeof(sim_packet_t));
+        if(!packets) {
+            trace->failed = true;
+            return;
+        }
+        trace->packets = packets;
+        trace->capacity = capacity;
+    }
+
+    sim_packet_t *p = &trace->packets[trace->count++];
+    p->type = packet->type;
+    p->size = packet->size;
+    p->length = packet->length;
+    p->pts = packet->pts;
+    p->pictures = packet->pictures;
+    p->arrival = packet->scr - trace->first_scr;
+    if(packet->mux_rate > 0)
+        p->arrival += (double)trace->pack_bytes / packet->mux_rate;
+}
+
+
+/* Occupancy: bytes in at one time, out at a later one */
+
+static void occupancy_add(sim_occupancy_t *o, double in, double out, size_t bytes) {
+    if(o->count + 2 > o->capacity) {
+        int capacity = o->capacity ? o->capacity * 2 : 2048;
+        sim_event_t *events = realloc(o->events, capacity * sizeof(sim_event_t));
+        if(!events) {
+            o->failed = true;
+            return;
+        }
+        o->events = events;
+        o->capacity = capacity;
+    }
+    o->events[o->count++] = (sim_event_t){ in, (long)bytes };
+    o->events[o->count++] = (sim_event_t){ out > in ? out : in, -(long)bytes };
+}
+
+static int compare_events(const void *a, const void *b) {
+    const sim_event_t *ea = a, *eb = b;
+    return (ea->time > eb->time) - (ea->time < eb->time);
+}
+
+static void occupancy_sweep(sim_occupancy_t *o, int seconds) {
+    long level = 0;
+
+    o->second_peak = calloc(seconds, sizeof(size_t));
+    if(!o->second_peak)
+        o->failed = true;
+    qsort(o->events, o->count, sizeof(sim_event_t), compare_events);
+
+    for(int i = 0; i < o->count; i++) {
+        /* Everything that happens at the same time at once; a packet may
+           replace one that leaves at that moment */
+        level += o->events[i].delta;
+        if(i + 1 < o->count && o->events[i + 1].time == o->events[i].time)
+            continue;
+
+        if(level > 0 && (size_t)level > o->peak) {
+            o->peak = level;
+            o->peak_time = o->events[i].time;
+        }
+
+        int second = (int)o->events[i].time;
+        if(o->second_peak && second >= 0 && second < seconds && level > 0 &&
+           (size_t)level > o->second_peak[second])
+            o->second_peak[second] = level;
+    }
+}
+
+
+/* Heat map strip, one character per second */
+
+static void print_strip(const char *name, const size_t *values, int seconds) {
+    static const char ramp[] = " .:-=+*#%@";
+    size_t peak = 0;
+
+    for(int i = 0; i < seconds; i++)
+        if(values[i] > peak)
+            peak = values[i];
+
+    printf("  %-8s|", name);
+    for(int i = 0; i < seconds && i < SIM_STRIP_WIDTH; i++) {
+        int level = peak ? (int)((values[i] * (sizeof(ramp) - 2) + peak - 1) / peak) : 0;
+        putchar(ramp[level]);
+    }
+    printf("|\n");
+}
+
+int main(int argc, char **argv) {
+    const char *filename = NULL;
+    double read_rate = 0;
+    double audio_lead = 0;
+    size_t demux_size = 0;
+    bool per_second = false;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-r") && i + 1 < argc)
+            read_rate = atof(argv[++i]) * 1024;
+        else if(!strcmp(argv[i], "-d") && i + 1 < argc)
+            demux_size = strtoul(argv[++i], NULL, 0);
+        else if(!strcmp(argv[i], "-l") && i + 1 < argc)
+            audio_lead = atof(argv[++i]);
+        else if(!strcmp(argv[i], "-p"))
+            per_second = true;
+        else
+            filename = argv[i];
+    }
+
+    if(!filename) {
+        fprintf(stderr, "usage: %s [-r KB/s] [-d bytes] [-l seconds] [-p] file.mpg\n", argv[0]);
+        return 1;
+    }
+
+    plm_buffer_t *buffer = plm_buffer_create_with_filename(filename);
+    if(!buffer)
+        return 1;
+
+    sim_trace_t trace;
+    plm_scan_info_t info;
+    plm_memory_requirements_t req;
+
+    memset(&trace, 0, sizeof(trace));
+    memset(&req, 0, sizeof(req));
+    if(!plm_scan_stream(buffer, &info, on_packet, &trace) || !trace.count) {
+        fprintf(stderr, "No MPEG-PS packets in %s\n", filename);
+        free(trace.packets);
+        plm_buffer_destroy(buffer);
+        return 1;
+    }
+    plm_query_memory_requirements(buffer, &req);
+    plm_buffer_destroy(buffer);
+
+    if(trace.failed) {
+        fprintf(stderr, "Out of memory for the packets of %s\n", filename);
+        free(trace.packets);
+        return 1;
+    }
+
+    if(!demux_size)
+        demux_size = req.demux_ring ? req.demux_ring : PLM_BUFFER_DEFAULT_SIZE;
+
+    /* Consumption schedule on the SCR clock. With B-pictures the first
+       picture is decoded one frame period before it is shown. */
+    double video_start = PLM_PACKET_INVALID_TS;
+    double audio_start = PLM_PACKET_INVALID_TS;
+    for(int i = 0; i < trace.count; i++) {
+        sim_packet_t *p = &trace.packets[i];
+        if(p->pts == PLM_PACKET_INVALID_TS)
+            continue;
+        if(p->type == PLM_DEMUX_PACKET_VIDEO_1 && video_start == PLM_PACKET_INVALID_TS && p->pictures)
+            video_start = p->pts - trace.first_scr;
+        if(p->type == PLM_DEMUX_PACKET_AUDIO_1 && audio_start == PLM_PACKET_INVALID_TS)
+            audio_start = p->pts - trace.first_scr - audio_lead;
+    }
+
+    double frame_period = info.framerate > 0 ? 1.0 / info.framerate : 0;
+    if(info.frames_by_type[3])
+        video_start -= frame_period;
+
+    plm_scan_audio_t *audio = &info.audio[0];
+    double audio_frame_bytes = audio->bitrate ? 144.0 * audio->bitrate / audio->samplerate : 0;
+    double audio_frame_period = audio->samplerate ? (double)PLM_AUDIO_SAMPLES_PER_FRAME / audio->samplerate : 0;
+
+    int seconds = (int)(trace.packets[trace.count - 1].arrival + info.duration) + 2;
+    size_t *second_bits = calloc(seconds, sizeof(size_t));
+    sim_occupancy_t occupancy[SIM_BUFFERS];
+    memset(occupancy, 0, sizeof(occupancy));
+
+    /* Replay */
+    double delay = 0, stall_time = 0, first_stall = -1;
+    double read_clock = 0, free_time = 0;
+    size_t demux_fill = 0;
+    double *delivered = calloc(trace.count, sizeof(double));
+    int oldest = 0, stalls = 0;
+    int pictures = 0;
+    size_t audio_offset = 0;
+    int result = 1;
+
+    if(!second_bits || !delivered) {
+        fprintf(stderr, "Out of memory for the replay\n");
+        goto finish;
+    }
+
+    for(int i = 0; i < trace.count; i++) {
+        sim_packet_t *p = &trace.packets[i];
+
+        /* Read into the demux buffer once delivered packets made room */
+        while(demux_fill + p->size > demux_size && oldest < i) {
+            if(delivered[oldest] > free_time)
+                free_time = delivered[oldest];
+            demux_fill -= trace.packets[oldest].size;
+            oldest++;
+        }
+        double read_start = read_clock > free_time ? read_clock : free_time;
+        double read_done = read_start + (read_rate > 0 ? p->size / read_rate : 0);
+        read_clock = read_done;
+        demux_fill += p->size;
+
+        double deliver = p->arrival + delay;
+        if(read_done > deliver)
+            deliver = read_done;
+        delivered[i] = deliver;
+        occupancy_add(&occupancy[SIM_DEMUX], read_done, deliver, p->size);
+
+        int second = (int)deliver;
+        if(second >= 0 && second < seconds)
+            second_bits[second] += p->size * 8;
+
+        /* When its stream needs the packet, and when all of it is decoded */
+        double need, done;
+        sim_buffer_t target;
+        if(p->type == PLM_DEMUX_PACKET_VIDEO_1 && video_start != PLM_PACKET_INVALID_TS) {
+            int first = pictures > 0 ? pictures - 1 : 0;
+            int last = p->pictures > 0 ? pictures + p->pictures - 1 : first;
+            need = video_start + first * frame_period;
+            done = video_start + last * frame_period;
+            pictures += p->pictures;
+            target = SIM_VIDEO;
+        }
+        else if(p->type == PLM_DEMUX_PACKET_AUDIO_1 && audio_frame_bytes > 0 &&
+                audio_start != PLM_PACKET_INVALID_TS) {
+            int first = (int)(audio_offset / audio_frame_bytes);
+            int last = (int)((audio_offset + p->length - 1) / audio_frame_bytes);
+            need = audio_start + first * audio_frame_period;
+            done = audio_start + last * audio_frame_period;
+            audio_offset += p->length;
+            target = SIM_AUDIO;
+        }
+        else {
+            continue;
+        }
+
+        if(deliver > need + delay) {
+            if(first_stall < 0)
+                first_stall = need + delay;
+            stalls++;
+            stall_time += deliver - (need + delay);
+            delay = deliver - need;
+        }
+        occupancy_add(&occupancy[target], deliver, done + delay, p->length);
+    }
+
+    for(int b = 0; b < SIM_BUFFERS; b++) {
+        occupancy_sweep(&occupancy[b], seconds);
+        if(occupancy[b].failed) {
+            fprintf(stderr, "Out of memory for the %s buffer\n", sim_buffer_names[b]);
+            goto finish;
+        }
+    }
+
+    /* Trim the empty tail */
+    while(seconds > 1 && !second_bits[seconds - 1] && !occupancy[SIM_VIDEO].second_peak[seconds - 1] &&
+          !occupancy[SIM_AUDIO].second_peak[seconds - 1])
+        seconds--;
+
+    size_t peak_bits = 0;
+    for(int i = 0; i < seconds; i++)
+        if(second_bits[i] > peak_bits)
+            peak_bits = second_bits[i];
+
+    printf("%s: %.2fs, %dx%d at %.3f fps, %d frames (I %d, P %d, B %d), %d GOPs of up to %d\n",
+           filename, info.duration, info.width, info.height, info.framerate, info.frames,
+           info.frames_by_type[1], info.frames_by_type[2], info.frames_by_type[3],
+           info.gops, info.max_gop_length);
+    printf("  mux rate %d kbit/s, video %d kbit/s (VBV %zu bytes), audio %d kbit/s\n",
+           info.mux_rate * 8 / 1000, info.video_bitrate / 1000, info.vbv_buffer_size,
+           audio->bitrate / 1000);
+    printf("  delivered bit rate: avg %.0f, peak %zu kbit/s\n",
+           info.duration > 0 ? info.size * 8 / info.duration / 1000 : 0.0, peak_bits / 1000);
+    if(read_rate > 0)
+        printf("  read bandwidth %.0f KB/s, demux buffer %zu bytes\n", read_rate / 1024, demux_size);
+    else
+        printf("  read bandwidth unlimited, demux buffer %zu bytes\n", demux_size);
+
+    if(stalls)
+        printf("  %d stalls, %.3fs in total, the first at %.2fs\n", stalls, stall_time, first_stall);
+    else
+        printf("  no stalls\n");
+
+    /* plmpeg doesn't follow this schedule: it demuxes only when a decoder
+       runs short, so its rings don't fill the way these buffers do and a
+       peak above a ring's size doesn't mean the ring grows */
+    size_t plm_sizes[SIM_BUFFERS] = { demux_size, req.video_ring, req.audio_ring };
+    printf("  buffer   model peak   at       plmpeg ring\n");
+    for(int b = 0; b < SIM_BUFFERS; b++)
+        printf("  %-8s %10zu   %6.2fs %10zu%s\n", sim_buffer_names[b], occupancy[b].peak,
+               occupancy[b].peak_time, plm_sizes[b],
+               occupancy[b].peak > plm_sizes[b] ? "  (model peak above ring)" : "");
+
+    if(per_second) {
+        printf("  second  kbit/s    demux    video    audio\n");
+        for(int i = 0; i < seconds; i++)
+            printf("  %6d %7zu %8zu %8zu %8zu\n", i, second_bits[i] / 1000,
+                   occupancy[SIM_DEMUX].second_peak[i], occupancy[SIM_VIDEO].second_peak[i],
+                   occupancy[SIM_AUDIO].second_peak[i]);
+    }
+
+    print_strip("bit rate", second_bits, seconds);
+    for(int b = 0; b < SIM_BUFFERS; b++)
+        print_strip(sim_buffer_names[b], occupancy[b].second_peak, seconds);
+    if(seconds > SIM_STRIP_WIDTH)
+        printf("  (first %d of %d seconds)\n", SIM_STRIP_WIDTH, seconds);
+
+    result = stalls ? 2 : 0;
+
+finish:
+    for(int b = 0; b < SIM_BUFFERS; b++) {
+        free(occupancy[b].events);
+        free(occupancy[b].second_peak);
+    }
+    free(delivered);
+    free(second_bits);
+    free(trace.packets);
+
+    return result;
+}
@@ -0,0 +1,468 @@
+/**
+ * \file example_export.c
+ * \brief Export an MPEG file to raw Y4M or RGB video and WAV audio on a host
+ *
+ * Decodes with the plm_* API and writes the results as fast as the disk
+ * takes them. Y4M output is the decoder's own 4:2:0 planes, handed to
+ * writev() straight from the frame buffers without conversion or copying.
+ * RGB output converts frames on worker threads while the main thread keeps
+ * decoding, and writes them in order.
+ *
+ * Usage: mpeg_export [-r] [-t threads] [-a out.wav] file.mpg out.y4m|out.rgb
+ *   -r  write packed RGB24 frames (raw, no header) instead of Y4M
+ *   -t  conversion threads for -r; also decodes audio on its own thread
+ *   -a  write the audio to a 16-bit PCM WAV file
+ *
+ * Use - as the video output to only export the audio. Raw RGB plays with
+ * e.g. ffplay -f rawvideo -pixel_format rgb24 -video_size WxH out.rgb.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+#include <unistd.h>
+#include "mpeg.h"
+#include "pl_mpeg.h"
+
+#ifndef IOV_MAX
+#define IOV_MAX 1024
+#endif
+
+#define EXPORT_MAX_THREADS 16
+
+/* writev() everything, resuming after short writes */
+static bool write_all(int fd, struct iovec *iov, int count) {
+    while(count > 0) {
+        int n = count < IOV_MAX ? count : IOV_MAX;
+        ssize_t written = writev(fd, iov, n);
+
+        if(written < 0) {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+
+        while(n > 0 && (size_t)written >= iov->iov_len) {
+            written -= iov->iov_len;
+            iov++;
+            count--;
+            n--;
+        }
+        if(n > 0) {
+            iov->iov_base = (uint8_t *)iov->iov_base + written;
+            iov->iov_len -= written;
+        }
+    }
+
+    return true;
+}
+
+static bool write_bytes(int fd, const void *data, size_t size) {
+    struct iovec iov = { (void *)data, size };
+    return write_all(fd, &iov, 1);
+}
+
+
+/* Y4M: one span per plane when the planes are exactly the display size,
+   otherwise one span per row to drop the macroblock padding */
+
+static int add_plane(struct iovec *iov, const plm_plane_t *plane,
+                     unsigned int width, unsigned int height) {
+    if(plane->width == width) {
+        iov->iov_base = plane->data;
+        iov->iov_len = (size_t)width * height;
+        return 1;
+    }
+
+    for(unsigned int row = 0; row < height; row++) {
+        iov[row].iov_base = plane->data + (size_t)row * plane->width;
+        iov[row].iov_len = width;
+    }
+    return height;
+}
+
+static bool write_y4m_header(int fd, plm_t *plm) {
+    char header[128];
+    double framerate = plm_get_framerate(plm);
+    int num, den;
+
+    /* The NTSC rates are n * 1000 / 1001 */
+    if(fabs(framerate * 1001 / 1000 - round(framerate * 1001 / 1000)) < 1e-3 &&
+       fabs(framerate - round(framerate)) > 1e-3) {
+        num = (int)round(framerate * 1001);
+        den = 1001;
+    }
+    else {
+        num = (int)round(framerate * 1000);
+        den = 1000;
+        while(num % 10 == 0 && den % 10 == 0) {
+            num /= 10;
+            den /= 10;
+        }
+    }
+
+    /* MPEG-1 sites chroma between the luma samples, like JPEG */
+    int len = snprintf(header, sizeof(header), "YUV4MPEG2 W%d H%d F%d:%d Ip A1:1 C420jpeg\n",
+                       plm_get_width(plm), plm_get_height(plm), num, den);
+    return write_bytes(fd, header, len);
+}
+
+static bool write_y4m_frame(int fd, plm_frame_t *frame, struct iovec *iov) {
+    static char tag[] = "FRAME\n";
+    unsigned int cw = (frame->width + 1) / 2;
+    unsigned int ch = (frame->height + 1) / 2;
+    int count = 0;
+
+    iov[count].iov_base = tag;
+    iov[count].iov_len = sizeof(tag) - 1;
+    count++;
+    count += add_plane(&iov[count], &frame->y, frame->width, frame->height);
+    count += add_plane(&iov[count], &frame->cb, cw, ch);
+    count += add_plane(&iov[count], &frame->cr, cw, ch);
+
+    return write_all(fd, iov, count);
+}
+
+
+/* WAV: 16-bit interleaved PCM; the sizes are patched in when done */
+
+static bool write_wav_header(int fd, int samplerate, uint32_t data_size) {
+    uint8_t h[44];
+    uint32_t byte_rate = samplerate * 4;
+
+    memcpy(h, "RIFF", 4);
+    h[4] = (data_size + 36); h[5] = (data_size + 36) >> 8;
+    h[6] = (data_size + 36) >> 16; h[7] = (data_size + 36) >> 24;
+    memcpy(h + 8, "WAVEfmt ", 8);
+    h[16] = 16; h[17] = h[18] = h[19] = 0;
+    h[20] = 1; h[21] = 0;                       /* PCM */
+    h[22] = 2; h[23] = 0;                       /* Stereo */
+    h[24] = samplerate; h[25] = samplerate >> 8;
+    h[26] = samplerate >> 16; h[27] = samplerate >> 24;
+    h[28] = byte_rate; h[29] = byte_rate >> 8;
+    h[30] = byte_rate >> 16; h[31] = byte_rate >> 24;
+    h[32] = 4; h[33] = 0;                       /* Block align */
+    h[34] = 16; h[35] = 0;                      /* Bits per sample */
+    memcpy(h + 36, "data", 4);
+    h[40] = data_size; h[41] = data_size >> 8;
+    h[42] = data_size >> 16; h[43] = data_size >> 24;
+
+    return pwrite(fd, h, sizeof(h), 0) == sizeof(h);
+}
+
+
+/* RGB: frames are copied into slots and converted by the workers. Slot
+   seq % count holds frame seq; before it is reused, frame seq - count is
+   written, so frames reach the file in order. */
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_QUEUED,
+    SLOT_BUSY,
+    SLOT_DONE
+} slot_state_t;
+
+typedef struct {
+    slot_state_t state;
+    plm_frame_t frame;
+    uint8_t *rgb;
+} rgb_slot_t;
+
+typedef struct {
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    rgb_slot_t *slots;
+    int slot_count;
+    size_t rgb_size;
+    bool quit;
+} rgb_pool_t;
+
+static void convert(rgb_slot_t *slot) {
+    plm_frame_to_rgb(&slot->frame, slot->rgb, slot->frame.width * 3);
+}
+
+static void *rgb_worker(void *arg) {
+    rgb_pool_t *pool = arg;
+
+    pthread_mutex_lock(&pool->lock);
+    while(!pool->quit) {
+        rgb_slot_t *slot = NULL;
+
+        for(int i = 0; i < pool->slot_count && !slot; i++) {
+            if(pool->slots[i].state == SLOT_QUEUED)
+                slot = &pool->slots[i];
+        }
+        if(!slot) {
+            pthread_cond_wait(&pool->cond, &pool->lock);
+            continue;
+        }
+
+        slot->state = SLOT_BUSY;
+        pthread_mutex_unlock(&pool->lock);
+        convert(slot);
+        pthread_mutex_lock(&pool->lock);
+        slot->state = SLOT_DONE;
+        pthread_cond_broadcast(&pool->cond);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+
+static bool rgb_pool_init(rgb_pool_t *pool, plm_t *plm, int threads) {
+    unsigned int yw = (plm_get_width(plm) + 15) & ~15;
+    unsigned int yh = (plm_get_height(plm) + 15) & ~15;
+    size_t luma = (size_t)yw * yh;
+
+    memset(pool, 0, sizeof(*pool));
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->cond, NULL);
+    pool->slot_count = threads > 0 ? threads * 2 : 1;
+    pool->rgb_size = (size_t)plm_get_width(plm) * plm_get_height(plm) * 3;
+    pool->slots = calloc(pool->slot_count, sizeof(rgb_slot_t));
+    if(!pool->slots)
+        return false;
+
+    for(int i = 0; i < pool->slot_count; i++) {
+        rgb_slot_t *slot = &pool->slots[i];
+        uint8_t *planes = malloc(luma + luma / 2);
+
+        slot->rgb = malloc(pool->rgb_size);
+        if(!planes || !slot->rgb) {
+            free(planes);
+            return false;
+        }
+        slot->frame.width = plm_get_width(plm);
+        slot->frame.height = plm_get_height(plm);
+        slot->frame.y = (plm_plane_t){ yw, yh, planes };
+        slot->frame.cr = (plm_plane_t){ yw / 2, yh / 2, planes + luma };
+        slot->frame.cb = (plm_plane_t){ yw / 2, yh / 2, planes + luma + luma / 4 };
+    }
+
+    return true;
+}
+
+static void rgb_pool_free(rgb_pool_t *pool) {
+    if(pool->slots) {
+        for(int i = 0; i < pool->slot_count; i++) {
+            free(pool->slots[i].frame.y.data);
+            free(pool->slots[i].rgb);
+        }
+        free(pool->slots);
+    }
+    pthread_cond_destroy(&pool->cond);
+    pthread_mutex_destroy(&pool->lock);
+}
+
+/* Wait for the slot's frame to be converted, write it and free the slot */
+static bool rgb_slot_flush(rgb_pool_t *pool, rgb_slot_t *slot, int fd) {
+    pthread_mutex_lock(&pool->lock);
+    while(slot->state == SLOT_QUEUED || slot->state == SLOT_BUSY)
+        pthread_cond_wait(&pool->cond, &pool->lock);
+    bool had_frame = slot->state == SLOT_DONE;
+    slot->state = SLOT_FREE;
+    pthread_mutex_unlock(&pool->lock);
+
+    return !had_frame || write_bytes(fd, slot->rgb, pool->rgb_size);
+}
+
+
+typedef struct {
+    int video_fd;
+    int audio_fd;
+    bool rgb;
+    bool threaded;
+    rgb_pool_t pool;
+    uint64_t frames;
+    uint64_t pcm_bytes;
+    struct iovec *iov;
+    bool failed;
+} export_t;
+
+static void on_video(plm_t *plm, plm_frame_t *frame, void *user) {
+    export_t *ex = user;
+    (void)plm;
+
+    if(ex->failed)
+        return;
+
+    if(!ex->rgb) {
+        ex->failed = !write_y4m_frame(ex->video_fd, frame, ex->iov);
+    }
+    else {
+        rgb_pool_t *pool = &ex->pool;
+        rgb_slot_t *slot = &pool->slots[ex->frames % pool->slot_count];
+
+        if(!rgb_slot_flush(pool, slot, ex->video_fd)) {
+            ex->failed = true;
+            return;
+        }
+
+        slot->frame.time = frame->time;
+        memcpy(slot->frame.y.data, frame->y.data, (size_t)frame->y.width * frame->y.height);
+        memcpy(slot->frame.cr.data, frame->cr.data, (size_t)frame->cr.width * frame->cr.height);
+        memcpy(slot->frame.cb.data, frame->cb.data, (size_t)frame->cb.width * frame->cb.height);
+
+        if(!ex->threaded) {
+            convert(slot);
+            slot->state = SLOT_DONE;
+        }
+        else {
+            pthread_mutex_lock(&pool->lock);
+            slot->state = SLOT_QUEUED;
+            pthread_cond_signal(&pool->cond);
+            pthread_mutex_unlock(&pool->lock);
+        }
+    }
+    ex->frames++;
+}
+
+static void on_audio(plm_t *plm, plm_samples_t *samples, void *user) {
+    export_t *ex = user;
+    size_t size = samples->count * 2 * sizeof(short);
+    (void)plm;
+
+    if(ex->failed)
+        return;
+
+    ex->failed = !write_bytes(ex->audio_fd, samples->pcm, size);
+    ex->pcm_bytes += size;
+}
+
+static int open_output(const char *filename) {
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        fprintf(stderr, "Can not open %s: %s\n", filename, strerror(errno));
+    return fd;
+}
+
+int main(int argc, char **argv) {
+    const char *in = NULL, *out = NULL, *wav = NULL;
+    pthread_t workers[EXPORT_MAX_THREADS];
+    int threads = 0, started = 0;
+    int result = 1;
+    export_t ex;
+
+    memset(&ex, 0, sizeof(ex));
+    ex.video_fd = ex.audio_fd = -1;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-r"))
+            ex.rgb = true;
+        else if(!strcmp(argv[i], "-t") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-a") && i + 1 < argc)
+            wav = argv[++i];
+        else if(!in)
+            in = argv[i];
+        else
+            out = argv[i];
+    }
+
+    if(!in || !out) {
+        fprintf(stderr, "usage: %s [-r] [-t threads] [-a out.wav] file.mpg out.y4m|out.rgb\n", argv[0]);
+        return 1;
+    }
+    if(threads < 0)
+        threads = 0;
+    if(threads > EXPORT_MAX_THREADS)
+        threads = EXPORT_MAX_THREADS;
+
+    plm_t *plm = plm_create_with_filename(in);
+    if(!plm || !plm_has_headers(plm)) {
+        fprintf(stderr, "Can not read %s\n", in);
+        plm_destroy(plm);
+        return 1;
+    }
+
+    bool video = strcmp(out, "-") && plm_get_num_video_streams(plm) > 0;
+    bool audio = wav && plm_get_num_audio_streams(plm) > 0;
+
+    plm_set_video_enabled(plm, video);
+    plm_set_audio_enabled(plm, audio);
+    plm_set_video_decode_callback(plm, on_video, &ex);
+    plm_set_audio_decode_callback(plm, on_audio, &ex);
+    plm_set_threaded(plm, threads > 0 && video && audio);
+
+    /* Only reference pictures reach the planes by default */
+    plm_set_video_fill_planes(plm, video);
+
+    if(video) {
+        ex.video_fd = open_output(out);
+        if(ex.video_fd < 0)
+            goto finish;
+
+        if(ex.rgb) {
+            if(!rgb_pool_init(&ex.pool, plm, threads))
+                goto finish;
+            /* Fewer workers only convert slower; none converts inline */
+            for(; started < threads; started++) {
+                if(pthread_create(&workers[started], NULL, rgb_worker, &ex.pool) != 0) {
+                    fprintf(stderr, "Can not start worker %d of %d\n", started + 1, threads);
+                    break;
+                }
+            }
+            ex.threaded = started > 0;
+        }
+        else {
+            /* "FRAME" plus at most one span per row of each plane; the
+               chroma planes have (height + 1) / 2 rows each */
+            ex.iov = malloc(sizeof(struct iovec) * (2 + plm_get_height(plm) * 2));
+            if(!ex.iov || !write_y4m_header(ex.video_fd, plm))
+                goto finish;
+        }
+    }
+
+    if(audio) {
+        ex.audio_fd = open_output(wav);
+        if(ex.audio_fd < 0 || !write_wav_header(ex.audio_fd, plm_get_samplerate(plm), 0) ||
+           lseek(ex.audio_fd, 44, SEEK_SET) != 44)
+            goto finish;
+    }
+
+    /* Decode in timestamp order, as fast as possible */
+    while(!plm_has_ended(plm) && !ex.failed)
+        plm_decode(plm, 1.0);
+
+    if(ex.rgb && video) {
+        uint64_t first = ex.frames > (uint64_t)ex.pool.slot_count ? ex.frames - ex.pool.slot_count : 0;
+        for(uint64_t seq = first; seq < ex.frames && !ex.failed; seq++)
+            ex.failed = !rgb_slot_flush(&ex.pool, &ex.pool.slots[seq % ex.pool.slot_count], ex.video_fd);
+    }
+
+    if(audio && !ex.failed)
+        ex.failed = !write_wav_header(ex.audio_fd, plm_get_samplerate(plm), (uint32_t)ex.pcm_bytes);
+
+    if(ex.failed)
+        fprintf(stderr, "Write error: %s\n", strerror(errno));
+    else
+        result = 0;
+
+    printf("%llu frames, %llu PCM bytes\n", (unsigned long long)ex.frames, (unsigned long long)ex.pcm_bytes);
+
+finish:
+    if(ex.threaded) {
+        pthread_mutex_lock(&ex.pool.lock);
+        ex.pool.quit = true;
+        pthread_cond_broadcast(&ex.pool.cond);
+        pthread_mutex_unlock(&ex.pool.lock);
+        for(int i = 0; i < started; i++)
+            pthread_join(workers[i], NULL);
+    }
+    if(ex.pool.slots)
+        rgb_pool_free(&ex.pool);
+    free(ex.iov);
+    if(ex.video_fd >= 0)
+        close(ex.video_fd);
+    if(ex.audio_fd >= 0)
+        close(ex.audio_fd);
+    plm_destroy(plm);
+
+    return result;
+}
@@ -0,0 +1,215 @@
+/**
+ * \file example_headless.c
+ * \brief Headless MPEG playback on a host
+ *
+ * Runs the same player loop as the Dreamcast examples through the headless
+ * backend, which consumes frames and PCM instead of drawing and playing them.
+ * Use it to benchmark decoding and to check that playback, looping and A/V
+ * sync still behave after a change.
+ *
+ * Usage: headless [-u] [-s] [-A] [-e audio.mp2] [-w count] [-t threads] file.mpg
+ *        headless -b [-t threads] file.mpg...
+ *   -u  unthrottled: don't wait for frame times, run as fast as it decodes
+ *   -s  use mpeg_decode_step() instead of mpeg_play_ex()
+ *   -A  adapt the audio depth to the content (adaptive_audio)
+ *   -e  file is an elementary video stream (.m1v); play it with this
+ *       elementary audio stream
+ *   -w  play count copies at once through a scheduler, the first one with
+ *       the highest priority
+ *   -t  worker threads for the scheduler or the batch decoder
+ *   -b  decode all files as fast as possible with the batch decoder and
+ *       print one line of results per file
+ *
+ * The checksums printed at the end only depend on the clip, so an
+ * unthrottled run makes a quick end-to-end regression test.
+ *
+ * To try the motion-compensation prefetch lookahead, rebuild with
+ * `make clean && make PREFETCH_DISTANCE=n` and compare the decode timings of
+ * unthrottled runs against the default of 0, which turns it off.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "mpeg.h"
+
+static void print_timing(const char *name, const mpeg_timing_stats_t *t) {
+    printf("  %-9s n=%-6u min=%-6u avg=%-6u p99=%-6u max=%u us\n",
+           name, t->count, t->min_us, t->avg_us, t->p99_us, t->max_us);
+}
+
+static void print_stats(mpeg_player_t *player) {
+    mpeg_player_stats_t stats;
+    mpeg_headless_stats_t consumed;
+
+    mpeg_player_get_stats(player, &stats);
+    print_timing("decode", &stats.decode);
+    print_timing("decode I", &stats.decode_i);
+    print_timing("decode P", &stats.decode_p);
+    print_timing("decode B", &stats.decode_b);
+    print_timing("upload", &stats.upload);
+    print_timing("lateness", &stats.lateness);
+    print_timing("audio gap", &stats.audio_gap);
+    printf("  frames shown=%u late=%u dropped=%u, audio underruns=%u\n",
+           stats.frames_shown, stats.frames_late, stats.frames_dropped,
+           stats.audio_underruns);
+    printf("  audio depth=%d peak=%d bytes, starved=%u\n",
+           stats.audio_depth, stats.audio_depth_peak, stats.audio_starved);
+
+    if(mpeg_player_get_headless_stats(player, &consumed))
+        printf("  consumed %u frames (checksum %08x), %llu PCM bytes (checksum %08x)\n",
+               consumed.frames, consumed.frame_checksum,
+               (unsigned long long)consumed.pcm_bytes, consumed.pcm_checksum);
+}
+
+static int decode_batch(const char **filenames, int count, int threads) {
+    mpeg_batch_t *batch = mpeg_batch_create(threads);
+    mpeg_batch_result_t *results = calloc(count, sizeof(mpeg_batch_result_t));
+    double seconds = 0.0;
+    int decoded = 0;
+
+    if(batch && results) {
+        decoded = mpeg_batch_decode(batch, filenames, count, results);
+
+        for(int i = 0; i < count; i++) {
+            const mpeg_batch_result_t *r = &results[i];
+
+            if(!r->ok) {
+                printf("%s: failed\n", filenames[i]);
+                continue;
+            }
+
+            printf("%s: %.2fs, %u frames (checksum %08x), %llu PCM bytes (checksum %08x), "
+                   "%u us, arena %zu\n",
+                   filenames[i], r->duration, r->frames, r->frame_checksum,
+                   (unsigned long long)r->pcm_bytes, r->pcm_checksum, r->decode_us, r->arena_used);
+            seconds += r->duration;
+        }
+        printf("%d of %d files, %.2fs of media\n", decoded, count, seconds);
+    }
+
+    free(results);
+    mpeg_batch_destroy(batch);
+
+    return decoded == count ? 0 : 1;
+}
+
+static int play_wall(const char *filename, const mpeg_player_options_t *options,
+                     int count, int threads) {
+    mpeg_player_t *players[MPEG_SCHEDULER_MAX_STREAMS];
+    mpeg_scheduler_t *sched = mpeg_scheduler_create(threads);
+    int created = 0;
+    int result = 0;
+
+    if(!sched)
+        return 1;
+
+    for(; created < count; created++) {
+        players[created] = mpeg_player_create_ex(filename, options);
+        if(!players[created]) {
+            result = 1;
+            goto finish;
+        }
+        mpeg_scheduler_add(sched, players[created], created == 0 ? 1 : 0);
+    }
+
+    while(true) {
+        bool ended = true;
+
+        mpeg_scheduler_update(sched, 0);
+        for(int i = 0; i < count; i++) {
+            mpeg_upload_frame(players[i]);
+            mpeg_draw_frame(players[i]);
+            ended = ended && mpeg_scheduler_has_ended(sched, players[i]);
+        }
+
+        if(ended)
+            break;
+    }
+
+finish:
+    mpeg_scheduler_destroy(sched);
+    for(int i = 0; i < created; i++) {
+        printf("stream %d:\n", i);
+        print_stats(players[i]);
+        mpeg_player_destroy(players[i]);
+    }
+
+    return result;
+}
+
+int main(int argc, char **argv) {
+    mpeg_player_options_t options = MPEG_PLAYER_OPTIONS_INITIALIZER;
+    const char *filename = NULL;
+    const char *audio_filename = NULL;
+    const char **filenames = calloc(argc, sizeof(char *));
+    int file_count = 0;
+    bool batch = false;
+    bool step = false;
+    int wall = 0;
+    int threads = 0;
+
+    options.backend = MPEG_BACKEND_HEADLESS;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strcmp(argv[i], "-u"))
+            options.backend = MPEG_BACKEND_HEADLESS_UNTHROTTLED;
+        else if(!strcmp(argv[i], "-s"))
+            step = true;
+        else if(!strcmp(argv[i], "-b"))
+            batch = true;
+        else if(!strcmp(argv[i], "-A"))
+            options.adaptive_audio = true;
+        else if(!strcmp(argv[i], "-e") && i + 1 < argc)
+            audio_filename = argv[++i];
+        else if(!strcmp(argv[i], "-w") && i + 1 < argc)
+            wall = atoi(argv[++i]);
+        else if(!strcmp(argv[i], "-t") && i + 1 < argc)
+            threads = atoi(argv[++i]);
+        else
+            filename = filenames[file_count++] = argv[i];
+    }
+
+    if(batch && file_count > 0) {
+        int result = decode_batch(filenames, file_count, threads);
+        free(filenames);
+        return result;
+    }
+    free(filenames);
+
+    if(!filename) {
+        fprintf(stderr, "usage: %s [-u] [-s] [-A] [-e audio.mp2] [-w count] [-t threads] file.mpg\n"
+                        "       %s -b [-t threads] file.mpg...\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    if(wall > MPEG_SCHEDULER_MAX_STREAMS)
+        wall = MPEG_SCHEDULER_MAX_STREAMS;
+    if(wall > 0)
+        return play_wall(filename, &options, wall, threads);
+
+    mpeg_player_t *player = audio_filename
+        ? mpeg_player_create_elementary_ex(filename, audio_filename, &options)
+        : mpeg_player_create_ex(filename, &options);
+    if(!player)
+        return 1;
+
+    if(step) {
+        mpeg_decode_result_t result;
+        while((result = mpeg_decode_step(player)) != MPEG_DECODE_EOF) {
+            if(result == MPEG_DECODE_ERROR)
+                break;
+            if(result == MPEG_DECODE_FRAME)
+                mpeg_upload_frame(player);
+            mpeg_draw_frame(player);
+        }
+    }
+    else {
+        mpeg_play_ex(player, NULL);
+    }
+
+    print_stats(player);
+    mpeg_player_destroy(player);
+
+    return 0;
+}
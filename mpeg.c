@@ -1,14 +1,78 @@
+#ifdef _arch_dreamcast
 #include <kos.h>
+#else
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#endif
 #include "mpeg.h"
 #define PL_MPEG_IMPLEMENTATION
 #include "pl_mpeg.h"
 
+/* Log-linear histogram of microseconds: values below 16 get a bucket each,
+   every octave above is split in 8 buckets up to about one second. */
+#define MPEG_HIST_LINEAR 16
+#define MPEG_HIST_OCTAVES 16
+#define MPEG_HIST_BUCKETS (MPEG_HIST_LINEAR + MPEG_HIST_OCTAVES * 8)
+
+typedef struct mpeg_timing_t {
+    uint32_t count;
+    uint32_t min_us;
+    uint32_t max_us;
+    uint64_t total_us;
+    uint32_t buckets[MPEG_HIST_BUCKETS];
+} mpeg_timing_t;
+
+typedef struct mpeg_stats_t {
+    mpeg_timing_t decode[4];    /* All frames, then by picture type 1-3 */
+    mpeg_timing_t upload;
+    mpeg_timing_t lateness;
+    uint32_t frames_shown;
+    uint32_t frames_late;
+    uint32_t frames_dropped;
+    uint32_t audio_underruns;
+    mpeg_timing_t audio_gap;
+    uint32_t audio_starved;
+    uint32_t audio_depth_peak;
+} mpeg_stats_t;
+
+/* Everything the player needs from the platform: a video sink, an audio sink,
+   a clock and input. The KOS backend drives the PVR, AICA and maple; the
+   headless one only consumes what it is given, on any platform. */
+typedef struct mpeg_backend_t {
+    uint64_t (*time_ns)(mpeg_player_t *player);
+    /* Nothing is due before until_ns */
+    void (*idle)(mpeg_player_t *player, uint64_t until_ns);
+
+    int  (*video_init)(mpeg_player_t *player, const mpeg_player_options_t *opts);
+    void (*video_destroy)(mpeg_player_t *player);
+    void (*video_upload)(mpeg_player_t *player);
+    void (*video_draw)(mpeg_player_t *player);
+    /* Show the current frame on its own, as mpeg_play_ex() does */
+    void (*video_present)(mpeg_player_t *player);
+    /* Upload a freshly decoded frame ahead of its present, if that is safe */
+    void (*video_prepare)(mpeg_player_t *player);
+    /* Whether video_present() can start without blocking */
+    bool (*video_ready)(mpeg_player_t *player);
+    /* Before mpeg_play_ex() presents its first frame */
+    void (*video_start)(mpeg_player_t *player);
+
+    int  (*audio_init)(mpeg_player_t *player);
+    void (*audio_destroy)(mpeg_player_t *player);
+    void (*audio_start)(mpeg_player_t *player);
+    void (*audio_stop)(mpeg_player_t *player);
+    void (*audio_poll)(mpeg_player_t *player);
+    void (*audio_volume)(mpeg_player_t *player);
+
+    int  (*check_cancel)(mpeg_player_t *player, const mpeg_cancel_options_t *opt);
+} mpeg_backend_t;
+
 struct mpeg_player_t {
     plm_t *decoder;
     plm_frame_t *frame;
     uint64_t start_time;
-    snd_stream_hnd_t snd_hnd;
-    pvr_list_type_t list_type;
+    const mpeg_backend_t *backend;
     size_t texture_width;
     size_t texture_height;
 
@@ -20,21 +84,76 @@ struct mpeg_player_t {
     int snd_volume;
     bool snd_started;
 
-    pvr_poly_hdr_t hdr;
+#ifdef _arch_dreamcast
+    snd_stream_hnd_t snd_hnd;
+    pvr_list_type_t list_type;
+    pvr_poly_hdr_t hdr[MPEG_MAX_TEXTURES];
     pvr_vertex_t vert[4];
 
-    pvr_ptr_t texture;
+    /* Textures alternate when there is more than one. Each one is fenced
+       with the PVR frame count at which the last scene that drew it will
+       have been rendered. */
+    pvr_ptr_t texture[MPEG_MAX_TEXTURES];
+    size_t texture_fence[MPEG_MAX_TEXTURES];
+
+    /* A stalled texture wait fell back to pvr_wait_ready(), which took the
+       ready state the next present would have waited for */
+    bool pvr_ready_taken;
+#endif
+    int texture_count;
+    int texture_index;
+
+    /* Fence of the last scene mpeg_play_ex() built itself, 0 when scenes
+       built elsewhere may be in flight */
+    size_t scene_fence;
+
+    /* Display refresh period that mpeg_play_ex() schedules frames on */
+    uint64_t refresh_ns;
+
+    /* Display buffer of the frame already in a texture, either streamed row
+       by row or uploaded ahead of its present, so mpeg_upload_frame() can
+       skip it. */
+    const uint32_t *uploaded_display;
+    uint64_t streamed_upload_ns;
+
+    /* Headless backend: the unthrottled clock, which only moves when the
+       player would otherwise wait, and how much PCM the audio sink has taken
+       since it started. */
+    bool unthrottled;
+    uint64_t virtual_ns;
+    uint64_t pcm_consumed;
+    mpeg_headless_stats_t headless;
+
+    /* Adaptive audio depth: PCM handed to the sound stream since it started
+       at audio_start_time, when it was last filled, and a slowly decaying
+       peak of the time between fills that the depth has to bridge. */
+    bool adaptive_audio;
+    uint64_t audio_start_time;
+    uint64_t audio_written;
+    uint64_t audio_last_fill;
+    uint64_t audio_gap_peak_ns;
+    int audio_depth;
+
+    mpeg_stats_t stats;
+    bool frame_presented;
+    bool d_pictures_only;
     int width;
     int height;
     bool loop;
+    bool in_arena;
 };
 
 /* Size of the sound buffer for both the SH4 side and the AICA side */
 #define SOUND_BUFFER (64 * 1024)
 #define AUDIO_CHANNELS 2
 
-static int setup_graphics(mpeg_player_t *player, const mpeg_player_options_t *options);
-static int setup_audio(mpeg_player_t *player);
+/* In arena mode the player struct and sound buffer sit at the front of the
+   caller's block; the decoder gets the rest. */
+#define MPEG_ARENA_ALIGN(sz) (((sz) + 31) & ~(size_t)31)
+#define MPEG_ARENA_HEAD_SIZE (MPEG_ARENA_ALIGN(sizeof(mpeg_player_t)) + SOUND_BUFFER)
+
+static int mpeg_pcm_fill(mpeg_player_t *player, int request_size);
+static int mpeg_audio_allow(mpeg_player_t *player, int request_size);
 static void fast_memcpy(void *dest, const void *src, size_t length);
 
 static uint32_t next_power_of_two(uint32_t n) {
@@ -52,464 +171,363 @@ static uint32_t next_power_of_two(uint32_t n) {
     return n;
 }
 
-static inline void sound_stream_reset(mpeg_player_t *player) {
-    if(!player)
-        return;
+static int mpeg_hist_bucket(uint32_t us) {
+    if(us < MPEG_HIST_LINEAR)
+        return us;
 
-    if(player->snd_hnd != SND_STREAM_INVALID && player->snd_started) {
-        snd_stream_stop(player->snd_hnd);
-        player->snd_started = false;
-    }
+    int octave = 31 - __builtin_clz(us);
+    int bucket = MPEG_HIST_LINEAR + (octave - 4) * 8 + ((us >> (octave - 3)) & 7);
 
-    player->snd_pcm_leftovers = 0;
-    player->snd_pcm_offset = 0;
+    return bucket < MPEG_HIST_BUCKETS ? bucket : MPEG_HIST_BUCKETS - 1;
 }
 
-static int mpeg_check_cancel(const mpeg_cancel_options_t *opt) {
-    if(!opt) return 0;
-
-    /*   Controller Cancel   */
-    MAPLE_FOREACH_BEGIN(MAPLE_FUNC_CONTROLLER, cont_state_t, st)
-        if(opt->pad_button_any && (st->buttons & opt->pad_button_any))
-            return 1;
-
-        if(opt->pad_button_combo &&
-            (st->buttons & opt->pad_button_combo) == opt->pad_button_combo)
-            return 1;
-
-        /* Always cancel on reset combo */
-        if(st->buttons == CONT_RESET_BUTTONS)
-            return 2;
-    MAPLE_FOREACH_END()
-
-    /*   Keyboard Cancel   */
-    MAPLE_FOREACH_BEGIN(MAPLE_FUNC_KEYBOARD, kbd_state_t, kbd_st)
-        for(size_t i = 0; i < opt->kbd_keys_any_count; ++i) {
-            if(kbd_st->key_states[opt->kbd_keys_any[i]].is_down)
-                return 1;
-        }
-
-        int all_pressed = 1;
-        for(size_t i = 0; i < opt->kbd_keys_combo_count; ++i) {
-            if(!kbd_st->key_states[opt->kbd_keys_combo[i]].is_down) {
-                all_pressed = 0;
-                break;
-            }
-        }
+/* Largest value that falls into a bucket */
+static uint32_t mpeg_hist_bucket_max(int bucket) {
+    if(bucket < MPEG_HIST_LINEAR)
+        return bucket;
 
-        if(opt->kbd_keys_combo_count && all_pressed)
-            return 1;
-    MAPLE_FOREACH_END()
+    int shift = (bucket - MPEG_HIST_LINEAR) / 8 + 1;
+    int sub = (bucket - MPEG_HIST_LINEAR) % 8;
 
-    return 0;
+    return ((uint32_t)(8 + sub + 1) << shift) - 1;
 }
 
-/** Default MPEG player options used when NULL is passed to *_ex() functions. */
-static const mpeg_player_options_t MPEG_PLAYER_OPTIONS_DEFAULT = MPEG_PLAYER_OPTIONS_INITIALIZER;
-
-static bool mpeg_player_init(mpeg_player_t *player, const mpeg_player_options_t *opts) {
-    /* Never let plm loop internally — it rewinds without resetting our
-       start_time, which causes playback_time >> frame->time and the video
-       plays at max speed.  We store the flag ourselves and rewind manually
-       so that start_time and audio are properly re-initialized. */
-    player->loop = opts->loop;
-    plm_set_loop(player->decoder, 0);
-
-    player->snd_buf = (uint8_t *)MPEG_MEMALIGN(32, SOUND_BUFFER);
-    if(!player->snd_buf) {
-        fprintf(stderr, "Out of memory for player->snd_buf\n");
-        mpeg_player_destroy(player);
-        return false;
-    }
-
-    player->list_type = opts->list_type;
-    if(setup_graphics(player, opts) < 0) {
-        fprintf(stderr, "Setting up graphics failed\n");
-        mpeg_player_destroy(player);
-        return false;
-    }
+static void mpeg_timing_add(mpeg_timing_t *t, uint64_t ns) {
+    uint32_t us = (uint32_t)(ns / 1000);
 
-    player->snd_volume = opts->volume;
-    if(setup_audio(player) < 0) {
-        fprintf(stderr, "Setting up audio failed\n");
-        mpeg_player_destroy(player);
-        return false;
-    }
+    if(t->count == 0 || us < t->min_us)
+        t->min_us = us;
+    if(us > t->max_us)
+        t->max_us = us;
 
-    return true;
+    t->count++;
+    t->total_us += us;
+    t->buckets[mpeg_hist_bucket(us)]++;
 }
 
-mpeg_player_t *mpeg_player_create_ex(const char *filename, const mpeg_player_options_t *options) {
-    mpeg_player_t *player = NULL;
-    const mpeg_player_options_t *opts = options ? options : &MPEG_PLAYER_OPTIONS_DEFAULT;
-
-    if(!filename) {
-        fprintf(stderr, "filename is NULL\n");
-        return NULL;
-    }
+static void mpeg_timing_report(const mpeg_timing_t *t, mpeg_timing_stats_t *out) {
+    MPEG_MEMZERO(out, sizeof(mpeg_timing_stats_t));
+    if(t->count == 0)
+        return;
 
-    player = (mpeg_player_t *)MPEG_MALLOC(sizeof(mpeg_player_t));
-    if(!player) {
-        fprintf(stderr, "Out of memory for player\n");
-        return NULL;
+    out->count = t->count;
+    out->min_us = t->min_us;
+    out->max_us = t->max_us;
+    out->avg_us = (uint32_t)(t->total_us / t->count);
+
+    uint32_t target = (uint32_t)(((uint64_t)t->count * 99 + 99) / 100);
+    uint32_t seen = 0;
+    for(int i = 0; i < MPEG_HIST_BUCKETS; i++) {
+        seen += t->buckets[i];
+        if(seen >= target) {
+            out->p99_us = mpeg_hist_bucket_max(i);
+            break;
+        }
     }
 
-    MPEG_MEMZERO(player, sizeof(mpeg_player_t));
-    player->snd_hnd = SND_STREAM_INVALID;
+    if(out->p99_us > out->max_us)
+        out->p99_us = out->max_us;
+}
 
-    player->decoder = plm_create_with_filename(filename);
-    if(!player->decoder) {
-        fprintf(stderr, "Out of memory for player->decoder\n");
-        mpeg_player_destroy(player);
-        return NULL;
-    }
+static inline uint64_t mpeg_now(mpeg_player_t *player) {
+    return player->backend->time_ns(player);
+}
 
-    if(!mpeg_player_init(player, opts))
-        return NULL;
+/* Wall clock for the timing stats, whatever clock the backend plays by */
+static inline uint64_t mpeg_perf_ns(void) {
+#ifdef _arch_dreamcast
+    return timer_ns_gettime64();
+#else
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+#endif
+}
 
-    return player;
+/* Player clock time at which the current frame is due */
+static uint64_t mpeg_frame_time(mpeg_player_t *player) {
+    return player->start_time + (uint64_t)(player->frame->time * 1e9) + 1;
 }
 
-mpeg_player_t *mpeg_player_create_memory_ex(unsigned char *memory, const size_t length, const mpeg_player_options_t *options) {
-    mpeg_player_t *player = NULL;
-    const mpeg_player_options_t *opts = options ? options : &MPEG_PLAYER_OPTIONS_DEFAULT;
+/* Player clock time at which to present the current frame. Each frame is
+   planned onto the refresh nearest its timestamp, on a grid of refreshes from
+   start_time, and handed over one refresh ahead so it is rendered in time to
+   flip there. Frames at 24 fps on a 60 Hz display then fall into a steady
+   3:2 cadence from their timestamps alone, however the decode times vary. */
+static uint64_t mpeg_frame_due(mpeg_player_t *player) {
+    if(!player->refresh_ns)
+        return mpeg_frame_time(player);
 
-    if(!memory) {
-        fprintf(stderr, "memory is NULL\n");
-        return NULL;
-    }
+    uint64_t t = (uint64_t)(player->frame->time * 1e9);
+    uint64_t slot = (t + player->refresh_ns / 2) / player->refresh_ns;
 
-    player = (mpeg_player_t *)MPEG_MALLOC(sizeof(mpeg_player_t));
-    if(!player) {
-        fprintf(stderr, "Out of memory for player\n");
-        return NULL;
-    }
+    return player->start_time + (slot ? slot - 1 : 0) * player->refresh_ns;
+}
 
-    MPEG_MEMZERO(player, sizeof(mpeg_player_t));
-    player->snd_hnd = SND_STREAM_INVALID;
+/* Called whenever the current frame is handed to the video sink; only the
+   first time counts as its presentation. */
+static void mpeg_frame_presented(mpeg_player_t *player) {
+    if(player->frame_presented || !player->frame || !player->start_time)
+        return;
 
-    player->decoder = plm_create_with_memory(memory, length, 1);
-    if(!player->decoder) {
-        fprintf(stderr, "Out of memory for player->decoder\n");
-        mpeg_player_destroy(player);
-        return NULL;
-    }
+    player->frame_presented = true;
+    player->stats.frames_shown++;
 
-    if(!mpeg_player_init(player, opts))
-        return NULL;
+    double late = (mpeg_now(player) - player->start_time) * 1e-9 - player->frame->time;
+    if(late < 0.0)
+        late = 0.0;
 
-    return player;
-}
+    mpeg_timing_add(&player->stats.lateness, (uint64_t)(late * 1e9));
 
-mpeg_player_t *mpeg_player_create(const char *filename) {
-    return mpeg_player_create_ex(filename, &MPEG_PLAYER_OPTIONS_DEFAULT);
+    double framerate = plm_get_framerate(player->decoder);
+    if(framerate > 0.0 && late > 1.0 / framerate)
+        player->stats.frames_late++;
 }
 
-mpeg_player_t *mpeg_player_create_memory(uint8_t *memory, const size_t length) {
-    return mpeg_player_create_memory_ex(memory, length, &MPEG_PLAYER_OPTIONS_DEFAULT);
+/* --- Texture fences ---
+   With more than one texture, each one is fenced with the count of PVR page
+   flips after which no scene reads it any more. These only work on the
+   counts and times they are given, so tests/ can check them against a mock
+   of the PVR on a host. */
+
+/* Refreshes without a flip after which a fence wait gives up. A render
+   that takes up to two refreshes still flips within this. */
+#define MPEG_FENCE_STALL_REFRESHES 3
+
+typedef enum mpeg_fence_state_t {
+    MPEG_FENCE_WAITING,
+    MPEG_FENCE_PASSED,
+    /* The frame count stopped moving, e.g. because nothing was submitted
+       between two uploads; there may be no scene left to wait for */
+    MPEG_FENCE_STALLED
+} mpeg_fence_state_t;
+
+typedef struct mpeg_fence_wait_t {
+    size_t frame_count;         /* Last count seen and since when */
+    uint64_t since_ns;
+} mpeg_fence_wait_t;
+
+/* Fence for a texture drawn in a scene the caller builds. The scene before
+   it may still be rendering, so this one has flipped two flips later at the
+   latest. */
+static inline size_t mpeg_fence_drawn(size_t frame_count) {
+    return frame_count + 2;
 }
 
-int mpeg_player_get_loop(mpeg_player_t *player) {
-    if(!player)
-        return -1;
+/* Fence for a texture drawn in a scene the player has just finished itself.
+   When the previous scene was the player's too, every scene in flight is
+   known: this one flips right after it, or next if it has flipped already. */
+static inline size_t mpeg_fence_finished(size_t frame_count, size_t last_fence) {
+    if(!last_fence)
+        return mpeg_fence_drawn(frame_count);
 
-    return player->loop;
+    return (last_fence > frame_count ? last_fence : frame_count) + 1;
 }
 
-void mpeg_player_set_loop(mpeg_player_t *player, int loop) {
-    if(!player)
-        return;
-
-    player->loop = loop;
+static inline void mpeg_fence_wait_start(mpeg_fence_wait_t *wait, size_t frame_count, uint64_t now_ns) {
+    wait->frame_count = frame_count;
+    wait->since_ns = now_ns;
 }
 
-void mpeg_player_set_volume(mpeg_player_t *player, uint8_t volume) {
-    if(!player)
-        return;
+/* One poll of a wait for `fence`. It only stalls when the count hasn't moved
+   for stall_ns, so a slow but steady render is still waited for. */
+static inline mpeg_fence_state_t mpeg_fence_poll(mpeg_fence_wait_t *wait, size_t fence,
+                                                 size_t frame_count, uint64_t now_ns,
+                                                 uint64_t stall_ns) {
+    if(frame_count >= fence)
+        return MPEG_FENCE_PASSED;
+
+    if(frame_count != wait->frame_count) {
+        mpeg_fence_wait_start(wait, frame_count, now_ns);
+        return MPEG_FENCE_WAITING;
+    }
 
-    player->snd_volume = volume;
-    snd_stream_volume(player->snd_hnd, player->snd_volume);
+    return now_ns - wait->since_ns >= stall_ns ? MPEG_FENCE_STALLED : MPEG_FENCE_WAITING;
 }
 
-const pvr_poly_hdr_t *mpeg_player_get_texture_hdr(mpeg_player_t *player) {
-    if(!player)
-        return NULL;
+#ifdef _arch_dreamcast
+/* --- KOS backend: PVR YUV converter, AICA sound stream and maple input --- */
 
-    return &player->hdr;
+static size_t mpeg_pvr_frame_count(void) {
+    pvr_stats_t stats;
+    pvr_get_stats(&stats);
+    return stats.frame_count;
 }
 
-void mpeg_player_get_uv_scale(mpeg_player_t *player, float *u_scale, float *v_scale) {
-    if(!player)
-        return;
+/* Mark the displayed texture as used by the scene being built. The frame
+   count goes up as each scene is rendered and flipped. Nothing is known
+   about the scenes before this one, which may be the caller's. */
+static void mpeg_texture_fence(mpeg_player_t *player) {
+    player->scene_fence = 0;
+    player->pvr_ready_taken = false;
+    if(player->texture_count > 1)
+        player->texture_fence[player->texture_index] = mpeg_fence_drawn(mpeg_pvr_frame_count());
+}
 
-    if(u_scale)
-        *u_scale = (float)player->width / (float)player->texture_width;
-    if(v_scale)
-        *v_scale = (float)player->height / (float)player->texture_height;
+/* Tighten the fence once the player has finished a scene of its own */
+static void mpeg_texture_fence_scene(mpeg_player_t *player, size_t last_fence) {
+    player->scene_fence = mpeg_fence_finished(mpeg_pvr_frame_count(), last_fence);
+    if(player->texture_count > 1)
+        player->texture_fence[player->texture_index] = player->scene_fence;
 }
 
-void mpeg_player_get_dimensions(mpeg_player_t *player, int *width, int *height) {
-    if(!player)
-        return;
+/* Wait until the PVR is done with the last scene that drew this texture. If
+   no scene flips for a while, none may be coming; wait for the PVR to be
+   idle instead of for the fence. */
+static void mpeg_texture_wait(mpeg_player_t *player, int index) {
+    const uint64_t stall_ns = MPEG_FENCE_STALL_REFRESHES * player->refresh_ns;
+    mpeg_fence_wait_t wait;
 
-    if(width)
-        *width = player->width;
-    if(height)
-        *height = player->height;
+    mpeg_fence_wait_start(&wait, mpeg_pvr_frame_count(), timer_ns_gettime64());
+    while(true) {
+        mpeg_fence_state_t state = mpeg_fence_poll(&wait, player->texture_fence[index],
+                                                   mpeg_pvr_frame_count(),
+                                                   timer_ns_gettime64(), stall_ns);
+        if(state == MPEG_FENCE_PASSED)
+            return;
+
+        if(state == MPEG_FENCE_STALLED) {
+            if(!player->pvr_ready_taken)
+                pvr_wait_ready();
+            player->pvr_ready_taken = true;
+            player->texture_fence[index] = 0;
+            return;
+        }
+
+        thd_pass();
+    }
 }
 
-void mpeg_player_reset(mpeg_player_t *player) {
-    if(!player)
-        return;
+/* Pick the texture to fill and restart the YUV converter on it. */
+static void mpeg_upload_begin(mpeg_player_t *player) {
+    if(player->texture_count > 1) {
+        int next = (player->texture_index + 1) % player->texture_count;
+        mpeg_texture_wait(player, next);
+        player->texture_index = next;
 
-    sound_stream_reset(player);
-    player->start_time = 0;
-    player->frame = NULL;
-    player->sample = NULL;
+        /* Point the YUV converter at the texture we're about to fill. */
+        PVR_SET(PVR_YUV_ADDR, (((uint32_t)player->texture[next]) & 0xffffff));
+    }
 
-    if(player->decoder)
-        plm_rewind(player->decoder);
+    /* HACK: Fix Flycast */
+    PVR_SET(PVR_YUV_CFG, (((player->texture_height >> 4) - 1) << 8) |
+                      ((player->texture_width >> 4) - 1));
 }
 
-void mpeg_player_destroy(mpeg_player_t *player) {
-    if(!player)
-        return;
+/* Feed rows of macroblocks from a display buffer to the YUV converter. */
+static void mpeg_upload_rows(mpeg_player_t *player, const uint32_t *src, int video_blocks_w, int rows) {
+    /*
+     * PVR YUV converter stride (in macroblocks).
+     * This MUST match the width configured in PVR_YUV_CFG.
+     *
+     * Example:
+     *   player->texture_width = 512 px
+     *   → stride = 512 / 16 = 32 macroblocks
+     */
+    const int pvr_blocks_per_row = player->texture_width >> 4;
+    const int pad_blocks_x = pvr_blocks_per_row - video_blocks_w;
 
-    if(player->texture) {
-        MPEG_PVR_FREE(player->texture);
-        player->texture = NULL;
-    }
+    /*
+     * Each macroblock is 384 bytes = 96 uint32_t
+     * sq_fast_cpy works in 32-byte chunks → 384 / 32 = 12 iterations
+     */
+    const int mb_sq_iters = 384 / 32;
 
-    if(player->snd_hnd != SND_STREAM_INVALID) {
-        snd_stream_destroy(player->snd_hnd);
-        player->snd_hnd = SND_STREAM_INVALID;
-    }
+    uint32_t *d = SQ_MASK_DEST((void *)PVR_TA_YUV_CONV);
+    sq_lock((void *)PVR_TA_YUV_CONV);
 
-    if(player->snd_buf) {
-        MPEG_FREE(player->snd_buf);
-        player->snd_buf = NULL;
-    }
+    for(int y = 0; y < rows; y++) {
+        /* Upload whole row of real macroblocks */
+        sq_fast_cpy(d, src, video_blocks_w * mb_sq_iters);
+        src += 96 * video_blocks_w;
 
-    if(player->decoder) {
-        plm_destroy(player->decoder);
-        player->decoder = NULL;
+        /* Pad row to PVR stride */
+        for(int i = 0; i < pad_blocks_x * mb_sq_iters; i++)
+            sq_flush(d);
     }
 
-    MPEG_FREE(player);
+    sq_unlock();
 }
 
-mpeg_play_result_t mpeg_play_ex(mpeg_player_t *player, const mpeg_cancel_options_t *cancel_options) {
-    mpeg_play_result_t result = MPEG_PLAY_NORMAL;
+/* Called by the decoder as each macroblock row of a B-picture (or of any
+   picture in no-delay mode) is finished. The row goes to the spare texture
+   while the decoder works on the next one. */
+static void mpeg_row_callback(plm_video_t *video, plm_frame_t *frame, int mb_row, void *user) {
+    mpeg_player_t *player = (mpeg_player_t *)user;
+    const int video_blocks_w = frame->y.width >> 4;
+    (void)video;
 
-    if(!player || !player->decoder)
-        return MPEG_PLAY_ERROR;
+    uint64_t start = timer_ns_gettime64();
+    if(mb_row == 0)
+        mpeg_upload_begin(player);
 
-    /* Init sound stream. */
-    sound_stream_reset(player);
-    snd_stream_start(player->snd_hnd, player->sample_rate, AUDIO_CHANNELS - 1);
-    player->snd_started = true;
+    mpeg_upload_rows(player, frame->display + mb_row * 96 * video_blocks_w, video_blocks_w, 1);
+    player->streamed_upload_ns += timer_ns_gettime64() - start;
 
-    player->frame = plm_decode_video(player->decoder);
-    if(!player->frame) {
-        /* Reset some stuff */
-        sound_stream_reset(player);
-        return MPEG_PLAY_ERROR;
+    if(mb_row == (int)(frame->y.height >> 4) - 1) {
+        player->uploaded_display = frame->display;
+        mpeg_timing_add(&player->stats.upload, player->streamed_upload_ns);
     }
-    player->start_time = timer_ns_gettime64();
-
-    while(true) {
-        /* Get elapsed playback time */
-        double playback_time = (timer_ns_gettime64() - player->start_time) * 1e-9f;
+}
 
-        /* Check cancel matching */
-        int cancel = mpeg_check_cancel(cancel_options);
-        if(cancel == 1 || cancel == 2) {
-            result = (cancel == 1) ? MPEG_PLAY_CANCEL_INPUT : MPEG_PLAY_CANCEL_RESET;
-            goto finish;
-        }
+static uint64_t kos_time_ns(mpeg_player_t *player) {
+    (void)player;
+    return timer_ns_gettime64();
+}
 
-        /* Poll audio regardless */
-        snd_stream_poll(player->snd_hnd);
+/* Nothing to sleep on that is finer than a timeslice, so let other threads
+   (the sound stream's included) run and come back to poll */
+static void kos_idle(mpeg_player_t *player, uint64_t until_ns) {
+    (void)player;
+    (void)until_ns;
+    thd_pass();
+}
 
-        if(playback_time >= player->frame->time) {
-            /* Render the current frame */
-            pvr_wait_ready();
-            pvr_scene_begin();
-            mpeg_upload_frame(player);
+static int kos_check_cancel(mpeg_player_t *player, const mpeg_cancel_options_t *opt) {
+    (void)player;
+    if(!opt) return 0;
 
-            pvr_list_begin(player->list_type);
+    /*   Controller Cancel   */
+    MAPLE_FOREACH_BEGIN(MAPLE_FUNC_CONTROLLER, cont_state_t, st)
+        if(opt->pad_button_any && (st->buttons & opt->pad_button_any))
+            return 1;
 
-            mpeg_draw_frame(player);
+        if(opt->pad_button_combo &&
+            (st->buttons & opt->pad_button_combo) == opt->pad_button_combo)
+            return 1;
 
-            pvr_list_finish();
-            pvr_scene_finish();
+        /* Always cancel on reset combo */
+        if(st->buttons == CONT_RESET_BUTTONS)
+            return 2;
+    MAPLE_FOREACH_END()
 
-            /* Decode the NEXT frame to have it ready */
-            player->frame = plm_decode_video(player->decoder);
-            if(!player->frame) {
-                /* Are we looping? */
-                if(!player->loop) {
-                    result = MPEG_PLAY_NORMAL;
-                    goto finish;
-                }
-
-                /* We are looping. Reset and restart */
-                mpeg_player_reset(player);
-                snd_stream_start(player->snd_hnd, player->sample_rate, AUDIO_CHANNELS - 1);
-                player->snd_started = true;
-
-                player->frame = plm_decode_video(player->decoder);
-                if(!player->frame) {
-                    result = MPEG_PLAY_ERROR;
-                    goto finish;
-                }
-
-                player->start_time = timer_ns_gettime64();
-            }
-        }
-    }
-
-finish:
-    /* Reset some stuff */
-    sound_stream_reset(player);
-    player->start_time = 0;
-
-    return result;
-}
-
-mpeg_play_result_t mpeg_play(mpeg_player_t *player, uint32_t cancel_buttons) {
-    mpeg_cancel_options_t opts = {
-        .pad_button_any = cancel_buttons
-    };
-
-    return mpeg_play_ex(player, &opts);
-}
-
-mpeg_decode_result_t mpeg_decode_step(mpeg_player_t *player) {
-    if(!player || !player->decoder)
-        return MPEG_DECODE_ERROR;
-
-    if(player->start_time == 0) {
-        /* Init sound stream. */
-        sound_stream_reset(player);
-        snd_stream_start(player->snd_hnd, player->sample_rate, AUDIO_CHANNELS - 1);
-        player->snd_started = true;
-
-        /* Prime the first frame */
-        player->frame = plm_decode_video(player->decoder);
-        if(!player->frame)
-            return MPEG_DECODE_EOF;
-
-        player->start_time = timer_ns_gettime64();
-
-        /* Poll first thing as well since we have a video frame ready */
-        snd_stream_poll(player->snd_hnd);
-        return MPEG_DECODE_FRAME;
-    }
-
-    /* Get elapsed playback time */
-    double playback_time = (timer_ns_gettime64() - player->start_time) * 1e-9f;
-
-    /* Poll audio regardless */
-    snd_stream_poll(player->snd_hnd);
-
-    /* Check if it's time to decode the next frame */
-    if(playback_time >= player->frame->time) {
-        player->frame = plm_decode_video(player->decoder);
-        if(player->frame)
-            return MPEG_DECODE_FRAME;
-
-        /* Are we looping? */
-        if(!player->loop) {
-            sound_stream_reset(player);
-            player->start_time = 0;
-            return MPEG_DECODE_EOF;
+    /*   Keyboard Cancel   */
+    MAPLE_FOREACH_BEGIN(MAPLE_FUNC_KEYBOARD, kbd_state_t, kbd_st)
+        for(size_t i = 0; i < opt->kbd_keys_any_count; ++i) {
+            if(kbd_st->key_states[opt->kbd_keys_any[i]].is_down)
+                return 1;
         }
 
-        /* We are Looping. Reset and restart */
-        mpeg_player_reset(player);
-        snd_stream_start(player->snd_hnd, player->sample_rate, AUDIO_CHANNELS - 1);
-        player->snd_started = true;
-
-        player->frame = plm_decode_video(player->decoder);
-        if(!player->frame) {
-            sound_stream_reset(player);
-            return MPEG_DECODE_EOF;
+        int all_pressed = 1;
+        for(size_t i = 0; i < opt->kbd_keys_combo_count; ++i) {
+            if(!kbd_st->key_states[opt->kbd_keys_combo[i]].is_down) {
+                all_pressed = 0;
+                break;
+            }
         }
 
-        player->start_time = timer_ns_gettime64();
-        return MPEG_DECODE_FRAME;
-    }
-
-    return MPEG_DECODE_IDLE;
-}
-
-void mpeg_upload_frame(mpeg_player_t *player) {
-    if(!player || !player->frame)
-        return;
-
-    /* HACK: Fix Flycast */
-    PVR_SET(PVR_YUV_CFG, (((player->texture_height >> 4) - 1) << 8) |
-                      ((player->texture_width >> 4) - 1));
-
-    /* Video size in macroblocks (16x16) */
-    const int video_blocks_w = player->frame->y.width  >> 4;
-    const int video_blocks_h = player->frame->y.height >> 4;
-
-    /*
-     * PVR YUV converter stride (in macroblocks).
-     * This MUST match the width configured in PVR_YUV_CFG.
-     *
-     * Example:
-     *   player->texture_width = 512 px
-     *   → stride = 512 / 16 = 32 macroblocks
-     */
-    const int pvr_blocks_per_row = player->texture_width >> 4;
-    const int pad_blocks_x = pvr_blocks_per_row - video_blocks_w;
-
-    /*
-     * Each macroblock is 384 bytes = 96 uint32_t
-     * sq_fast_cpy works in 32-byte chunks → 384 / 32 = 12 iterations
-     */
-    const int mb_sq_iters = 384 / 32;
-
-    uint32_t *src = player->frame->display;
-    uint32_t *d = SQ_MASK_DEST((void *)PVR_TA_YUV_CONV);
-    sq_lock((void *)PVR_TA_YUV_CONV);
-
-    for(int y = 0; y < video_blocks_h; y++) {
-        /* Upload whole row of real macroblocks */
-        sq_fast_cpy(d, src, video_blocks_w * mb_sq_iters);
-        src += 96 * video_blocks_w;
-
-        /* Pad row to PVR stride */
-        for(int i = 0; i < pad_blocks_x * mb_sq_iters; i++)
-            sq_flush(d);
-    }
-
-    sq_unlock();
-}
-
-void mpeg_draw_frame(mpeg_player_t *player) {
-    if(!player || !player->frame)
-        return;
-
-    pvr_prim(&player->hdr, sizeof(pvr_poly_hdr_t));
+        if(opt->kbd_keys_combo_count && all_pressed)
+            return 1;
+    MAPLE_FOREACH_END()
 
-    pvr_prim(&player->vert[0], sizeof(pvr_vertex_t));
-    pvr_prim(&player->vert[1], sizeof(pvr_vertex_t));
-    pvr_prim(&player->vert[2], sizeof(pvr_vertex_t));
-    pvr_prim(&player->vert[3], sizeof(pvr_vertex_t));
+    return 0;
 }
 
-static int setup_graphics(mpeg_player_t *player, const mpeg_player_options_t *opts) {
+static int kos_video_init(mpeg_player_t *player, const mpeg_player_options_t *opts) {
     float screen_x = 0.0f;
     float screen_y = 0.0f;
     float screen_width = (float)vid_mode->width;
     float screen_height = (float)vid_mode->height;
-    player->width = plm_get_width(player->decoder);
-    player->height = plm_get_height(player->decoder);
-
     /* Check if the w/h ratio matches the screen */
     float video_ratio = (float)player->width / (float)player->height;
     float screen_ratio = screen_width / screen_height;
@@ -527,34 +545,48 @@ static int setup_graphics(mpeg_player_t *player, const mpeg_player_options_t *op
         }
     }
 
-    player->texture_width = next_power_of_two(player->width);
-    player->texture_height = next_power_of_two(player->height);
+    player->list_type = opts->list_type;
 
-    player->texture = MPEG_PVR_MALLOC(player->texture_width * player->texture_height * 2);
-    if(!player->texture) {
-        fprintf(stderr, "Failed to allocate PVR memory!\n");
-        return -1;
+    /* PAL modes have 625 lines and refresh at 50 Hz, the rest at 60 Hz */
+    int refresh_rate = opts->refresh_rate;
+    if(!refresh_rate)
+        refresh_rate = (vid_mode->scanlines >= 600) ? 50 : 60;
+    player->refresh_ns = 1000000000 / refresh_rate;
+
+    player->texture_count = opts->texture_count;
+    if(player->texture_count < 1)
+        player->texture_count = 1;
+    if(player->texture_count > MPEG_MAX_TEXTURES)
+        player->texture_count = MPEG_MAX_TEXTURES;
+
+    for(int i = 0; i < player->texture_count; i++) {
+        player->texture[i] = MPEG_PVR_MALLOC(player->texture_width * player->texture_height * 2);
+        if(!player->texture[i]) {
+            fprintf(stderr, "Failed to allocate PVR memory!\n");
+            return -1;
+        }
+
+        /* Clear texture to black */
+        sq_set(player->texture[i], 0, player->texture_width * player->texture_height * 2);
+
+        pvr_poly_cxt_t cxt;
+        pvr_poly_cxt_txr(&cxt, player->list_type,
+                         PVR_TXRFMT_YUV422 | PVR_TXRFMT_NONTWIDDLED,
+                         player->texture_width, player->texture_height,
+                         player->texture[i],
+                         opts->filter_mode);
+        pvr_poly_compile(&player->hdr[i], &cxt);
     }
+    player->texture_index = 0;
 
     /* Set SQ to YUV converter. */
-    PVR_SET(PVR_YUV_ADDR, (((uint32_t)player->texture) & 0xffffff));
+    PVR_SET(PVR_YUV_ADDR, (((uint32_t)player->texture[0]) & 0xffffff));
     /* Divide texture width and texture height by 16 and subtract 1.
        The actual values to set are 1, 3, 7, 15, 31, 63. */
     PVR_SET(PVR_YUV_CFG, (((player->texture_height >> 4) - 1) << 8) |
                           ((player->texture_width >> 4) - 1));
     PVR_GET(PVR_YUV_CFG);
 
-    /* Clear texture to black */
-    sq_set(player->texture, 0, player->texture_width * player->texture_height * 2);
-
-    pvr_poly_cxt_t cxt;
-    pvr_poly_cxt_txr(&cxt, player->list_type,
-                     PVR_TXRFMT_YUV422 | PVR_TXRFMT_NONTWIDDLED,
-                     player->texture_width, player->texture_height,
-                     player->texture,
-                     opts->filter_mode);
-    pvr_poly_compile(&player->hdr, &cxt);
-
     float u = (float)player->width / player->texture_width;
     float v = (float)player->height / player->texture_height;
     float left   = screen_x;
@@ -599,53 +631,116 @@ static int setup_graphics(mpeg_player_t *player, const mpeg_player_options_t *op
     player->vert[3].oargb = 0;
     player->vert[3].flags = PVR_CMD_VERTEX_EOL;
 
+    /* Rows can only go out early when they don't overwrite what's on screen */
+    if(opts->stream_rows && player->texture_count > 1)
+        plm_set_video_row_callback(player->decoder, mpeg_row_callback, player);
+
     return 0;
 }
 
-static void *sound_callback(snd_stream_hnd_t hnd, int request_size, int *size_out) {
-    mpeg_player_t *player = (mpeg_player_t *)snd_stream_get_userdata(hnd);
-    const int frame_bytes = PLM_AUDIO_SAMPLES_PER_FRAME * AUDIO_CHANNELS * (int)sizeof(short);
-    uint8_t *dest = player->snd_buf;
-    int out = 0;
-    int needed = request_size;
+static void kos_video_destroy(mpeg_player_t *player) {
+    for(int i = 0; i < MPEG_MAX_TEXTURES; i++) {
+        if(player->texture[i]) {
+            MPEG_PVR_FREE(player->texture[i]);
+            player->texture[i] = NULL;
+        }
+    }
+}
 
-    while(needed > 0) {
-        if(player->snd_pcm_leftovers > 0 && player->sample) {
-            int chunk = player->snd_pcm_leftovers;
-            if(chunk > needed)
-                chunk = needed;
+static void kos_video_upload(mpeg_player_t *player) {
+    mpeg_upload_begin(player);
 
-            fast_memcpy(dest + out, (uint8_t *)player->sample->pcm + player->snd_pcm_offset, chunk);
-            out += chunk;
-            needed -= chunk;
-            player->snd_pcm_offset += chunk;
-            player->snd_pcm_leftovers -= chunk;
-            continue;
-        }
+    /* Video size in macroblocks (16x16) */
+    const int video_blocks_w = player->frame->y.width  >> 4;
+    const int video_blocks_h = player->frame->y.height >> 4;
 
-        player->sample = plm_decode_audio(player->decoder);
-        if(!player->sample)
-            break;
+    mpeg_upload_rows(player, player->frame->display, video_blocks_w, video_blocks_h);
+}
 
-        player->snd_pcm_offset = 0;
-        player->snd_pcm_leftovers = frame_bytes;
-    }
+static void kos_video_draw(mpeg_player_t *player) {
+    mpeg_texture_fence(player);
+    pvr_prim(&player->hdr[player->texture_index], sizeof(pvr_poly_hdr_t));
 
-    if(needed > 0) {
-        MPEG_MEMZERO(dest + out, needed);
-        out += needed;
+    pvr_prim(&player->vert[0], sizeof(pvr_vertex_t));
+    pvr_prim(&player->vert[1], sizeof(pvr_vertex_t));
+    pvr_prim(&player->vert[2], sizeof(pvr_vertex_t));
+    pvr_prim(&player->vert[3], sizeof(pvr_vertex_t));
+}
+
+static void kos_video_present(mpeg_player_t *player) {
+    size_t last_fence = player->scene_fence;
+
+    /* With a spare texture the upload overlaps the render of the previous
+       scene, and has usually been done by kos_video_prepare() already. */
+    if(player->texture_count > 1) {
+        mpeg_upload_frame(player);
+        if(!player->pvr_ready_taken)
+            pvr_wait_ready();
+        pvr_scene_begin();
+    }
+    else {
+        pvr_wait_ready();
+        pvr_scene_begin();
+        mpeg_upload_frame(player);
     }
+    player->pvr_ready_taken = false;
+
+    pvr_list_begin(player->list_type);
+
+    mpeg_draw_frame(player);
+
+    pvr_list_finish();
+    pvr_scene_finish();
+
+    mpeg_texture_fence_scene(player, last_fence);
+}
+
+/* With a spare texture, upload the next frame as soon as it is decoded, in
+   the slack before it is due, rather than when it is presented */
+static void kos_video_prepare(mpeg_player_t *player) {
+    if(player->texture_count > 1)
+        mpeg_upload_frame(player);
+}
+
+static bool kos_video_ready(mpeg_player_t *player) {
+    return player->pvr_ready_taken || pvr_check_ready() == 0;
+}
+
+/* With two textures the first scene must be fenced on its exact flip, or
+   every upload after it waits for the scene just submitted. The caller's
+   scenes may still be in flight, so wait until nothing has flipped for as
+   long as a fence wait would, once per mpeg_play_ex(). */
+static void kos_video_start(mpeg_player_t *player) {
+    const uint64_t stall_ns = MPEG_FENCE_STALL_REFRESHES * player->refresh_ns;
+    mpeg_fence_wait_t wait;
 
+    player->scene_fence = 0;
+    if(player->texture_count != 2)
+        return;
+
+    mpeg_fence_wait_start(&wait, mpeg_pvr_frame_count(), timer_ns_gettime64());
+    while(mpeg_fence_poll(&wait, SIZE_MAX, mpeg_pvr_frame_count(),
+                          timer_ns_gettime64(), stall_ns) == MPEG_FENCE_WAITING)
+        thd_pass();
+
+    player->scene_fence = wait.frame_count;
+}
+
+static void *sound_callback(snd_stream_hnd_t hnd, int request_size, int *size_out) {
+    mpeg_player_t *player = (mpeg_player_t *)snd_stream_get_userdata(hnd);
+
+    /* Adaptive, hand over less than asked for to keep the AICA buffer at
+       the chosen depth; the stream writes only what it gets */
+    if(player->adaptive_audio)
+        request_size = mpeg_audio_allow(player, request_size);
+
+    mpeg_pcm_fill(player, request_size);
     *size_out = request_size;
 
     return player->snd_buf;
 }
 
-static int setup_audio(mpeg_player_t *player) {
-    player->snd_pcm_leftovers = 0;
-    player->snd_pcm_offset = 0;
-    player->sample_rate = plm_get_samplerate(player->decoder);
-
+static int kos_audio_init(mpeg_player_t *player) {
     player->snd_hnd = snd_stream_alloc(sound_callback, SOUND_BUFFER);
     if(player->snd_hnd == SND_STREAM_INVALID)
         return -1;
@@ -656,28 +751,1530 @@ static int setup_audio(mpeg_player_t *player) {
     return 0;
 }
 
-static __attribute__((noinline)) void fast_memcpy(void *dest, const void *src, size_t length) {
-    uint8_t *d = (uint8_t *)dest;
-    const uint8_t *s = (const uint8_t *)src;
+static void kos_audio_destroy(mpeg_player_t *player) {
+    if(player->snd_hnd != SND_STREAM_INVALID) {
+        snd_stream_destroy(player->snd_hnd);
+        player->snd_hnd = SND_STREAM_INVALID;
+    }
+}
 
-    size_t prefix = ((size_t)32 - ((uintptr_t)d & 31)) & 31;
-    if(prefix > length)
-        prefix = length;
+static void kos_audio_start(mpeg_player_t *player) {
+    snd_stream_start(player->snd_hnd, player->sample_rate, AUDIO_CHANNELS - 1);
+}
 
-    for(size_t i = 0; i < prefix; i++)
-        d[i] = s[i];
+static void kos_audio_stop(mpeg_player_t *player) {
+    if(player->snd_hnd != SND_STREAM_INVALID)
+        snd_stream_stop(player->snd_hnd);
+}
 
-    d += prefix;
-    s += prefix;
-    length -= prefix;
+static void kos_audio_poll(mpeg_player_t *player) {
+    snd_stream_poll(player->snd_hnd);
+}
 
-    if(length >= 32 && (((uintptr_t)s & 7) == 0)) {
-        size_t block_bytes = length & ~(size_t)31;
+static void kos_audio_volume(mpeg_player_t *player) {
+    snd_stream_volume(player->snd_hnd, player->snd_volume);
+}
+
+static const mpeg_backend_t mpeg_backend_kos = {
+    kos_time_ns, kos_idle,
+    kos_video_init, kos_video_destroy, kos_video_upload, kos_video_draw, kos_video_present,
+    kos_video_prepare, kos_video_ready, kos_video_start,
+    kos_audio_init, kos_audio_destroy, kos_audio_start, kos_audio_stop, kos_audio_poll,
+    kos_audio_volume,
+    kos_check_cancel
+};
+#endif
+
+/* --- Headless backend: consumes frames and PCM without any output --- */
+
+#define MPEG_FNV_OFFSET 2166136261u
+#define MPEG_FNV_PRIME  16777619u
+
+static uint32_t mpeg_fnv1a(uint32_t hash, const uint8_t *data, size_t length) {
+    for(size_t i = 0; i < length; i++) {
+        hash ^= data[i];
+        hash *= MPEG_FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/* The unthrottled clock ignores how long decoding takes, so A/V sync and
+   the PCM consumed depend only on the stream and runs are repeatable. */
+static uint64_t headless_time_ns(mpeg_player_t *player) {
+    if(player->unthrottled)
+        return player->virtual_ns;
+
+    return mpeg_perf_ns();
+}
+
+/* Unthrottled, jump the clock to the next frame instead of waiting for it */
+static void headless_idle(mpeg_player_t *player, uint64_t until_ns) {
+    if(player->unthrottled && until_ns > player->virtual_ns)
+        player->virtual_ns = until_ns;
+}
+
+static int headless_video_init(mpeg_player_t *player, const mpeg_player_options_t *opts) {
+    player->texture_count = 0;
+    /* Pace presents like a display would, 60 Hz unless told otherwise */
+    player->refresh_ns = 1000000000 / (opts->refresh_rate ? opts->refresh_rate : 60);
+    /* Start off zero: a zero start_time means playback hasn't started */
+    player->virtual_ns = 1000000000;
+    player->headless.frame_checksum = MPEG_FNV_OFFSET;
+    player->headless.pcm_checksum = MPEG_FNV_OFFSET;
+    return 0;
+}
+
+static void headless_video_destroy(mpeg_player_t *player) {
+    (void)player;
+}
+
+static void headless_video_upload(mpeg_player_t *player) {
+    const plm_frame_t *frame = player->frame;
+    size_t size = (size_t)frame->y.width * frame->y.height * 3 / 2;
+
+    player->headless.frames++;
+    player->headless.frame_checksum = mpeg_fnv1a(player->headless.frame_checksum,
+                                                 (const uint8_t *)frame->display, size);
+}
+
+static void headless_video_draw(mpeg_player_t *player) {
+    (void)player;
+}
+
+static void headless_video_present(mpeg_player_t *player) {
+    mpeg_upload_frame(player);
+    mpeg_draw_frame(player);
+}
+
+static void headless_video_prepare(mpeg_player_t *player) {
+    (void)player;
+}
+
+static bool headless_video_ready(mpeg_player_t *player) {
+    (void)player;
+    return true;
+}
+
+static void headless_video_start(mpeg_player_t *player) {
+    player->scene_fence = 0;
+}
+
+static int headless_audio_init(mpeg_player_t *player) {
+    (void)player;
+    return 0;
+}
+
+static void headless_audio_destroy(mpeg_player_t *player) {
+    (void)player;
+}
+
+static void headless_audio_start(mpeg_player_t *player) {
+    player->audio_start_time = mpeg_now(player);
+    player->pcm_consumed = 0;
+}
+
+static void headless_audio_stop(mpeg_player_t *player) {
+    (void)player;
+}
+
+/* Take as much PCM as a sound device started at audio_start_time would have */
+static void headless_audio_poll(mpeg_player_t *player) {
+    const int sample_bytes = AUDIO_CHANNELS * (int)sizeof(short);
+
+    if(!player->snd_started)
+        return;
+
+    /* Adaptive, act like a device that plays from a buffer of the chosen
+       depth and is topped up on each poll */
+    if(player->adaptive_audio) {
+        int allowed = mpeg_audio_allow(player, SOUND_BUFFER);
+        int decoded = mpeg_pcm_fill(player, allowed);
+
+        player->headless.pcm_bytes += decoded;
+        player->headless.pcm_checksum = mpeg_fnv1a(player->headless.pcm_checksum,
+                                                   player->snd_buf, decoded);
+        return;
+    }
+
+    uint64_t elapsed = mpeg_now(player) - player->audio_start_time;
+    uint64_t due = elapsed * player->sample_rate / 1000000000 * sample_bytes;
+
+    while(player->pcm_consumed < due) {
+        uint64_t chunk = due - player->pcm_consumed;
+        if(chunk > SOUND_BUFFER)
+            chunk = SOUND_BUFFER;
+
+        int decoded = mpeg_pcm_fill(player, (int)chunk);
+        player->headless.pcm_bytes += decoded;
+        player->headless.pcm_checksum = mpeg_fnv1a(player->headless.pcm_checksum,
+                                                   player->snd_buf, decoded);
+        player->pcm_consumed += chunk;
+    }
+}
+
+static void headless_audio_volume(mpeg_player_t *player) {
+    (void)player;
+}
+
+static int headless_check_cancel(mpeg_player_t *player, const mpeg_cancel_options_t *opt) {
+    (void)player;
+    (void)opt;
+    return 0;
+}
+
+static const mpeg_backend_t mpeg_backend_headless = {
+    headless_time_ns, headless_idle,
+    headless_video_init, headless_video_destroy, headless_video_upload, headless_video_draw,
+    headless_video_present, headless_video_prepare, headless_video_ready, headless_video_start,
+    headless_audio_init, headless_audio_destroy, headless_audio_start, headless_audio_stop,
+    headless_audio_poll, headless_audio_volume,
+    headless_check_cancel
+};
+
+static const mpeg_backend_t *mpeg_backend_select(mpeg_backend_type_t type) {
+#ifdef _arch_dreamcast
+    if(type == MPEG_BACKEND_DEFAULT)
+        return &mpeg_backend_kos;
+#endif
+    (void)type;
+    return &mpeg_backend_headless;
+}
+
+static plm_frame_t *mpeg_decode_frame(mpeg_player_t *player) {
+    /* Frames can be reused by the decoder, so keep the time of this one */
+    double previous_time = player->frame ? player->frame->time : -1.0;
+
+    if(player->frame && !player->frame_presented)
+        player->stats.frames_dropped++;
+
+    player->uploaded_display = NULL;
+    player->streamed_upload_ns = 0;
+    player->frame_presented = false;
+
+    uint64_t start = mpeg_perf_ns();
+    plm_frame_t *frame = plm_decode_video(player->decoder);
+    if(!frame)
+        return NULL;
+
+    /* Rows streamed during the decode count as upload time, not decode */
+    uint64_t ns = mpeg_perf_ns() - start - player->streamed_upload_ns;
+    int type = plm_get_picture_type(player->decoder);
+
+    mpeg_timing_add(&player->stats.decode[0], ns);
+    if(type >= 1 && type <= 3)
+        mpeg_timing_add(&player->stats.decode[type], ns);
+
+    /* B-pictures skipped by the decoder leave a gap in the timestamps. The
+       gaps between D-pictures are what D-only playback asked for. */
+    double framerate = plm_get_framerate(player->decoder);
+    if(previous_time >= 0.0 && framerate > 0.0 && !player->d_pictures_only) {
+        int skipped = (int)((frame->time - previous_time) * framerate + 0.5) - 1;
+        if(skipped > 0)
+            player->stats.frames_dropped += skipped;
+    }
+
+    return frame;
+}
+
+static inline void sound_stream_start(mpeg_player_t *player) {
+    /* Before the start, which may already fill the stream */
+    player->audio_start_time = mpeg_now(player);
+    player->audio_written = 0;
+    player->audio_last_fill = 0;
+
+    player->backend->audio_start(player);
+    player->snd_started = true;
+}
+
+static inline void sound_stream_reset(mpeg_player_t *player) {
+    if(!player)
+        return;
+
+    if(player->snd_started) {
+        player->backend->audio_stop(player);
+        player->snd_started = false;
+    }
+
+    player->snd_pcm_leftovers = 0;
+    player->snd_pcm_offset = 0;
+}
+
+/* Fill the sound buffer with request_size bytes of PCM, padding with silence
+   when the decoder has none. Returns how many bytes were decoded PCM. */
+static int mpeg_pcm_fill(mpeg_player_t *player, int request_size) {
+    const int frame_bytes = PLM_AUDIO_SAMPLES_PER_FRAME * AUDIO_CHANNELS * (int)sizeof(short);
+    uint8_t *dest = player->snd_buf;
+    int out = 0;
+    int needed = request_size;
+
+    while(needed > 0) {
+        if(player->snd_pcm_leftovers > 0 && player->sample) {
+            int chunk = player->snd_pcm_leftovers;
+            if(chunk > needed)
+                chunk = needed;
+
+            fast_memcpy(dest + out, (uint8_t *)player->sample->pcm + player->snd_pcm_offset, chunk);
+            out += chunk;
+            needed -= chunk;
+            player->snd_pcm_offset += chunk;
+            player->snd_pcm_leftovers -= chunk;
+            continue;
+        }
+
+        player->sample = plm_decode_audio(player->decoder);
+        if(!player->sample)
+            break;
+
+        player->snd_pcm_offset = 0;
+        player->snd_pcm_leftovers = frame_bytes;
+    }
+
+    if(needed > 0) {
+        if(!plm_has_ended(player->decoder))
+            player->stats.audio_underruns++;
+
+        MPEG_MEMZERO(dest + out, needed);
+    }
+
+    return out;
+}
+
+/* Adaptive audio depth. The sound stream plays from its buffer while the
+   player decodes; the time between two fills, with a decode in it or a late
+   poll, is what the buffer has to bridge. The depth follows the peak of
+   those gaps with headroom: it rises at once on a longer gap, or by half
+   when the stream ran dry anyway, and decays slowly while the content is
+   calm. */
+
+#define MPEG_AUDIO_DEPTH_MIN (PLM_AUDIO_SAMPLES_PER_FRAME * AUDIO_CHANNELS * (int)sizeof(short))
+#define MPEG_AUDIO_DEPTH_MAX SOUND_BUFFER
+#define MPEG_AUDIO_GAP_DECAY 32     /* Each calmer fill takes 1/32 off the peak's distance to it */
+
+/* How much of request_size the sound stream may take now, so that it holds
+   at most the current depth of PCM ahead of what it has played */
+static int mpeg_audio_allow(mpeg_player_t *player, int request_size) {
+    const uint64_t bytes_per_second = (uint64_t)player->sample_rate * AUDIO_CHANNELS * sizeof(short);
+    uint64_t now = mpeg_now(player);
+    uint64_t played = (now - player->audio_start_time) * bytes_per_second / 1000000000 & ~(uint64_t)3;
+
+    /* The stream played silence in the hole */
+    if(played > player->audio_written) {
+        if(player->audio_written > 0) {
+            player->stats.audio_starved++;
+            player->audio_gap_peak_ns += player->audio_gap_peak_ns / 2;
+        }
+        player->audio_written = played;
+    }
+
+    uint64_t depth = player->audio_gap_peak_ns * 3 / 2 * bytes_per_second / 1000000000 + MPEG_AUDIO_DEPTH_MIN;
+    if(depth > MPEG_AUDIO_DEPTH_MAX)
+        depth = MPEG_AUDIO_DEPTH_MAX;
+    player->audio_depth = (int)depth & ~31;
+    if((uint32_t)player->audio_depth > player->stats.audio_depth_peak)
+        player->stats.audio_depth_peak = player->audio_depth;
+
+    int64_t allowed = player->audio_depth - (int64_t)(player->audio_written - played);
+    if(allowed > request_size)
+        allowed = request_size;
+    if(allowed < 0)
+        allowed = 0;
+    allowed &= ~31;
+
+    player->audio_written += allowed;
+
+    /* Polls that find the stream full don't count as fills */
+    if(allowed > 0) {
+        if(player->audio_last_fill) {
+            uint64_t gap = now - player->audio_last_fill;
+
+            mpeg_timing_add(&player->stats.audio_gap, gap);
+            if(gap > player->audio_gap_peak_ns)
+                player->audio_gap_peak_ns = gap;
+            else
+                player->audio_gap_peak_ns -= (player->audio_gap_peak_ns - gap) / MPEG_AUDIO_GAP_DECAY;
+        }
+        player->audio_last_fill = now;
+    }
+
+    return (int)allowed;
+}
+
+/** Default MPEG player options used when NULL is passed to *_ex() functions. */
+static const mpeg_player_options_t MPEG_PLAYER_OPTIONS_DEFAULT = MPEG_PLAYER_OPTIONS_INITIALIZER;
+
+static bool mpeg_player_init(mpeg_player_t *player, const mpeg_player_options_t *opts) {
+    /* Never let plm loop internally — it rewinds without resetting our
+       start_time, which causes playback_time >> frame->time and the video
+       plays at max speed.  We store the flag ourselves and rewind manually
+       so that start_time and audio are properly re-initialized. */
+    player->loop = opts->loop;
+    plm_set_loop(player->decoder, 0);
+
+    if(!player->snd_buf)
+        player->snd_buf = (uint8_t *)MPEG_MEMALIGN(32, SOUND_BUFFER);
+    if(!player->snd_buf) {
+        fprintf(stderr, "Out of memory for player->snd_buf\n");
+        mpeg_player_destroy(player);
+        return false;
+    }
+
+    player->width = plm_get_width(player->decoder);
+    player->height = plm_get_height(player->decoder);
+    player->texture_width = next_power_of_two(player->width);
+    player->texture_height = next_power_of_two(player->height);
+    player->unthrottled = (opts->backend == MPEG_BACKEND_HEADLESS_UNTHROTTLED);
+    player->adaptive_audio = opts->adaptive_audio;
+
+    if(player->backend->video_init(player, opts) < 0) {
+        fprintf(stderr, "Setting up graphics failed\n");
+        mpeg_player_destroy(player);
+        return false;
+    }
+
+    player->snd_volume = opts->volume;
+    player->snd_pcm_leftovers = 0;
+    player->snd_pcm_offset = 0;
+    player->sample_rate = plm_get_samplerate(player->decoder);
+    /* Start out bridging two frames until the gaps are measured */
+    if(plm_get_framerate(player->decoder) > 0.0)
+        player->audio_gap_peak_ns = (uint64_t)(2e9 / plm_get_framerate(player->decoder));
+    if(player->backend->audio_init(player) < 0) {
+        fprintf(stderr, "Setting up audio failed\n");
+        mpeg_player_destroy(player);
+        return false;
+    }
+
+    return true;
+}
+
+static mpeg_player_t *mpeg_player_alloc(const mpeg_player_options_t *opts) {
+    mpeg_player_t *player = NULL;
+
+    if(opts->arena) {
+        if(((uintptr_t)opts->arena & 31) || opts->arena_size < MPEG_ARENA_HEAD_SIZE) {
+            fprintf(stderr, "Arena is misaligned or too small\n");
+            return NULL;
+        }
+        player = (mpeg_player_t *)opts->arena;
+    }
+    else {
+        player = (mpeg_player_t *)MPEG_MALLOC(sizeof(mpeg_player_t));
+        if(!player) {
+            fprintf(stderr, "Out of memory for player\n");
+            return NULL;
+        }
+    }
+
+    MPEG_MEMZERO(player, sizeof(mpeg_player_t));
+    player->backend = mpeg_backend_select(opts->backend);
+#ifdef _arch_dreamcast
+    player->snd_hnd = SND_STREAM_INVALID;
+#endif
+
+    if(opts->arena) {
+        player->in_arena = true;
+        player->snd_buf = (uint8_t *)opts->arena + MPEG_ARENA_ALIGN(sizeof(mpeg_player_t));
+    }
+
+    return player;
+}
+
+mpeg_player_t *mpeg_player_create_ex(const char *filename, const mpeg_player_options_t *options) {
+    mpeg_player_t *player = NULL;
+    const mpeg_player_options_t *opts = options ? options : &MPEG_PLAYER_OPTIONS_DEFAULT;
+
+    if(!filename) {
+        fprintf(stderr, "filename is NULL\n");
+        return NULL;
+    }
+
+    player = mpeg_player_alloc(opts);
+    if(!player)
+        return NULL;
+
+    if(player->in_arena)
+        player->decoder = plm_create_with_filename_arena(filename,
+            (uint8_t *)opts->arena + MPEG_ARENA_HEAD_SIZE, opts->arena_size - MPEG_ARENA_HEAD_SIZE);
+    else if(opts->fast_start)
+        player->decoder = plm_create_with_filename_fast_start(filename);
+    else
+        player->decoder = plm_create_with_filename(filename);
+    if(!player->decoder) {
+        fprintf(stderr, "Out of memory for player->decoder\n");
+        mpeg_player_destroy(player);
+        return NULL;
+    }
+
+    if(!mpeg_player_init(player, opts))
+        return NULL;
+
+    return player;
+}
+
+mpeg_player_t *mpeg_player_create_memory_ex(unsigned char *memory, const size_t length, const mpeg_player_options_t *options) {
+    mpeg_player_t *player = NULL;
+    const mpeg_player_options_t *opts = options ? options : &MPEG_PLAYER_OPTIONS_DEFAULT;
+
+    if(!memory) {
+        fprintf(stderr, "memory is NULL\n");
+        return NULL;
+    }
+
+    player = mpeg_player_alloc(opts);
+    if(!player)
+        return NULL;
+
+    if(player->in_arena)
+        player->decoder = plm_create_with_memory_arena(memory, length, 1,
+            (uint8_t *)opts->arena + MPEG_ARENA_HEAD_SIZE, opts->arena_size - MPEG_ARENA_HEAD_SIZE);
+    else
+        player->decoder = plm_create_with_memory(memory, length, 1);
+    if(!player->decoder) {
+        fprintf(stderr, "Out of memory for player->decoder\n");
+        mpeg_player_destroy(player);
+        return NULL;
+    }
+
+    if(!mpeg_player_init(player, opts))
+        return NULL;
+
+    return player;
+}
+
+mpeg_player_t *mpeg_player_create_elementary_ex(const char *video_filename, const char *audio_filename,
+                                                const mpeg_player_options_t *options) {
+    mpeg_player_t *player = NULL;
+    plm_buffer_t *video = NULL;
+    plm_buffer_t *audio = NULL;
+    const mpeg_player_options_t *opts = options ? options : &MPEG_PLAYER_OPTIONS_DEFAULT;
+
+    if(!video_filename) {
+        fprintf(stderr, "video_filename is NULL\n");
+        return NULL;
+    }
+
+    if(opts->arena) {
+        fprintf(stderr, "Elementary streams can't be played from an arena\n");
+        return NULL;
+    }
+
+    player = mpeg_player_alloc(opts);
+    if(!player)
+        return NULL;
+
+    video = plm_buffer_create_with_filename(video_filename);
+    if(audio_filename)
+        audio = plm_buffer_create_with_filename(audio_filename);
+    if(!video || (audio_filename && !audio)) {
+        plm_buffer_destroy(video);
+        plm_buffer_destroy(audio);
+        mpeg_player_destroy(player);
+        return NULL;
+    }
+
+    player->decoder = plm_create_with_elementary_streams(video, audio, 1);
+    if(!player->decoder) {
+        fprintf(stderr, "Out of memory for player->decoder\n");
+        mpeg_player_destroy(player);
+        return NULL;
+    }
+
+    if(!mpeg_player_init(player, opts))
+        return NULL;
+
+    return player;
+}
+
+size_t mpeg_player_get_arena_size(const char *filename) {
+    if(!filename)
+        return 0;
+
+    plm_buffer_t *buffer = plm_buffer_create_with_filename(filename);
+    if(!buffer)
+        return 0;
+
+    size_t size = plm_get_arena_size(buffer);
+    plm_buffer_destroy(buffer);
+
+    return size ? MPEG_ARENA_HEAD_SIZE + size : 0;
+}
+
+size_t mpeg_player_get_arena_size_memory(unsigned char *memory, const size_t length) {
+    if(!memory)
+        return 0;
+
+    plm_buffer_t *buffer = plm_buffer_create_with_memory(memory, length, 0);
+    if(!buffer)
+        return 0;
+
+    size_t size = plm_get_arena_size(buffer);
+    plm_buffer_destroy(buffer);
+
+    return size ? MPEG_ARENA_HEAD_SIZE + size : 0;
+}
+
+static void mpeg_memory_report_fill(mpeg_memory_report_t *report, const plm_memory_requirements_t *req,
+                                    int texture_count) {
+    report->frame_buffers = req->frame_buffers;
+    report->rings = req->demux_ring + req->video_ring + req->audio_ring;
+    report->ring_growth = req->ring_growth;
+    report->audio_tables = req->audio_tables;
+    report->decoder_structs = req->structs;
+    report->player = sizeof(mpeg_player_t) + SOUND_BUFFER;
+    report->total_ram = req->total + report->player;
+    report->vram = next_power_of_two(req->width) * next_power_of_two(req->height) * 2 * texture_count;
+    report->small_ring_savings = req->small_ring_savings;
+}
+
+bool mpeg_player_query_memory(const char *filename, mpeg_memory_report_t *report) {
+    plm_memory_requirements_t req;
+
+    if(!filename || !report)
+        return false;
+
+    MPEG_MEMZERO(report, sizeof(mpeg_memory_report_t));
+
+    plm_buffer_t *buffer = plm_buffer_create_with_filename(filename);
+    if(!buffer)
+        return false;
+
+    int ok = plm_query_memory_requirements(buffer, &req);
+    plm_buffer_destroy(buffer);
+
+    if(!ok)
+        return false;
+
+    mpeg_memory_report_fill(report, &req, 1);
+    return true;
+}
+
+void mpeg_player_get_memory_footprint(mpeg_player_t *player, mpeg_memory_report_t *report) {
+    plm_memory_requirements_t req;
+
+    if(!player || !report)
+        return;
+
+    plm_get_memory_footprint(player->decoder, &req);
+    mpeg_memory_report_fill(report, &req, player->texture_count);
+}
+
+void mpeg_player_get_stats(mpeg_player_t *player, mpeg_player_stats_t *stats) {
+    plm_buffer_levels_t levels;
+
+    if(!player || !stats)
+        return;
+
+    mpeg_timing_report(&player->stats.decode[0], &stats->decode);
+    mpeg_timing_report(&player->stats.decode[1], &stats->decode_i);
+    mpeg_timing_report(&player->stats.decode[2], &stats->decode_p);
+    mpeg_timing_report(&player->stats.decode[3], &stats->decode_b);
+    mpeg_timing_report(&player->stats.upload, &stats->upload);
+    mpeg_timing_report(&player->stats.lateness, &stats->lateness);
+
+    stats->frames_shown = player->stats.frames_shown;
+    stats->frames_late = player->stats.frames_late;
+    stats->frames_dropped = player->stats.frames_dropped;
+    stats->audio_underruns = player->stats.audio_underruns;
+    stats->pcm_leftover_bytes = player->snd_pcm_leftovers;
+    mpeg_timing_report(&player->stats.audio_gap, &stats->audio_gap);
+    stats->audio_starved = player->stats.audio_starved;
+    stats->audio_depth = player->adaptive_audio ? player->audio_depth : SOUND_BUFFER;
+    stats->audio_depth_peak = player->adaptive_audio ? player->stats.audio_depth_peak : SOUND_BUFFER;
+
+    plm_get_buffer_levels(player->decoder, &levels);
+    stats->demux_fill = levels.demux_fill;
+    stats->demux_capacity = levels.demux_capacity;
+    stats->video_fill = levels.video_fill;
+    stats->video_capacity = levels.video_capacity;
+    stats->audio_fill = levels.audio_fill;
+    stats->audio_capacity = levels.audio_capacity;
+}
+
+void mpeg_player_reset_stats(mpeg_player_t *player) {
+    if(!player)
+        return;
+
+    MPEG_MEMZERO(&player->stats, sizeof(mpeg_stats_t));
+}
+
+mpeg_player_t *mpeg_player_create(const char *filename) {
+    return mpeg_player_create_ex(filename, &MPEG_PLAYER_OPTIONS_DEFAULT);
+}
+
+mpeg_player_t *mpeg_player_create_memory(uint8_t *memory, const size_t length) {
+    return mpeg_player_create_memory_ex(memory, length, &MPEG_PLAYER_OPTIONS_DEFAULT);
+}
+
+int mpeg_player_get_loop(mpeg_player_t *player) {
+    if(!player)
+        return -1;
+
+    return player->loop;
+}
+
+void mpeg_player_set_loop(mpeg_player_t *player, int loop) {
+    if(!player)
+        return;
+
+    player->loop = loop;
+}
+
+void mpeg_player_set_volume(mpeg_player_t *player, uint8_t volume) {
+    if(!player)
+        return;
+
+    player->snd_volume = volume;
+    player->backend->audio_volume(player);
+}
+
+void mpeg_player_set_d_pictures_only(mpeg_player_t *player, bool only) {
+    if(!player)
+        return;
+
+    player->d_pictures_only = only;
+    plm_set_video_d_pictures_only(player->decoder, only);
+}
+
+bool mpeg_player_get_headless_stats(mpeg_player_t *player, mpeg_headless_stats_t *stats) {
+    if(!player || !stats || player->backend != &mpeg_backend_headless)
+        return false;
+
+    *stats = player->headless;
+    return true;
+}
+
+#ifdef _arch_dreamcast
+const pvr_poly_hdr_t *mpeg_player_get_texture_hdr(mpeg_player_t *player) {
+    if(!player || player->backend != &mpeg_backend_kos)
+        return NULL;
+
+    mpeg_texture_fence(player);
+    mpeg_frame_presented(player);
+    return &player->hdr[player->texture_index];
+}
+#endif
+
+void mpeg_player_get_uv_scale(mpeg_player_t *player, float *u_scale, float *v_scale) {
+    if(!player)
+        return;
+
+    if(u_scale)
+        *u_scale = (float)player->width / (float)player->texture_width;
+    if(v_scale)
+        *v_scale = (float)player->height / (float)player->texture_height;
+}
+
+void mpeg_player_get_dimensions(mpeg_player_t *player, int *width, int *height) {
+    if(!player)
+        return;
+
+    if(width)
+        *width = player->width;
+    if(height)
+        *height = player->height;
+}
+
+void mpeg_player_reset(mpeg_player_t *player) {
+    if(!player)
+        return;
+
+    sound_stream_reset(player);
+    player->start_time = 0;
+    player->frame = NULL;
+    player->sample = NULL;
+    player->uploaded_display = NULL;
+
+    if(player->decoder)
+        plm_rewind(player->decoder);
+}
+
+void mpeg_player_destroy(mpeg_player_t *player) {
+    if(!player)
+        return;
+
+    player->backend->video_destroy(player);
+    player->backend->audio_destroy(player);
+
+    if(player->snd_buf) {
+        if(!player->in_arena)
+            MPEG_FREE(player->snd_buf);
+        player->snd_buf = NULL;
+    }
+
+    if(player->decoder) {
+        plm_destroy(player->decoder);
+        player->decoder = NULL;
+    }
+
+    if(!player->in_arena)
+        MPEG_FREE(player);
+}
+
+mpeg_play_result_t mpeg_play_ex(mpeg_player_t *player, const mpeg_cancel_options_t *cancel_options) {
+    mpeg_play_result_t result = MPEG_PLAY_NORMAL;
+
+    if(!player || !player->decoder)
+        return MPEG_PLAY_ERROR;
+
+    /* Init sound stream. */
+    sound_stream_reset(player);
+    sound_stream_start(player);
+
+    player->backend->video_start(player);
+
+    player->frame = mpeg_decode_frame(player);
+    if(!player->frame) {
+        /* Reset some stuff */
+        sound_stream_reset(player);
+        return MPEG_PLAY_ERROR;
+    }
+    player->start_time = mpeg_now(player);
+
+    while(true) {
+        /* Check cancel matching */
+        int cancel = player->backend->check_cancel(player, cancel_options);
+        if(cancel == 1 || cancel == 2) {
+            result = (cancel == 1) ? MPEG_PLAY_CANCEL_INPUT : MPEG_PLAY_CANCEL_RESET;
+            goto finish;
+        }
+
+        /* Poll audio regardless */
+        player->backend->audio_poll(player);
+
+        /* Present on the planned refresh, but only once that won't block, so
+           audio keeps being polled while the previous scene renders */
+        uint64_t due = mpeg_frame_due(player);
+        if(mpeg_now(player) >= due && player->backend->video_ready(player)) {
+            /* Render the current frame */
+            player->backend->video_present(player);
+
+            /* Decode the NEXT frame to have it ready */
+            player->frame = mpeg_decode_frame(player);
+            if(!player->frame) {
+                /* Are we looping? */
+                if(!player->loop) {
+                    result = MPEG_PLAY_NORMAL;
+                    goto finish;
+                }
+
+                /* We are looping. Reset and restart */
+                mpeg_player_reset(player);
+                sound_stream_start(player);
+
+                player->frame = mpeg_decode_frame(player);
+                if(!player->frame) {
+                    result = MPEG_PLAY_ERROR;
+                    goto finish;
+                }
+
+                player->start_time = mpeg_now(player);
+            }
+
+            /* Get it into a texture in the slack before it is due */
+            player->backend->video_prepare(player);
+        }
+        else {
+            player->backend->idle(player, due);
+        }
+    }
+
+finish:
+    /* Reset some stuff */
+    sound_stream_reset(player);
+    player->start_time = 0;
+
+    return result;
+}
+
+mpeg_play_result_t mpeg_play(mpeg_player_t *player, uint32_t cancel_buttons) {
+    mpeg_cancel_options_t opts = {
+        .pad_button_any = cancel_buttons
+    };
+
+    return mpeg_play_ex(player, &opts);
+}
+
+mpeg_decode_result_t mpeg_decode_step(mpeg_player_t *player) {
+    if(!player || !player->decoder)
+        return MPEG_DECODE_ERROR;
+
+    if(player->start_time == 0) {
+        /* Init sound stream. */
+        sound_stream_reset(player);
+        sound_stream_start(player);
+
+        /* Prime the first frame */
+        player->frame = mpeg_decode_frame(player);
+        if(!player->frame)
+            return MPEG_DECODE_EOF;
+
+        player->start_time = mpeg_now(player);
+
+        /* Poll first thing as well since we have a video frame ready */
+        player->backend->audio_poll(player);
+        return MPEG_DECODE_FRAME;
+    }
+
+    /* Get elapsed playback time */
+    double playback_time = (mpeg_now(player) - player->start_time) * 1e-9;
+
+    /* Poll audio regardless */
+    player->backend->audio_poll(player);
+
+    /* Check if it's time to decode the next frame */
+    if(playback_time >= player->frame->time) {
+        player->frame = mpeg_decode_frame(player);
+        if(player->frame)
+            return MPEG_DECODE_FRAME;
+
+        /* Are we looping? */
+        if(!player->loop) {
+            sound_stream_reset(player);
+            player->start_time = 0;
+            return MPEG_DECODE_EOF;
+        }
+
+        /* We are Looping. Reset and restart */
+        mpeg_player_reset(player);
+        sound_stream_start(player);
+
+        player->frame = mpeg_decode_frame(player);
+        if(!player->frame) {
+            sound_stream_reset(player);
+            return MPEG_DECODE_EOF;
+        }
+
+        player->start_time = mpeg_now(player);
+        return MPEG_DECODE_FRAME;
+    }
+
+    player->backend->idle(player, mpeg_frame_time(player));
+    return MPEG_DECODE_IDLE;
+}
+
+void mpeg_upload_frame(mpeg_player_t *player) {
+    if(!player || !player->frame)
+        return;
+
+    /* Already in the texture if it was streamed row by row or prepared */
+    if(player->frame->display == player->uploaded_display)
+        return;
+
+    uint64_t start = mpeg_perf_ns();
+    player->backend->video_upload(player);
+    mpeg_timing_add(&player->stats.upload, mpeg_perf_ns() - start);
+    player->uploaded_display = player->frame->display;
+}
+
+void mpeg_draw_frame(mpeg_player_t *player) {
+    if(!player || !player->frame)
+        return;
+
+    mpeg_frame_presented(player);
+    player->backend->video_draw(player);
+}
+
+/* --- Worker pool --- */
+
+#define MPEG_POOL_MAX_THREADS 32
+
+/* Runs job number job of the current batch. worker is the index of the pool
+   thread running it, or MPEG_POOL_MAX_THREADS for the calling thread. */
+typedef void (*mpeg_pool_job_t)(void *user, int job, int worker);
+
+typedef struct mpeg_pool_t mpeg_pool_t;
+
+typedef struct {
+    mpeg_pool_t *pool;
+    int index;
+} mpeg_pool_worker_t;
+
+/* Threads that take the jobs of a batch one at a time. Jobs are handed out
+   from next to end, which is empty outside mpeg_pool_run() so that a worker
+   waking late can't start on a batch still being set up. */
+struct mpeg_pool_t {
+    mpeg_pool_job_t run_job;
+    void *user;
+    int next;
+    int end;
+
+#ifndef _arch_dreamcast
+    pthread_t threads[MPEG_POOL_MAX_THREADS];
+    mpeg_pool_worker_t workers[MPEG_POOL_MAX_THREADS];
+    int thread_count;
+    pthread_mutex_t lock;
+    pthread_cond_t work;        /* A new batch or quit, for the workers */
+    pthread_cond_t done;        /* The batch is finished, for the caller */
+    unsigned batch;
+    int active;
+    bool quit;
+#endif
+};
+
+/* Next job, or -1 once all are handed out. Called with the lock held when
+   there are workers. */
+static int mpeg_pool_next_job(mpeg_pool_t *pool) {
+    if(pool->next >= pool->end)
+        return -1;
+
+    return pool->next++;
+}
+
+#ifndef _arch_dreamcast
+/* Run jobs until there are none left. Called with the lock held. */
+static void mpeg_pool_work(mpeg_pool_t *pool, int worker) {
+    int job;
+
+    while((job = mpeg_pool_next_job(pool)) >= 0) {
+        pool->active++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->run_job(pool->user, job, worker);
+        pthread_mutex_lock(&pool->lock);
+        pool->active--;
+    }
+
+    if(pool->active == 0)
+        pthread_cond_broadcast(&pool->done);
+}
+
+static void *mpeg_pool_worker(void *arg) {
+    mpeg_pool_worker_t *worker = (mpeg_pool_worker_t *)arg;
+    mpeg_pool_t *pool = worker->pool;
+    unsigned batch = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    while(true) {
+        while(!pool->quit && pool->batch == batch)
+            pthread_cond_wait(&pool->work, &pool->lock);
+
+        if(pool->quit)
+            break;
+
+        batch = pool->batch;
+        mpeg_pool_work(pool, worker->index);
+    }
+    pthread_mutex_unlock(&pool->lock);
+
+    return NULL;
+}
+#endif
+
+/* Start up to threads workers; fewer if some fail to start. The pool must be
+   zeroed. */
+static void mpeg_pool_init(mpeg_pool_t *pool, int threads, mpeg_pool_job_t run_job, void *user) {
+    pool->run_job = run_job;
+    pool->user = user;
+
+#ifndef _arch_dreamcast
+    if(threads > MPEG_POOL_MAX_THREADS)
+        threads = MPEG_POOL_MAX_THREADS;
+
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    for(int i = 0; i < threads; i++) {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        if(pthread_create(&pool->threads[i], NULL, mpeg_pool_worker, &pool->workers[i]) != 0)
+            break;
+        pool->thread_count++;
+    }
+#else
+    (void)threads;
+#endif
+}
+
+static void mpeg_pool_destroy(mpeg_pool_t *pool) {
+#ifndef _arch_dreamcast
+    pthread_mutex_lock(&pool->lock);
+    pool->quit = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for(int i = 0; i < pool->thread_count; i++)
+        pthread_join(pool->threads[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+#else
+    (void)pool;
+#endif
+}
+
+/* Run jobs 0 to count - 1 and return once all are done */
+static void mpeg_pool_run(mpeg_pool_t *pool, int count) {
+    int job;
+
+#ifndef _arch_dreamcast
+    if(pool->thread_count > 0) {
+        pthread_mutex_lock(&pool->lock);
+        pool->next = 0;
+        pool->end = count;
+        pool->batch++;
+        pthread_cond_broadcast(&pool->work);
+
+        /* Take jobs as well rather than just wait */
+        mpeg_pool_work(pool, MPEG_POOL_MAX_THREADS);
+        while(pool->next < pool->end || pool->active > 0)
+            pthread_cond_wait(&pool->done, &pool->lock);
+
+        pool->next = pool->end = 0;
+        pthread_mutex_unlock(&pool->lock);
+        return;
+    }
+#endif
+
+    pool->next = 0;
+    pool->end = count;
+    while((job = mpeg_pool_next_job(pool)) >= 0)
+        pool->run_job(pool->user, job, MPEG_POOL_MAX_THREADS);
+    pool->next = pool->end = 0;
+}
+
+/* --- Multi-stream scheduler --- */
+
+#define MPEG_SCHEDULER_MAX_THREADS 8
+
+typedef struct mpeg_sched_stream_t {
+    mpeg_player_t *player;
+    int priority;
+    uint64_t deadline;          /* When the frame after the current one is due */
+    plm_frame_t *decoded;       /* Result of this update's decode */
+    bool decode_ran;
+    bool ended;
+} mpeg_sched_stream_t;
+
+struct mpeg_scheduler_t {
+    mpeg_sched_stream_t streams[MPEG_SCHEDULER_MAX_STREAMS];
+    int stream_count;
+    bool overloaded;
+
+    /* This update's decodes, earliest deadline first. The pool hands them
+       out in order; once the budget runs out the rest are skipped. */
+    int jobs[MPEG_SCHEDULER_MAX_STREAMS];
+    int job_count;
+    uint64_t batch_start;
+    uint64_t budget_ns;
+
+    mpeg_pool_t pool;
+};
+
+static mpeg_sched_stream_t *mpeg_scheduler_find(mpeg_scheduler_t *sched, mpeg_player_t *player) {
+    for(int i = 0; i < sched->stream_count; i++) {
+        if(sched->streams[i].player == player)
+            return &sched->streams[i];
+    }
+
+    return NULL;
+}
+
+/* Decode the job-th stream of this update, unless the budget is spent */
+static void mpeg_scheduler_decode(void *user, int job, int worker) {
+    mpeg_scheduler_t *sched = (mpeg_scheduler_t *)user;
+    mpeg_sched_stream_t *stream = &sched->streams[sched->jobs[job]];
+    (void)worker;
+
+    if(sched->budget_ns && mpeg_perf_ns() - sched->batch_start > sched->budget_ns)
+        return;
+
+    stream->decoded = mpeg_decode_frame(stream->player);
+    stream->decode_ran = true;
+}
+
+/* While any stream is behind, streams below the top priority drop their
+   B-pictures */
+static void mpeg_scheduler_shed(mpeg_scheduler_t *sched) {
+    int top = sched->streams[0].priority;
+
+    for(int i = 1; i < sched->stream_count; i++) {
+        if(sched->streams[i].priority > top)
+            top = sched->streams[i].priority;
+    }
+
+    for(int i = 0; i < sched->stream_count; i++) {
+        mpeg_sched_stream_t *stream = &sched->streams[i];
+        plm_set_video_skip_b_pictures(stream->player->decoder,
+                                      sched->overloaded && stream->priority < top);
+    }
+}
+
+/* Take a stream out of the scheduler's hands and back to normal decoding */
+static void mpeg_scheduler_release(mpeg_sched_stream_t *stream) {
+    mpeg_player_t *player = stream->player;
+
+    sound_stream_reset(player);
+    player->start_time = 0;
+    plm_set_video_skip_b_pictures(player->decoder, FALSE);
+}
+
+mpeg_scheduler_t *mpeg_scheduler_create(int threads) {
+    mpeg_scheduler_t *sched = (mpeg_scheduler_t *)MPEG_MALLOC(sizeof(mpeg_scheduler_t));
+    if(!sched)
+        return NULL;
+
+    memset(sched, 0, sizeof(mpeg_scheduler_t));
+
+    if(threads > MPEG_SCHEDULER_MAX_THREADS)
+        threads = MPEG_SCHEDULER_MAX_THREADS;
+    mpeg_pool_init(&sched->pool, threads, mpeg_scheduler_decode, sched);
+
+    return sched;
+}
+
+void mpeg_scheduler_destroy(mpeg_scheduler_t *sched) {
+    if(!sched)
+        return;
+
+    mpeg_pool_destroy(&sched->pool);
+
+    for(int i = 0; i < sched->stream_count; i++)
+        mpeg_scheduler_release(&sched->streams[i]);
+
+    MPEG_FREE(sched);
+}
+
+bool mpeg_scheduler_add(mpeg_scheduler_t *sched, mpeg_player_t *player, int priority) {
+    if(!sched || !player || !player->decoder)
+        return false;
+
+    if(sched->stream_count >= MPEG_SCHEDULER_MAX_STREAMS || mpeg_scheduler_find(sched, player))
+        return false;
+
+    mpeg_sched_stream_t *stream = &sched->streams[sched->stream_count++];
+    memset(stream, 0, sizeof(mpeg_sched_stream_t));
+    stream->player = player;
+    stream->priority = priority;
+
+    /* Primed by the next update, like mpeg_decode_step() */
+    player->start_time = 0;
+    mpeg_scheduler_shed(sched);
+
+    return true;
+}
+
+void mpeg_scheduler_remove(mpeg_scheduler_t *sched, mpeg_player_t *player) {
+    if(!sched)
+        return;
+
+    mpeg_sched_stream_t *stream = mpeg_scheduler_find(sched, player);
+    if(!stream)
+        return;
+
+    mpeg_scheduler_release(stream);
+
+    *stream = sched->streams[--sched->stream_count];
+    if(sched->stream_count)
+        mpeg_scheduler_shed(sched);
+}
+
+bool mpeg_scheduler_has_ended(mpeg_scheduler_t *sched, mpeg_player_t *player) {
+    if(!sched)
+        return true;
+
+    mpeg_sched_stream_t *stream = mpeg_scheduler_find(sched, player);
+    return !stream || stream->ended;
+}
+
+int mpeg_scheduler_update(mpeg_scheduler_t *sched, uint32_t budget_us) {
+    int new_frames = 0;
+    bool behind = false;
+
+    if(!sched)
+        return 0;
+
+    sched->batch_start = mpeg_perf_ns();
+    sched->budget_ns = (uint64_t)budget_us * 1000;
+    sched->job_count = 0;
+
+    for(int i = 0; i < sched->stream_count; i++) {
+        mpeg_sched_stream_t *stream = &sched->streams[i];
+        mpeg_player_t *player = stream->player;
+
+        stream->decode_ran = false;
+        if(stream->ended)
+            continue;
+
+        if(player->start_time == 0) {
+            sound_stream_reset(player);
+            sound_stream_start(player);
+
+            player->frame = mpeg_decode_frame(player);
+            if(!player->frame) {
+                sound_stream_reset(player);
+                stream->ended = true;
+                continue;
+            }
+
+            player->start_time = mpeg_now(player);
+            new_frames++;
+        }
+
+        player->backend->audio_poll(player);
+
+        uint64_t now = mpeg_now(player);
+        if(now < mpeg_frame_time(player))
+            continue;
+
+        double framerate = plm_get_framerate(player->decoder);
+        stream->deadline = mpeg_frame_time(player) +
+                           (framerate > 0.0 ? (uint64_t)(1e9 / framerate) : 0);
+        if(now > stream->deadline)
+            behind = true;
+
+        /* Insert in deadline order */
+        int j = sched->job_count++;
+        while(j > 0 && sched->streams[sched->jobs[j - 1]].deadline > stream->deadline) {
+            sched->jobs[j] = sched->jobs[j - 1];
+            j--;
+        }
+        sched->jobs[j] = i;
+    }
+
+    if(behind != sched->overloaded) {
+        sched->overloaded = behind;
+        mpeg_scheduler_shed(sched);
+    }
+
+    /* Nothing due: let each player wait, or move its clock on */
+    if(sched->job_count == 0) {
+        for(int i = 0; i < sched->stream_count; i++) {
+            mpeg_player_t *player = sched->streams[i].player;
+            if(!sched->streams[i].ended)
+                player->backend->idle(player, mpeg_frame_time(player));
+        }
+
+        return new_frames;
+    }
+
+    mpeg_pool_run(&sched->pool, sched->job_count);
+
+    /* Looping and the end of streams touch the audio, so they stay here */
+    for(int i = 0; i < sched->job_count; i++) {
+        mpeg_sched_stream_t *stream = &sched->streams[sched->jobs[i]];
+        mpeg_player_t *player = stream->player;
+
+        if(!stream->decode_ran)
+            continue;
+
+        if(stream->decoded) {
+            player->frame = stream->decoded;
+            new_frames++;
+            continue;
+        }
+
+        /* Keep showing the last frame of a stream that doesn't loop. It is
+           still in its texture and already counted. */
+        if(!player->loop) {
+            sound_stream_reset(player);
+            player->uploaded_display = player->frame->display;
+            player->frame_presented = true;
+            stream->ended = true;
+            continue;
+        }
+
+        mpeg_player_reset(player);
+        sound_stream_start(player);
+
+        player->frame = mpeg_decode_frame(player);
+        if(!player->frame) {
+            sound_stream_reset(player);
+            stream->ended = true;
+            continue;
+        }
+
+        player->start_time = mpeg_now(player);
+        new_frames++;
+    }
+
+    return new_frames;
+}
+
+/* --- Batch decoding --- */
+
+/* Each thread keeps one arena and only grows it, so a batch of similar
+   clips allocates once per thread */
+typedef struct {
+    void *memory;
+    size_t size;
+} mpeg_batch_arena_t;
+
+struct mpeg_batch_t {
+    mpeg_batch_arena_t arenas[MPEG_POOL_MAX_THREADS + 1];    /* Last one is the caller's */
+
+    const char *const *filenames;
+    mpeg_batch_result_t *results;
+
+    mpeg_pool_t pool;
+};
+
+typedef struct {
+    mpeg_batch_result_t *result;
+    double frame_duration;
+    double sample_duration;
+} mpeg_batch_file_t;
+
+static void mpeg_batch_video(plm_t *plm, plm_frame_t *frame, void *user) {
+    mpeg_batch_file_t *file = (mpeg_batch_file_t *)user;
+    mpeg_batch_result_t *result = file->result;
+    size_t size = (size_t)frame->y.width * frame->y.height * 3 / 2;
+    (void)plm;
+
+    /* Same data and hash as the headless backend */
+    result->frames++;
+    result->frame_checksum = mpeg_fnv1a(result->frame_checksum, (const uint8_t *)frame->display, size);
+    if(frame->time + file->frame_duration > result->duration)
+        result->duration = frame->time + file->frame_duration;
+}
+
+static void mpeg_batch_audio(plm_t *plm, plm_samples_t *samples, void *user) {
+    mpeg_batch_file_t *file = (mpeg_batch_file_t *)user;
+    mpeg_batch_result_t *result = file->result;
+    size_t size = samples->count * AUDIO_CHANNELS * sizeof(short);
+    (void)plm;
+
+    result->audio_frames++;
+    result->pcm_bytes += size;
+    result->pcm_checksum = mpeg_fnv1a(result->pcm_checksum, (const uint8_t *)samples->pcm, size);
+    if(samples->time + file->sample_duration > result->duration)
+        result->duration = samples->time + file->sample_duration;
+}
+
+static void mpeg_batch_decode_file(mpeg_batch_arena_t *arena, const char *filename,
+                                   mpeg_batch_result_t *result) {
+    uint64_t start = mpeg_perf_ns();
+    mpeg_batch_file_t file = { result, 0.0, 0.0 };
+
+    memset(result, 0, sizeof(mpeg_batch_result_t));
+    result->frame_checksum = MPEG_FNV_OFFSET;
+    result->pcm_checksum = MPEG_FNV_OFFSET;
+
+    plm_buffer_t *buffer = plm_buffer_create_with_filename(filename);
+    if(!buffer)
+        return;
+
+    size_t size = plm_get_arena_size(buffer);
+    plm_buffer_destroy(buffer);
+    if(!size)
+        return;
+
+    if(size > arena->size) {
+        /* Some headroom, so the next slightly larger clip fits as well */
+        size_t grow = size + size / 4;
+        void *memory = MPEG_MEMALIGN(32, grow);
+        if(!memory)
+            return;
+
+        MPEG_FREE(arena->memory);
+        arena->memory = memory;
+        arena->size = grow;
+    }
+
+    plm_t *decoder = plm_create_with_filename_arena(filename, arena->memory, arena->size);
+    if(!decoder)
+        return;
+
+    if(!plm_has_headers(decoder)) {
+        plm_destroy(decoder);
+        return;
+    }
+
+    if(plm_get_framerate(decoder) > 0.0)
+        file.frame_duration = 1.0 / plm_get_framerate(decoder);
+    if(plm_get_samplerate(decoder) > 0)
+        file.sample_duration = (double)PLM_AUDIO_SAMPLES_PER_FRAME / plm_get_samplerate(decoder);
+
+    plm_set_video_decode_callback(decoder, mpeg_batch_video, &file);
+    plm_set_audio_decode_callback(decoder, mpeg_batch_audio, &file);
+
+    while(!plm_has_ended(decoder))
+        plm_decode(decoder, 1.0);
+
+    result->arena_used = plm_get_arena_used(decoder);
+    result->decode_us = (uint32_t)((mpeg_perf_ns() - start) / 1000);
+
+    /* Decoding stops on an error like at the end of the file */
+    result->ok = !plm_has_error(decoder) && (result->frames || result->audio_frames);
+    plm_destroy(decoder);
+}
+
+static void mpeg_batch_job(void *user, int job, int worker) {
+    mpeg_batch_t *batch = (mpeg_batch_t *)user;
+
+    mpeg_batch_decode_file(&batch->arenas[worker], batch->filenames[job], &batch->results[job]);
+}
+
+mpeg_batch_t *mpeg_batch_create(int threads) {
+    mpeg_batch_t *batch = (mpeg_batch_t *)MPEG_MALLOC(sizeof(mpeg_batch_t));
+    if(!batch)
+        return NULL;
+
+    memset(batch, 0, sizeof(mpeg_batch_t));
+    mpeg_pool_init(&batch->pool, threads, mpeg_batch_job, batch);
+
+    return batch;
+}
+
+void mpeg_batch_destroy(mpeg_batch_t *batch) {
+    if(!batch)
+        return;
+
+    mpeg_pool_destroy(&batch->pool);
+
+    for(int i = 0; i <= MPEG_POOL_MAX_THREADS; i++)
+        MPEG_FREE(batch->arenas[i].memory);
+
+    MPEG_FREE(batch);
+}
+
+int mpeg_batch_decode(mpeg_batch_t *batch, const char *const *filenames, int count,
+                      mpeg_batch_result_t *results) {
+    int decoded = 0;
+
+    if(!batch || !filenames || !results || count <= 0)
+        return 0;
+
+    batch->filenames = filenames;
+    batch->results = results;
+    mpeg_pool_run(&batch->pool, count);
+
+    for(int i = 0; i < count; i++) {
+        if(results[i].ok)
+            decoded++;
+    }
+
+    return decoded;
+}
+
+static __attribute__((noinline)) void fast_memcpy(void *dest, const void *src, size_t length) {
+    uint8_t *d = (uint8_t *)dest;
+    const uint8_t *s = (const uint8_t *)src;
+
+    size_t prefix = ((size_t)32 - ((uintptr_t)d & 31)) & 31;
+    if(prefix > length)
+        prefix = length;
+
+    for(size_t i = 0; i < prefix; i++)
+        d[i] = s[i];
+
+    d += prefix;
+    s += prefix;
+    length -= prefix;
+
+    if(length >= 32 && (((uintptr_t)s & 7) == 0)) {
+        size_t block_bytes = length & ~(size_t)31;
+
+#ifdef _arch_dreamcast
         size_t blocks = block_bytes >> 5;
 
         sq_lock(d);
         sq_fast_cpy(SQ_MASK_DEST(d), s, blocks);
         sq_unlock();
+#else
+        memcpy(d, s, block_bytes);
+#endif
 
         d += block_bytes;
         s += block_bytes;
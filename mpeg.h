@@ -30,8 +30,23 @@ extern "C" {
 #endif
 
 #include <stdio.h>
+#include <stdbool.h>
 
+#ifdef _arch_dreamcast
 #include <dc/pvr/pvr_header.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+
+/* Off target only the headless backend exists. These stand in for the PVR
+   types that appear in mpeg_player_options_t so it keeps the same shape. */
+typedef int pvr_list_type_t;
+typedef int pvr_filter_mode_t;
+#define PVR_LIST_OP_POLY    0
+#define PVR_LIST_TR_POLY    2
+#define PVR_FILTER_NONE     0
+#define PVR_FILTER_BILINEAR 2
+#endif
 
 /**
     \defgroup mpeg_customization Build-Time Customization
@@ -77,7 +92,8 @@ extern "C" {
 
     These define how the MPEG decoder opens and reads MPEG files.
 
-    If none are defined, the library uses KallistiOS file I/O:
+    If none are defined, the library uses KallistiOS file I/O (POSIX `open()`,
+    `read()` and `lseek()` on a host build):
 
     ```c
     #define MPEG_FILE_TYPE                 file_t
@@ -138,7 +154,7 @@ extern "C" {
         !defined(MPEG_FILE_TELL)
         #error "If you override any MPEG_FILE_* macro, you must override all: TYPE, INVALID_HANDLE, OPEN, CLOSE, SEEK, READ, TELL."
     #endif
-#else
+#elif defined(_arch_dreamcast)
     #define MPEG_FILE_TYPE                 file_t
     #define MPEG_FILE_INVALID_HANDLE       FILEHND_INVALID
     #define MPEG_FILE_OPEN(fn)             fs_open((fn), O_RDONLY)
@@ -146,6 +162,14 @@ extern "C" {
     #define MPEG_FILE_SEEK(fh, off, st)    fs_seek((fh), (off), (st))
     #define MPEG_FILE_READ(fh, buf, size)  fs_read((fh), (buf), (size))
     #define MPEG_FILE_TELL(fh)             fs_tell((fh))
+#else
+    #define MPEG_FILE_TYPE                 int
+    #define MPEG_FILE_INVALID_HANDLE       (-1)
+    #define MPEG_FILE_OPEN(fn)             open((fn), O_RDONLY)
+    #define MPEG_FILE_CLOSE(fh)            close((fh))
+    #define MPEG_FILE_SEEK(fh, off, st)    lseek((fh), (off), (st))
+    #define MPEG_FILE_READ(fh, buf, size)  read((fh), (buf), (size))
+    #define MPEG_FILE_TELL(fh)             lseek((fh), 0, SEEK_CUR)
 #endif
 
 typedef struct mpeg_player_t mpeg_player_t;
@@ -179,6 +203,16 @@ mpeg_player_t *mpeg_player_create(const char *filename);
 */
 mpeg_player_t *mpeg_player_create_memory(unsigned char *memory, const size_t length);
 
+/**
+ * \enum mpeg_backend_type_t
+ * Where the player sends video and audio, and where it gets time and input.
+ */
+typedef enum mpeg_backend_type_t {
+    MPEG_BACKEND_DEFAULT = 0,           /**< PVR, AICA and maple on Dreamcast; headless elsewhere */
+    MPEG_BACKEND_HEADLESS,              /**< Consume frames and PCM in real time, without output */
+    MPEG_BACKEND_HEADLESS_UNTHROTTLED   /**< Same, but skip ahead instead of waiting for frame times */
+} mpeg_backend_type_t;
+
 /**
  * \struct mpeg_player_options_t
  * Playback options for MPEG player.
@@ -188,8 +222,19 @@ typedef struct mpeg_player_options_t {
     pvr_filter_mode_t   filter_mode;  /**< Texture filter mode */
     uint8_t             volume;       /**< Volume (0–255) */
     bool                loop;         /**< Enable looping */
+    void               *arena;        /**< Optional 32-byte aligned block to carve the player from */
+    size_t              arena_size;   /**< Size of \p arena in bytes */
+    bool                fast_start;   /**< Read as little as possible before the first frame */
+    uint8_t             texture_count; /**< Video textures to alternate (1 to MPEG_MAX_TEXTURES) */
+    bool                stream_rows;  /**< Upload macroblock rows while the frame decodes */
+    mpeg_backend_type_t backend;      /**< Video/audio sink, clock and input to use */
+    uint8_t             refresh_rate; /**< Display refresh in Hz to schedule frames on, 0 to detect */
+    bool                adaptive_audio; /**< Size the sound stream's lead to the content at runtime */
 } mpeg_player_options_t;
 
+/** \brief Maximum number of video textures a player can alternate between. */
+#define MPEG_MAX_TEXTURES 3
+
 /**
  * \def MPEG_PLAYER_OPTIONS_INITIALIZER
  * Default initializer for `mpeg_player_options_t`.
@@ -199,6 +244,63 @@ typedef struct mpeg_player_options_t {
  * - `filter_mode` = `PVR_FILTER_BILINEAR`
  * - `volume`      = `255`
  * - `loop`        = `false`
+ * - `arena`       = `NULL` (allocate from the heap)
+ * - `arena_size`  = `0`
+ * - `fast_start`  = `false`
+ * - `texture_count` = `1`
+ * - `stream_rows` = `false`
+ * - `backend`     = `MPEG_BACKEND_DEFAULT`
+ * - `refresh_rate` = `0` (50 Hz for PAL video modes, 60 Hz otherwise)
+ * - `adaptive_audio` = `false`
+ *
+ * When `arena` is set, the player, its sound buffer and the whole decoder are
+ * carved from that one block and nothing is allocated from the heap during
+ * playback. Use mpeg_player_get_arena_size() to size it. The block must stay
+ * valid until mpeg_player_destroy() and is never freed by the player.
+ *
+ * When `fast_start` is set, a file is opened without looking up its size or
+ * prescanning its packets, so the first frame shows after reading only the
+ * first few sectors. It has no effect on memory sources or with `arena`,
+ * whose size is computed for a full prescan.
+ *
+ * With a `texture_count` of 2 or more, each frame is uploaded to the next
+ * texture while the PVR may still be rendering the previous one, instead of
+ * waiting for the render to finish first. Each texture costs another
+ * texture's worth of video memory. With exactly 2, mpeg_play_ex() first
+ * waits for the scenes rendered before it to be flipped, up to three display
+ * refreshes, so that it knows which of its own scenes each upload waits for.
+ *
+ * When `stream_rows` is also set, each macroblock row of a B-picture is sent
+ * to the spare texture as soon as it is decoded, overlapping the transfer with
+ * the decode of the next row; mpeg_upload_frame() then has nothing left to do
+ * for that frame. Reference pictures are shown one picture after they decode
+ * and are still uploaded whole. It has no effect with a single texture.
+ *
+ * The headless backends decode and pace exactly like the PVR one but only
+ * checksum the frames and PCM they consume, see mpeg_player_get_headless_stats().
+ * They have no input, so playback only ends with the stream. Unthrottled, the
+ * player clock only moves by jumping to the next frame time instead of waiting
+ * for it, so a clip runs as fast as it decodes and its checksums are the same
+ * on every run. The timing stats still use the real clock. They are the only backends on a host build
+ * and can also be used on the Dreamcast to time decoding without rendering.
+ * The PVR options above are ignored by them.
+ *
+ * mpeg_play_ex() plans each frame onto the display refresh nearest its
+ * timestamp and submits it one refresh ahead, so 24 fps content keeps an even
+ * 3:2 cadence at 60 Hz. It never blocks waiting for the PVR: until the
+ * previous scene is done it keeps polling audio and input instead, and with a
+ * spare texture the next frame is uploaded as soon as it is decoded. Set
+ * `refresh_rate` if the display runs at a rate the video mode doesn't tell.
+ * The headless backends pace presents on the same refresh, 60 Hz by default.
+ *
+ * By default the sound stream keeps its whole buffer filled, which adds
+ * about 340 ms of audio at 48 kHz ahead of what plays. With `adaptive_audio`
+ * it only holds as much as the longest recent gap between two fills needs
+ * (the player decodes and waits for the PVR in these gaps), with headroom.
+ * The depth grows as soon as the content gets heavier or the stream runs
+ * dry, and shrinks again slowly, between one MP2 frame and the full buffer.
+ * mpeg_player_get_stats() reports the gaps, the depth and how often the
+ * stream ran dry.
  *
  * Example:
  * ```c
@@ -207,7 +309,7 @@ typedef struct mpeg_player_options_t {
  * ```
  */
 #define MPEG_PLAYER_OPTIONS_INITIALIZER \
-    { PVR_LIST_OP_POLY, PVR_FILTER_BILINEAR, 255, false }
+    { PVR_LIST_OP_POLY, PVR_FILTER_BILINEAR, 255, false, NULL, 0, false, 1, false, MPEG_BACKEND_DEFAULT, 0, false }
 
 /** \brief   Create an MPEG player instance with custom options.
     \ingroup mpeg_playback
@@ -250,6 +352,190 @@ mpeg_player_t *mpeg_player_create_ex(const char *filename, const mpeg_player_opt
 */
 mpeg_player_t *mpeg_player_create_memory_ex(unsigned char *memory, const size_t length, const mpeg_player_options_t *options);
 
+/** \brief   Create an MPEG player for separate video and audio files.
+    \ingroup mpeg_playback
+
+    Plays an MPEG-1 video elementary stream (.m1v) with an optional MPEG-1
+    Layer II audio stream (.mp2) instead of a multiplexed MPEG-PS file. Each
+    decoder reads its own file directly, so nothing is demultiplexed or copied
+    and the two files may live anywhere, e.g. in different regions of a disc.
+
+    Elementary streams have no timestamps. Playback follows the frame rate and
+    the audio sample count, and the duration is unknown. Arenas are not
+    supported.
+
+    \param  video_filename  The video stream to play. Must not be NULL.
+    \param  audio_filename  The audio stream to play alongside it, or NULL
+                            for silent video.
+    \param  options         Optional pointer to a mpeg_player_options_t structure
+                            specifying playback and rendering options.
+                            May be NULL to use defaults.
+    \return                 A pointer to an initialized mpeg_player_t structure,
+                            or NULL if initialization fails at any stage.
+*/
+mpeg_player_t *mpeg_player_create_elementary_ex(const char *video_filename, const char *audio_filename,
+                                                const mpeg_player_options_t *options);
+
+/** \brief   Get the arena size needed to play an MPEG file.
+    \ingroup mpeg_playback
+
+    Reads the video sequence header of the file to find the frame size and
+    returns the number of bytes `mpeg_player_options_t.arena` must provide to
+    hold the player, its sound buffer and the decoder. The PVR texture is not
+    included as it lives in video memory.
+
+    \param  filename        The filename of the MPEG file. Must not be NULL.
+    \return                 The required arena size in bytes, or 0 if the
+                            file could not be opened or has no video.
+*/
+size_t mpeg_player_get_arena_size(const char *filename);
+
+/** \brief   Get the arena size needed to play MPEG data stored in memory.
+    \ingroup mpeg_playback
+
+    Same as mpeg_player_get_arena_size(), for data passed to
+    mpeg_player_create_memory_ex().
+
+    \param  memory          Pointer to the MPEG data in memory. Must not be NULL.
+    \param  length          Size of the MPEG data in bytes.
+    \return                 The required arena size in bytes, or 0 if the data
+                            has no video.
+*/
+size_t mpeg_player_get_arena_size_memory(unsigned char *memory, const size_t length);
+
+/**
+ * \struct mpeg_memory_report_t
+ * Memory used by an MPEG player, in bytes.
+ */
+typedef struct mpeg_memory_report_t {
+    size_t  frame_buffers;      /**< Decoded reference frames and their display copies */
+    size_t  rings;              /**< Demux, video and audio ring buffers */
+    size_t  ring_growth;        /**< Growth of the rings beyond their default size;
+                                     already part of `rings` in a live footprint */
+    size_t  audio_tables;       /**< Audio decoder state and synthesis tables */
+    size_t  decoder_structs;    /**< Remaining decoder structures */
+    size_t  player;             /**< Player struct and SH4 sound buffer */
+    size_t  total_ram;          /**< Sum of all of the above */
+    size_t  vram;               /**< PVR texture memory, for all textures */
+    size_t  small_ring_savings; /**< RAM saved by sizing the rings to the packets seen */
+} mpeg_memory_report_t;
+
+/** \brief   Get the memory needed to play an MPEG file.
+    \ingroup mpeg_playback
+
+    Parses the stream headers only and reports how much main and video memory
+    a player for this file would need with one texture, without creating it.
+    Use this to check a video fits next to the game's own assets before
+    starting it.
+
+    \param  filename        The filename of the MPEG file. Must not be NULL.
+    \param  report          Filled in with the memory requirements.
+    \return                 true on success, false if the file could not be
+                            opened or has no video.
+*/
+bool mpeg_player_query_memory(const char *filename, mpeg_memory_report_t *report);
+
+/** \brief   Get the memory currently used by an MPEG player.
+    \ingroup mpeg_playback
+
+    Reports the memory held right now, including any ring growth that
+    happened during playback.
+
+    \param  player          The MPEG player instance.
+    \param  report          Filled in with the current footprint.
+*/
+void mpeg_player_get_memory_footprint(mpeg_player_t *player, mpeg_memory_report_t *report);
+
+/**
+ * \struct mpeg_timing_stats_t
+ * Distribution of one measured time, in microseconds.
+ *
+ * `p99_us` comes from a histogram whose buckets are 1/8 of an octave wide, so
+ * it is within about 12% of the exact value.
+ */
+typedef struct mpeg_timing_stats_t {
+    uint32_t    count;          /**< Number of samples */
+    uint32_t    min_us;
+    uint32_t    avg_us;
+    uint32_t    p99_us;
+    uint32_t    max_us;
+} mpeg_timing_stats_t;
+
+/**
+ * \struct mpeg_player_stats_t
+ * Playback health of an MPEG player since it was created or its statistics
+ * were last reset.
+ */
+typedef struct mpeg_player_stats_t {
+    mpeg_timing_stats_t decode;     /**< Time in the decoder for each frame */
+    mpeg_timing_stats_t decode_i;   /**< Same, when the picture decoded last was an I-picture */
+    mpeg_timing_stats_t decode_p;   /**< ... a P-picture */
+    mpeg_timing_stats_t decode_b;   /**< ... a B-picture */
+    mpeg_timing_stats_t upload;     /**< Transfer of a frame to the texture */
+    mpeg_timing_stats_t lateness;   /**< How long after its time each frame was first drawn */
+    uint32_t    frames_shown;       /**< Frames drawn at least once */
+    uint32_t    frames_late;        /**< Frames first drawn more than one frame period late */
+    uint32_t    frames_dropped;     /**< Frames decoded and replaced without being drawn */
+    uint32_t    audio_underruns;    /**< Sound requests padded with silence before the end */
+    int         pcm_leftover_bytes; /**< Decoded PCM not yet handed to the sound stream */
+    mpeg_timing_stats_t audio_gap;  /**< Time between two fills of the sound stream (`adaptive_audio` only) */
+    uint32_t    audio_starved;      /**< Times the sound stream ran dry between fills (`adaptive_audio` only) */
+    int         audio_depth;        /**< PCM bytes the sound stream may hold ahead right now */
+    int         audio_depth_peak;   /**< Largest depth chosen so far */
+    size_t      demux_fill;         /**< Bytes waiting in the demux buffer */
+    size_t      demux_capacity;
+    size_t      video_fill;         /**< Bytes waiting in the video buffer */
+    size_t      video_capacity;
+    size_t      audio_fill;         /**< Bytes waiting in the audio buffer */
+    size_t      audio_capacity;
+} mpeg_player_stats_t;
+
+/** \brief   Get playback statistics of an MPEG player.
+    \ingroup mpeg_playback
+
+    Timings and counters accumulate until mpeg_player_reset_stats(); looping
+    or mpeg_player_reset() does not clear them. The PCM depth and buffer fill
+    levels are sampled when this is called, so poll it once per frame to see
+    how they move over a clip.
+
+    A frame counts as drawn the first time mpeg_draw_frame() or
+    mpeg_player_get_texture_hdr() is called for it.
+
+    \param  player          The MPEG player instance.
+    \param  stats           Filled in with the statistics.
+*/
+void mpeg_player_get_stats(mpeg_player_t *player, mpeg_player_stats_t *stats);
+
+/** \brief   Clear the playback statistics of an MPEG player.
+    \ingroup mpeg_playback
+
+    \param  player          The MPEG player instance.
+*/
+void mpeg_player_reset_stats(mpeg_player_t *player);
+
+/**
+ * \struct mpeg_headless_stats_t
+ * What a headless backend consumed. The checksums are FNV-1a over the data in
+ * the order it was consumed, so two runs of the same clip match as long as
+ * the same frames were shown.
+ */
+typedef struct mpeg_headless_stats_t {
+    uint32_t    frames;             /**< Frames uploaded */
+    uint32_t    frame_checksum;     /**< Over the macroblock data of every uploaded frame */
+    uint64_t    pcm_bytes;          /**< Decoded PCM bytes consumed, not counting padding */
+    uint32_t    pcm_checksum;       /**< Over every decoded PCM byte consumed */
+} mpeg_headless_stats_t;
+
+/** \brief   Get what a headless backend has consumed.
+    \ingroup mpeg_playback
+
+    \param  player          The MPEG player instance.
+    \param  stats           Filled in with the totals since the player was created.
+    \return                 true on success, false if the player doesn't use a
+                            headless backend.
+*/
+bool mpeg_player_get_headless_stats(mpeg_player_t *player, mpeg_headless_stats_t *stats);
+
 /**
     \brief   Retrieves the loop status of the MPEG player.
     \ingroup mpeg_playback
@@ -286,6 +572,25 @@ void mpeg_player_set_loop(mpeg_player_t *player, int loop);
  */
 void mpeg_player_set_volume(mpeg_player_t *player, uint8_t volume);
 
+/**
+    \brief   Decode only the D-pictures of a stream that has them.
+    \ingroup mpeg_playback
+
+    D-pictures hold only the average color of each 8x8 block and decode without
+    IDCT or motion compensation, so a trick-play track made of them can be
+    fast-forwarded or previewed at a fraction of the normal cost. Playback
+    shows the D-pictures at their own times and skips the rest. Skipped
+    pictures aren't counted as dropped frames.
+
+    Every picture decodes as usual until the first D-picture is found. When the
+    mode is turned off, P- and B-pictures are skipped up to the next
+    I-picture.
+
+    \param   player  The MPEG player instance to configure.
+    \param   only    true to decode only D-pictures.
+ */
+void mpeg_player_set_d_pictures_only(mpeg_player_t *player, bool only);
+
 
 /** \brief   Get the PVR polygon header for the video texture.
     \ingroup mpeg_playback
@@ -294,11 +599,20 @@ void mpeg_player_set_volume(mpeg_player_t *player, uint8_t volume);
     the player's video texture. This allows rendering the video onto
     custom geometry instead of using the built-in full-screen quad.
 
+    With more than one texture, this is the texture holding the most recently
+    uploaded frame, so fetch it again every frame. Calling this marks that
+    texture as in use by the scene being built, so the next uploads won't
+    overwrite it before the PVR has rendered that scene. The player can't see
+    which of your scenes are still in flight, so it assumes the one before
+    may be; use three textures for the upload to overlap the render fully.
+
     \param  player      The MPEG player instance. Must be initialized.
     \return             A pointer to the player's pvr_poly_hdr_t, or NULL
-                        if player is NULL.
+                        if player is NULL or uses a headless backend.
 */
+#ifdef _arch_dreamcast
 const pvr_poly_hdr_t *mpeg_player_get_texture_hdr(mpeg_player_t *player);
+#endif
 
 /** \brief   Get the UV scale factors for the video texture.
     \ingroup mpeg_playback
@@ -494,6 +808,14 @@ mpeg_decode_result_t mpeg_decode_step(mpeg_player_t *player);
     The frame must have already been decoded using `mpeg_decode_step()` or
     through the playback loop.
 
+    With more than one texture, the frame goes to the texture after the one
+    currently displayed. This waits only until the PVR has rendered the last
+    scene that used that texture, so it can be called before
+    `pvr_wait_ready()` to overlap the upload with the previous render. If no
+    scene is rendered for three display refreshes, e.g. because this is called
+    twice without a scene in between, it stops waiting for that scene and
+    calls `pvr_wait_ready()` instead.
+
     \param  player      The MPEG player instance. Must be initialized and must
                         have a valid frame decoded.
  */
@@ -513,6 +835,210 @@ void mpeg_upload_frame(mpeg_player_t *player);
  */
 void mpeg_draw_frame(mpeg_player_t *player);
 
+/** \brief Maximum number of players one scheduler can drive. */
+#define MPEG_SCHEDULER_MAX_STREAMS 16
+
+/** \brief   Opaque multi-stream decode scheduler.
+    \ingroup mpeg_playback
+
+    A scheduler decodes the video of several players at once, for video walls,
+    UI tiles or picture-in-picture. Each call to mpeg_scheduler_update() gives
+    the players whose current frame has come due the next one, in order of
+    their next deadline (earliest deadline first), within an optional time
+    budget.
+
+    When a stream falls behind, every stream with a lower priority than the
+    highest one drops its B-pictures without decoding them until all streams
+    have caught up. Nothing references a B-picture, so the dropped frames
+    don't affect the rest. They are counted in the players' `frames_dropped`.
+
+    On a host the decoding can be spread across a pool of threads, one
+    player per thread at a time. Audio, looping and uploads stay on the
+    calling thread.
+
+    Example:
+    \code
+    mpeg_scheduler_t *sched = mpeg_scheduler_create(0);
+    mpeg_scheduler_add(sched, main_player, 1);
+    mpeg_scheduler_add(sched, tile_player, 0);
+
+    while(playing) {
+        mpeg_scheduler_update(sched, 0);
+
+        pvr_wait_ready();
+        pvr_scene_begin();
+        mpeg_upload_frame(main_player);
+        mpeg_upload_frame(tile_player);
+        pvr_list_begin(PVR_LIST_OP_POLY);
+        ... draw each player with mpeg_player_get_texture_hdr() ...
+        pvr_list_finish();
+        pvr_scene_finish();
+    }
+    \endcode
+*/
+typedef struct mpeg_scheduler_t mpeg_scheduler_t;
+
+/** \brief   Create a multi-stream decode scheduler.
+    \ingroup mpeg_playback
+
+    \param  threads     Worker threads to decode on. 0 decodes on the thread
+                        calling mpeg_scheduler_update(). Ignored on the
+                        Dreamcast, which has a single core.
+
+    \return             A new scheduler, or NULL if allocation failed.
+*/
+mpeg_scheduler_t *mpeg_scheduler_create(int threads);
+
+/** \brief   Destroy a scheduler.
+    \ingroup mpeg_playback
+
+    Stops its threads. The players are not destroyed and go back to decoding
+    every B-picture.
+
+    \param  sched       The scheduler to destroy. May be NULL.
+*/
+void mpeg_scheduler_destroy(mpeg_scheduler_t *sched);
+
+/** \brief   Add a player to a scheduler.
+    \ingroup mpeg_playback
+
+    The player must not also be driven by mpeg_play_ex() or
+    mpeg_decode_step(). Its audio and looping keep working as they would with
+    mpeg_decode_step().
+
+    \param  sched       The scheduler.
+    \param  player      The player to drive.
+    \param  priority    Higher values keep their B-pictures longer under load.
+
+    \retval true        The player was added.
+    \retval false       The scheduler is full or the player is already in it.
+*/
+bool mpeg_scheduler_add(mpeg_scheduler_t *sched, mpeg_player_t *player, int priority);
+
+/** \brief   Remove a player from a scheduler.
+    \ingroup mpeg_playback
+
+    Stops the player's audio. The player keeps its position and can be added
+    again or played on its own afterwards.
+
+    \param  sched       The scheduler.
+    \param  player      The player to remove.
+*/
+void mpeg_scheduler_remove(mpeg_scheduler_t *sched, mpeg_player_t *player);
+
+/** \brief   Decode the frames that have come due.
+    \ingroup mpeg_playback
+
+    Polls every player's audio, then decodes one frame for each player whose
+    current frame is due, earliest next deadline first. Upload and draw the
+    players afterwards; mpeg_upload_frame() does nothing for a player that
+    has no new frame.
+
+    \param  sched       The scheduler.
+    \param  budget_us   Stop starting new decodes after this many
+                        microseconds, leaving later deadlines for the next
+                        call. 0 for no limit.
+
+    \return             The number of players that got a new frame.
+*/
+int mpeg_scheduler_update(mpeg_scheduler_t *sched, uint32_t budget_us);
+
+/** \brief   Check whether a scheduled player has reached its end.
+    \ingroup mpeg_playback
+
+    \param  sched       The scheduler.
+    \param  player      A player in the scheduler.
+
+    \return             true once a player that doesn't loop has shown its
+                        last frame, or if the player isn't in the scheduler.
+*/
+bool mpeg_scheduler_has_ended(mpeg_scheduler_t *sched, mpeg_player_t *player);
+
+/** \brief   Result of decoding one file with mpeg_batch_decode().
+    \ingroup mpeg_playback
+
+    The checksums are FNV-1a. The frame checksum covers the same data as the
+    headless backend's, so an unthrottled headless run of a file gives the
+    same value. The PCM checksum covers every decoded sample.
+*/
+typedef struct mpeg_batch_result_t {
+    bool        ok;             /**< The file was decoded to its end,
+                                     without an error and not to nothing */
+    uint32_t    frames;         /**< Video frames decoded */
+    uint32_t    frame_checksum; /**< Over the display data of every frame */
+    uint32_t    audio_frames;   /**< MP2 frames decoded */
+    uint64_t    pcm_bytes;      /**< 16-bit stereo PCM bytes decoded */
+    uint32_t    pcm_checksum;   /**< Over all PCM bytes */
+    double      duration;       /**< End of the last frame or sample in seconds */
+    uint32_t    decode_us;      /**< Wall time to open and decode the file */
+    size_t      arena_used;     /**< Arena bytes the file's decoder used */
+} mpeg_batch_result_t;
+
+/** \brief   Opaque batch decoder.
+    \ingroup mpeg_playback
+
+    Decodes whole files as fast as possible, for verifying many clips at
+    once. Files are handed out one at a time to a fixed pool of threads.
+    Each thread decodes into one arena that it reuses for every file and
+    only grows when a file needs more, so there is no per-file allocation
+    once the arenas are big enough.
+
+    Only MPEG-PS files can be batch decoded.
+
+    Example:
+    \code
+    mpeg_batch_t *batch = mpeg_batch_create(7);
+    mpeg_batch_result_t results[FILE_COUNT];
+
+    mpeg_batch_decode(batch, filenames, FILE_COUNT, results);
+    mpeg_batch_destroy(batch);
+    \endcode
+*/
+typedef struct mpeg_batch_t mpeg_batch_t;
+
+/** \brief   Create a batch decoder.
+    \ingroup mpeg_playback
+
+    \param  threads     Worker threads to decode on, besides the thread
+                        calling mpeg_batch_decode(). Use one less than the
+                        number of cores to keep them all busy. Ignored on the
+                        Dreamcast, which has a single core.
+
+    \return             A new batch decoder, or NULL if allocation failed.
+*/
+mpeg_batch_t *mpeg_batch_create(int threads);
+
+/** \brief   Destroy a batch decoder.
+    \ingroup mpeg_playback
+
+    Stops its threads and frees their arenas.
+
+    \param  batch       The batch decoder to destroy. May be NULL.
+*/
+void mpeg_batch_destroy(mpeg_batch_t *batch);
+
+/** \brief   Decode a list of files.
+    \ingroup mpeg_playback
+
+    Decodes every file to its end, video and audio, and returns when all are
+    done. Files are decoded concurrently, so the order in which they finish
+    is undefined; results[i] always belongs to filenames[i].
+
+    A file that stops decoding before its end, because a packet overflowed a
+    ring of its arena (see plm_has_error()), or that decodes to no frames or
+    samples at all, is counted as failed. Its result still holds what was
+    decoded up to that point.
+
+    \param  batch       The batch decoder.
+    \param  filenames   The files to decode.
+    \param  count       The number of files.
+    \param  results     Receives one result per file.
+
+    \return             The number of files that decoded to their end.
+*/
+int mpeg_batch_decode(mpeg_batch_t *batch, const char *const *filenames, int count,
+                      mpeg_batch_result_t *results);
+
 #ifdef __cplusplus
 }
 #endif
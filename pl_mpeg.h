@@ -125,15 +125,33 @@ packets from it, you can use the plm_demux_* functions.
 
 
 This library uses malloc(), realloc() and free() to manage memory. Typically
-all allocation happens up-front when creating the interface. However, the
-default buffer size may be too small for certain inputs. In these cases plmpeg
-will realloc() the buffer with a larger size whenever needed. You can configure
-the default buffer size by defining PLM_BUFFER_DEFAULT_SIZE *before*
-including this library.
+all allocation happens up-front when creating the interface. For files and
+fixed memory, the ring buffers are sized from the limits the stream headers
+declare, and from the first packets where they declare none (see
+PLM_BUFFER_PRESCAN_PACKETS). For other sources the default buffer
+size may be too small for certain inputs. In these cases plmpeg will realloc()
+the buffer with a larger size whenever needed. You can configure the default
+buffer size by defining PLM_BUFFER_DEFAULT_SIZE *before* including this
+library.
 
 You can also define PLM_MALLOC, PLM_REALLOC and PLM_FREE to provide your own
 memory management functions.
 
+Alternatively, plm_create_with_arena() and friends carve every structure from
+one block of memory you supply, so no allocation happens after creation. Use
+plm_get_arena_size() to find out how large that block needs to be. The ring
+buffers of such an instance keep the size the stream analysis gave them and
+never grow during playback. A stream that overflows one stops decoding with an
+error, see plm_has_error().
+
+
+Motion compensation can prefetch the reference area of the macroblock
+PLM_PREFETCH_DISTANCE macroblocks ahead of the one being decoded, spread over
+the current macroblock's block decoding. Define it *before* including this
+library to try it on a target. The default is 0, which turns the lookahead off
+and leaves only the row-by-row prefetches inside the copy loops; no target has
+shown a measured gain from it yet.
+
 
 See below for detailed the API documentation.
 
@@ -177,6 +195,8 @@ extern "C" {
 
 #define PLM_MIN(a,b) ((a) < (b) ? (a) : (b))
 
+#define PLM_MAX(a,b) ((a) > (b) ? (a) : (b))
+
 #ifndef likely
 #define likely(x)   __builtin_expect(!!(x), 1)
 #endif
@@ -235,7 +255,9 @@ typedef struct {
 
 // Decoded Video Frame
 // width and height denote the desired display size of the frame. This may be
-// different from the internal size of the 3 planes.
+// different from the internal size of the 3 planes. display holds every frame
+// in macroblock order. The y, cr and cb planes are only written for reference
+// pictures (I and P), unless plm_video_set_fill_planes() is turned on.
 
 typedef struct {
 	double time;
@@ -255,6 +277,15 @@ typedef void(*plm_video_decode_callback)
 	(plm_t *self, plm_frame_t *frame, void *user);
 
 
+// Callback function type for finished macroblock rows of a frame that is
+// still being decoded. mb_row counts rows of 16 luma lines; rows arrive in
+// order and once each. Only frame->display (macroblock order, 384 bytes per
+// macroblock) is valid for the reported rows.
+
+typedef void(*plm_video_row_callback)
+	(plm_video_t *self, plm_frame_t *frame, int mb_row, void *user);
+
+
 // Decoded Audio Samples
 // Samples are signed 16-bit PCM interleaved as L, R.
 // The `count` is always PLM_AUDIO_SAMPLES_PER_FRAME (per channel) and just
@@ -289,6 +320,120 @@ typedef void(*plm_buffer_seek_callback)(plm_buffer_t *self, size_t offset, void
 
 typedef size_t(*plm_buffer_tell_callback)(plm_buffer_t *self, void *user);
 
+
+// Memory Requirements
+// Byte counts for the allocations of a plmpeg instance, not including
+// allocator overhead. small_ring_savings tells how much less memory would be
+// needed with rings sized to the packets seen; it is not included in total.
+
+typedef struct {
+	int width;                  // Frame size from the sequence header
+	int height;
+	size_t frame_buffers;       // 3 reference frames, each with its display copy
+	size_t demux_ring;          // File source ring; 0 for in-memory sources
+	size_t video_ring;
+	size_t audio_ring;
+	size_t ring_growth;         // Expected growth of the rings beyond their default size
+	size_t audio_tables;        // plm_audio_t: V buffers and samples. The synthesis
+	                            // window is shared by all instances.
+	size_t structs;             // plm_t, demuxer, buffer and video decoder structs
+	size_t total;
+
+	size_t small_ring_savings;  // Sizing the video and audio rings to the packets seen
+} plm_memory_requirements_t;
+
+
+// Buffer Levels
+// Bytes waiting to be read in each buffer of a plmpeg instance, next to the
+// capacity of that buffer. For an in-memory source the demux buffer holds the
+// whole stream.
+
+typedef struct {
+	size_t demux_fill;
+	size_t demux_capacity;
+	size_t video_fill;
+	size_t video_capacity;
+	size_t audio_fill;
+	size_t audio_capacity;
+} plm_buffer_levels_t;
+
+
+// Keyframe
+// An intra picture that decoding can start from. The time code fields come
+// from the GOP header in front of the picture, if there is one; has_gop is
+// FALSE otherwise.
+
+typedef struct {
+	double time;                // Presentation time in seconds, like frame->time
+	size_t position;            // Byte offset of the packet holding the picture
+	int has_gop;
+	int closed_gop;             // B-pictures after it only reference this GOP
+	int broken_link;            // Its first B-pictures can't be decoded
+	int drop_frame;
+	int hours;                  // GOP time code
+	int minutes;
+	int seconds;
+	int pictures;
+} plm_keyframe_t;
+
+
+// Stream Scan
+// What plm_scan_stream() found in an MPEG-PS stream. Bit rates are in bits
+// per second, byte counts include all packet and pack headers.
+
+typedef struct {
+	int samplerate;
+	int bitrate;                // From the first frame header
+	int channels;
+	int frames;                 // Estimated from the payload size
+	size_t bytes;
+	double duration;
+} plm_scan_audio_t;
+
+typedef struct {
+	size_t size;                // Bytes scanned
+	int packs;
+	int packets;
+	int mux_rate;               // Highest pack header mux rate, bytes per second
+	int peak_bitrate;           // Most bits within one second of SCR
+	double duration;            // Longest of the video and audio durations
+
+	int width;                  // From the first sequence header
+	int height;
+	double framerate;
+	int video_bitrate;
+	size_t vbv_buffer_size;
+	int frames;                 // Picture headers
+	int frames_by_type[5];      // Indexed by picture type, see plm_get_picture_type()
+	int gops;
+	int closed_gops;
+	int max_gop_length;         // Most pictures from one GOP header to the next
+	size_t video_bytes;
+	double video_duration;      // frames / framerate
+
+	int num_audio_streams;      // Audio streams with at least one packet
+	plm_scan_audio_t audio[4];  // Indexed by stream, see plm_set_audio_stream()
+} plm_scan_info_t;
+
+
+// One packet as seen by plm_scan_stream(), e.g. to plot a bit rate profile or
+// replay the packet arrival. scr and mux_rate are those of the pack header the
+// packet arrived in.
+
+typedef struct {
+	int type;                   // PLM_DEMUX_PACKET_* or another stream id
+	size_t position;            // Byte offset of the packet start code
+	size_t size;                // The whole packet, header included
+	size_t length;              // Payload bytes
+	double pts;                 // PLM_PACKET_INVALID_TS if the packet has none
+	double scr;
+	int mux_rate;
+	int pictures;               // Picture headers starting in the payload
+	int picture_type;           // Type of the first of them, 0 if none
+} plm_scan_packet_t;
+
+typedef void(*plm_scan_packet_callback)(plm_scan_packet_t *packet, void *user);
+
 // -----------------------------------------------------------------------------
 // plm_* public API
 // High-Level API for loading/demuxing/decoding MPEG-PS data
@@ -321,6 +466,111 @@ plm_t *plm_create_with_memory(uint8_t *bytes, size_t length, int free_when_done)
 plm_t *plm_create_with_buffer(plm_buffer_t *buffer, int destroy_when_done);
 
 
+// Create a plmpeg instance from separate elementary streams, e.g. an .m1v and
+// an .mp2 file, instead of an MPEG-PS file. The decoders read straight from
+// their own buffer, so there is no demuxer and no copying of packets, and each
+// buffer can be a file, memory or your own source. Either buffer may be NULL
+// for a stream without video or audio, but not both. Elementary streams carry
+// no timestamps: plm_get_duration() only knows what plm_set_duration() was
+// told and seeking decodes forward from the start. Pass TRUE to
+// destroy_when_done to let plmpeg call plm_buffer_destroy() on both buffers
+// when plm_destroy() is called.
+
+plm_t *plm_create_with_elementary_streams(plm_buffer_t *video_buffer, plm_buffer_t *audio_buffer, int destroy_when_done);
+
+
+// Create a plmpeg instance with a filename, reading as little of the file as
+// possible before the first frame can be decoded: the file size is not looked
+// up, the ring buffers are sized from the sequence header alone instead of
+// prescanning packets, and plm_get_duration() returns the estimate from
+// plm_get_duration_estimate() rather than scanning the end of the file.
+// Returns NULL if the file could not be opened.
+
+plm_t *plm_create_with_filename_fast_start(const char *filename);
+
+
+// Create a plmpeg instance that carves all of its structures from one
+// caller-supplied block of memory (the "arena") instead of making separate
+// PLM_MALLOC/PLM_MEMALIGN calls: plm_t, the demuxer, the video and audio ring
+// buffers, both decoders and the frame buffers. The memory must stay valid
+// until plm_destroy() is called; plm_destroy() never frees it. The ring
+// buffers are sized from the limits the stream declares at creation and never
+// grow: the arena can't free a replaced block, so a packet that doesn't fit a
+// full ring stops decoding with plm_has_error() instead. Use
+// plm_get_arena_size() to find out how large the block needs to be.
+// Returns NULL if the block is too small. Pass TRUE to destroy_when_done to
+// let plmpeg call plm_buffer_destroy() on the buffer when plm_destroy() is
+// called.
+
+plm_t *plm_create_with_arena(plm_buffer_t *buffer, int destroy_when_done, void *memory, size_t size);
+
+
+// Same as plm_create_with_arena(), but also carves the file source buffer
+// (the demux ring) from the arena. Returns NULL if the file could not be
+// opened or the block is too small.
+
+plm_t *plm_create_with_filename_arena(const char *filename, void *memory, size_t size);
+
+
+// Same as plm_create_with_arena(), but also carves the buffer struct for the
+// given in-memory data from the arena. Pass TRUE to free_when_done to let
+// plmpeg call PLM_FREE() on the bytes when plm_destroy() is called.
+
+plm_t *plm_create_with_memory_arena(uint8_t *bytes, size_t length, int free_when_done, void *memory, size_t size);
+
+
+// Get the number of bytes an arena needs to hold everything for the given
+// source. Only the video sequence header is read to find the frame size. The
+// buffer must be seekable (file or fixed memory); its read position is
+// restored afterwards. The estimate includes room for a file source ring, so
+// it is slightly larger than needed for in-memory sources. Returns 0 if no
+// sequence header could be found.
+
+size_t plm_get_arena_size(plm_buffer_t *buffer);
+
+
+// Get the number of bytes of its arena an instance has used so far, or 0 if
+// it was not created with one.
+
+size_t plm_get_arena_used(plm_t *self);
+
+
+// Get the memory a plmpeg instance would need for the given source without
+// creating it. Only headers are parsed: the video sequence header for the frame
+// size, plus the first packet headers to estimate ring growth and whether the
+// stream uses B-pictures. The buffer must be seekable; its read position is
+// restored afterwards. Returns FALSE if no sequence header could be found.
+
+int plm_query_memory_requirements(plm_buffer_t *buffer, plm_memory_requirements_t *req);
+
+
+// Walk an MPEG-PS stream in one pass for its duration, frame count, GOP
+// structure, bit rate profile and audio streams. Packets are skipped by their
+// length fields; of the payload only the video headers up to the picture
+// header and the first audio frame header of each stream are looked at, so
+// this runs at the speed the data can be read. The callback, if not NULL, is
+// called for every packet.
+// A seekable buffer (file, fixed memory or _for_appending) is scanned from
+// the start and its read position restored afterwards; any other buffer is
+// read from where it is until it runs out.
+// Returns FALSE if no video or audio packets were found.
+
+int plm_scan_stream(plm_buffer_t *buffer, plm_scan_info_t *info, plm_scan_packet_callback callback, void *user);
+
+
+// Get the memory currently held by a plmpeg instance, using the actual ring
+// capacities and frame buffers. Growth reports how far the rings have grown
+// beyond their default size.
+
+void plm_get_memory_footprint(plm_t *self, plm_memory_requirements_t *req);
+
+
+// Get how full the demux, video and audio buffers are right now. Buffers that
+// don't exist (yet) are reported as 0.
+
+void plm_get_buffer_levels(plm_t *self, plm_buffer_levels_t *levels);
+
+
 // Destroy a plmpeg instance and free all data.
 
 void plm_destroy(plm_t *self);
@@ -371,6 +621,12 @@ double plm_get_pixel_aspect_ratio(plm_t *self);
 double plm_get_framerate(plm_t *self);
 
 
+// Get the coding type of the picture decoded last, see
+// plm_video_get_picture_type().
+
+int plm_get_picture_type(plm_t *self);
+
+
 // Get or set whether audio decoding is enabled. Default TRUE.
 
 int plm_get_audio_enabled(plm_t *self);
@@ -406,11 +662,29 @@ void plm_set_audio_lead_time(plm_t *self, double lead_time);
 double plm_get_time(plm_t *self);
 
 
-// Get the video duration of the underlying source in seconds.
+// Get the video duration of the underlying source in seconds. This scans
+// the last packets of the source the first time it is called, unless the
+// instance was created for fast start or a duration was set with
+// plm_set_duration(); see below.
 
 double plm_get_duration(plm_t *self);
 
 
+// Get an estimate of the duration in seconds from the file size and the mux
+// rate of the first pack header, without scanning the source. Exact for
+// constant bitrate streams such as VCDs. Returns the exact duration instead
+// if it is already known, or PLM_PACKET_INVALID_TS if there is no mux rate.
+
+double plm_get_duration_estimate(plm_t *self);
+
+
+// Set the duration in seconds, e.g. from an index or metadata the application
+// keeps next to the file. plm_get_duration() and seeking will use it instead
+// of scanning the source.
+
+void plm_set_duration(plm_t *self, double duration);
+
+
 // Rewind all buffers back to the beginning.
 
 void plm_rewind(plm_t *self);
@@ -423,11 +697,19 @@ void plm_set_loop(plm_t *self, int loop);
 
 
 // Get whether the file has ended. If looping is enabled, this will always
-// return FALSE.
+// return FALSE, unless decoding stopped on an error.
 
 int plm_has_ended(plm_t *self);
 
 
+// Get whether decoding stopped on an error: a demuxed packet didn't fit a
+// ring buffer that can't grow, as in an arena, or growing one failed. What
+// was buffered before is still decoded, then plm_has_ended() returns TRUE.
+// The error is cleared by plm_rewind().
+
+int plm_has_error(plm_t *self);
+
+
 // Set the callback for decoded video frames used with plm_decode(). If no
 // callback is set, video data will be ignored and not be decoded. The *user
 // Parameter will be passed to your callback.
@@ -435,6 +717,28 @@ int plm_has_ended(plm_t *self);
 void plm_set_video_decode_callback(plm_t *self, plm_video_decode_callback fp, void *user);
 
 
+// Set the callback for finished macroblock rows, see plm_video_set_row_callback().
+
+void plm_set_video_row_callback(plm_t *self, plm_video_row_callback fp, void *user);
+
+
+// Set whether to drop B-pictures without decoding them, see
+// plm_video_set_skip_b_pictures().
+
+void plm_set_video_skip_b_pictures(plm_t *self, int skip);
+
+
+// Set whether to decode only D-pictures, see plm_video_set_d_pictures_only().
+
+void plm_set_video_d_pictures_only(plm_t *self, int only);
+
+
+// Set whether to write every picture to the Y/Cb/Cr planes, see
+// plm_video_set_fill_planes().
+
+void plm_set_video_fill_planes(plm_t *self, int fill);
+
+
 // Set the callback for decoded audio samples used with plm_decode(). If no
 // callback is set, audio data will be ignored and not be decoded. The *user
 // Parameter will be passed to your callback.
@@ -442,6 +746,17 @@ void plm_set_video_decode_callback(plm_t *self, plm_video_decode_callback fp, vo
 void plm_set_audio_decode_callback(plm_t *self, plm_audio_decode_callback fp, void *user);
 
 
+// Get or set whether plm_decode() decodes audio on a worker thread while the
+// calling thread decodes video. Callbacks are still made on the calling
+// thread, in timestamp order, so they don't need to be thread-safe. The
+// worker only reads audio the demuxer has already delivered; the calling
+// thread does all demuxing. This needs pthreads and a second core, so on the
+// Dreamcast it does nothing. Default FALSE.
+
+int plm_get_threaded(plm_t *self);
+void plm_set_threaded(plm_t *self, int threaded);
+
+
 // Advance the internal timer by seconds and decode video/audio up to this time.
 // This will call the video_decode_callback and audio_decode_callback any number
 // of times. A frame-skip is not implemented, i.e. everything up to current time
@@ -491,6 +806,30 @@ int plm_seek(plm_t *self, double time, int seek_exact);
 plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact);
 
 
+// Get the index of all keyframes (intra pictures) in the video stream, e.g.
+// for chapter markers or a scrub bar. The index is built on the first call
+// with a scan over the packet and picture headers, without decoding any
+// picture data, and then kept with the plm_t. Once it exists, plm_seek() and
+// plm_seek_frame() jump straight to the keyframe instead of searching for it.
+// Only keyframes at the start of a packet with a timestamp are listed, as
+// those are the ones seeking can start decoding from.
+// Like seeking, this needs a seekable plm_buffer with an MPEG-PS stream. If
+// the buffer was created _for_appending, the index is rebuilt when the data
+// has grown. Instances created with an arena take the index from the space
+// left in the arena.
+// Returns NULL and sets count to 0 if no index could be built. The returned
+// array is valid until the next call or until plm_destroy() is called.
+
+plm_keyframe_t *plm_get_keyframes(plm_t *self, int *count);
+
+
+// Get the index of the last keyframe at or before the given time in seconds
+// in the array returned by plm_get_keyframes(). Builds the index if needed.
+// Returns -1 if there is no such keyframe.
+
+int plm_find_keyframe(plm_t *self, double time);
+
+
 
 // -----------------------------------------------------------------------------
 // plm_buffer public API
@@ -509,6 +848,16 @@ plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact);
 #define PLM_VID_BUFFER_DEFAULT_SIZE (128 * 1024)
 #endif
 
+// The defaults above are only a fallback. When the source is a file or fixed
+// memory, the high-level API sizes the video ring from the sequence header's
+// vbv_buffer_size and the video and audio rings from the P-STD buffer bounds
+// of the system header, and a file source ring fits two of the largest
+// packets. Where the system header declares no bounds, the audio ring is sized
+// from the largest of this many packets. Set to 0 to skip the prescan.
+#ifndef PLM_BUFFER_PRESCAN_PACKETS
+#define PLM_BUFFER_PRESCAN_PACKETS 32
+#endif
+
 // Bytes we keep available for fast “peek” reads.
 // We maintain a small mirrored/guard region so hot-path bit reads can grab
 // up to PLM_PEEK_SIZE bytes linearly without doing ring wrap math.
@@ -557,7 +906,8 @@ void plm_buffer_destroy(plm_buffer_t *self);
 // available space, the buffer will realloc() with a larger capacity.
 // Returns the number of bytes written. This will always be the same as the
 // passed in length, except when the buffer was created _with_memory() for
-// which _write() is forbidden.
+// which _write() is forbidden, or when it was carved from an arena and is
+// full: those never grow, and 0 is returned.
 
 size_t plm_buffer_write(plm_buffer_t *self, uint8_t *bytes, size_t length);
 
@@ -581,8 +931,9 @@ void plm_buffer_set_load_callback(plm_buffer_t *self, plm_buffer_load_callback f
 void plm_buffer_rewind(plm_buffer_t *self);
 
 
-// Get the total size. For files, this returns the file size. For all other
-// types it returns the number of bytes currently in the buffer.
+// Get the total size. For files, this returns the file size, which is looked
+// up on the first call. For all other types it returns the number of bytes
+// currently in the buffer.
 
 size_t plm_buffer_get_size(plm_buffer_t *self);
 
@@ -649,6 +1000,22 @@ int plm_demux_get_num_video_streams(plm_demux_t *self);
 int plm_demux_get_num_audio_streams(plm_demux_t *self);
 
 
+// Returns the mux rate of the first pack header and the rate bound of the
+// system header, both in bytes per second, or 0 if the headers have not been
+// read yet.
+
+int plm_demux_get_mux_rate(plm_demux_t *self);
+int plm_demux_get_rate_bound(plm_demux_t *self);
+
+
+// Returns the P-STD buffer size bound the system header declares for the
+// stream of the given packet type, in bytes: how much of that stream a
+// decoder buffers at most. Returns 0 if the header declares none or has not
+// been read yet.
+
+size_t plm_demux_get_std_buffer_bound(plm_demux_t *self, int type);
+
+
 // Rewind the internal buffer. See plm_buffer_rewind().
 
 void plm_demux_rewind(plm_demux_t *self);
@@ -681,6 +1048,17 @@ double plm_demux_get_start_time(plm_demux_t *self, int type);
 double plm_demux_get_duration(plm_demux_t *self, int type);
 
 
+// Get the duration estimated from the source size and the mux rate, or the
+// exact duration if it is already known. See plm_get_duration_estimate().
+
+double plm_demux_get_duration_estimate(plm_demux_t *self);
+
+
+// Set the duration so plm_demux_get_duration() doesn't have to scan for it.
+
+void plm_demux_set_duration(plm_demux_t *self, double duration);
+
+
 // Decode and return the next packet. The returned packet_t is valid until
 // the next call to plm_demux_decode() or until the demuxer is destroyed.
 
@@ -721,6 +1099,14 @@ int plm_video_get_width(plm_video_t *self);
 int plm_video_get_height(plm_video_t *self);
 
 
+// Get the coding type of the picture decoded last: 1 for I, 2 for P, 3 for B,
+// 4 for D and 0 before the first picture. With B-pictures in the stream this is not
+// necessarily the type of the frame plm_video_decode() returned, since
+// reference pictures are returned one picture late.
+
+int plm_video_get_picture_type(plm_video_t *self);
+
+
 // Set "no delay" mode. When enabled, the decoder assumes that the video does
 // *not* contain any B-Frames. This is useful for reducing lag when streaming.
 // The default is FALSE.
@@ -728,6 +1114,51 @@ int plm_video_get_height(plm_video_t *self);
 void plm_video_set_no_delay(plm_video_t *self, int no_delay);
 
 
+// Set a callback that is called for each macroblock row as soon as it is
+// decoded, so the caller can start moving the frame out while the rest of it
+// is still being decoded. It is only called for the frame that the running
+// plm_video_decode() will return: B-pictures, and every picture in no-delay
+// mode. Reference pictures of a stream with B-pictures are returned one
+// picture late and don't call it. Set fp to NULL to disable.
+
+void plm_video_set_row_callback(plm_video_t *self, plm_video_row_callback fp, void *user);
+
+
+// Set whether to drop B-pictures without decoding them. Nothing references a
+// B-picture, so skipping one only costs the search for the next picture and
+// the following frames are unaffected. The time still advances over dropped
+// pictures. Use this to shed decode load when falling behind. The default is
+// FALSE.
+
+void plm_video_set_skip_b_pictures(plm_video_t *self, int skip);
+
+
+// Set whether to decode only the D-pictures of a stream that has them.
+// D-pictures carry just the DC coefficient of each block and decode without
+// IDCT or motion compensation, at a fraction of the cost of the others, for
+// fast-forward and preview tracks. Until the first D-picture is seen every
+// picture is decoded as usual. When this is turned off again, P- and
+// B-pictures are skipped up to the next I-picture, whose references they
+// would need. The default is FALSE.
+
+void plm_video_set_d_pictures_only(plm_video_t *self, int only);
+
+
+// Set whether to write B- and D-pictures to the Y/Cb/Cr planes too. Only
+// reference pictures are predicted from, so by default only they are copied
+// from the display buffer to the planes, and the planes of a returned B- or
+// D-picture hold an older frame. Turn this on when reading frame->y, cr and
+// cb instead of frame->display; it costs one more copy of each such frame.
+// The default is FALSE.
+
+void plm_video_set_fill_planes(plm_video_t *self, int fill);
+
+
+// Get whether a D-picture was seen in the stream so far.
+
+int plm_video_has_d_pictures(plm_video_t *self);
+
+
 // Get the current internal time in seconds.
 
 double plm_video_get_time(plm_video_t *self);
@@ -844,10 +1275,36 @@ plm_samples_t *plm_audio_decode(plm_audio_t *self);
 // -----------------------------------------------------------------------------
 // IMPLEMENTATION
 
+#ifdef _arch_dreamcast
 #include <kos.h>
+#else
+#include <pthread.h>
+#endif
 #include <string.h>
 #include <stdlib.h>
 
+// The decoder is tuned for the Dreamcast but also builds on a host, where the
+// SH4 instructions and KOS calls below fall back to portable C. This is for
+// testing and profiling the player off target, not for speed.
+
+#ifdef _arch_dreamcast
+	#define PLM_PREFETCH(addr) __asm__("pref @%0" : : "r"(addr))
+	#define PLM_ONCE_TYPE kthread_once_t
+	#define PLM_ONCE_INIT KTHREAD_ONCE_INIT
+	#define PLM_ONCE(once, fn) kthread_once((once), (fn))
+#else
+	#define PLM_PREFETCH(addr) __builtin_prefetch(addr)
+	#define PLM_ONCE_TYPE pthread_once_t
+	#define PLM_ONCE_INIT PTHREAD_ONCE_INIT
+	#define PLM_ONCE(once, fn) pthread_once((once), (fn))
+#endif
+
+#ifndef PLM_PREFETCH_DISTANCE
+	#define PLM_PREFETCH_DISTANCE 0
+#endif
+
+#ifdef _arch_dreamcast
+
 // Pipelined inner loop for audio synthesis using SH4 secondary FP bank.
 // Computes one sample: sum of 4 FIPRs across d[0..15] and strided v1/v2.
 // Does NOT modify d, v1, or v2 (uses internal temp copies).
@@ -966,13 +1423,100 @@ float shz_pl_inner_loop(const float *d, const float *v1, const float *v2) {
 	return result;
 }
 
+#else
+
+// Same sum as the FIPR version: d[0..15] against v1/v2 interleaved with a
+// stride of 128 floats.
+static inline float shz_pl_inner_loop(const float *d, const float *v1, const float *v2) {
+	float result = 0.0f;
+	for (int i = 0; i < 8; i++) {
+		result += d[i * 2] * v1[i * 128] + d[i * 2 + 1] * v2[i * 128];
+	}
+	return result;
+}
+
+#endif
+
+// -----------------------------------------------------------------------------
+// plm_arena implementation
+
+// A bump allocator over one caller-supplied block. The arena header lives at
+// the start of the block itself, so nothing is allocated to set it up and
+// nothing needs to be freed: plm_destroy() simply stops using the block.
+
+#define PLM_ARENA_ALIGN 32
+
+typedef struct plm_arena_t {
+	uint8_t *base;
+	size_t size;
+	size_t used;
+} plm_arena_t;
+
+// Allocate from the arena if one is given, from the heap otherwise.
+#define PLM_ARENA_MALLOC(arena, sz) \
+	((arena) ? plm_arena_alloc((arena), PLM_ARENA_ALIGN, (sz)) : PLM_MALLOC(sz))
+#define PLM_ARENA_MEMALIGN(arena, a, sz) \
+	((arena) ? plm_arena_alloc((arena), (a), (sz)) : PLM_MEMALIGN((a), (sz)))
+#define PLM_ARENA_FREE(arena, p) \
+	do { if (!(arena)) { PLM_FREE(p); } } while (0)
+
+// Rounded size of an arena allocation, including worst case alignment slack.
+#define PLM_ARENA_SIZEOF(sz) (((sz) + PLM_ARENA_ALIGN - 1) & ~(size_t)(PLM_ARENA_ALIGN - 1))
+
+plm_arena_t *plm_arena_create(void *memory, size_t size) {
+	if (!memory || size < sizeof(plm_arena_t)) {
+		return NULL;
+	}
+	plm_arena_t *self = (plm_arena_t *)memory;
+	self->base = (uint8_t *)memory;
+	self->size = size;
+	self->used = sizeof(plm_arena_t);
+	return self;
+}
+
+void *plm_arena_alloc(plm_arena_t *self, size_t align, size_t size) {
+	uintptr_t addr = (uintptr_t)(self->base + self->used);
+	uintptr_t aligned = (addr + align - 1) & ~(uintptr_t)(align - 1);
+	size_t offset = self->used + (aligned - addr);
+	if (offset > self->size || size > self->size - offset) {
+		fprintf(stderr, "Arena exhausted: need %zu more bytes, %zu left. [plm_arena_alloc]\n",
+			size, self->size - self->used);
+		return NULL;
+	}
+	self->used = offset + size;
+	return (void *)aligned;
+}
+
 // -----------------------------------------------------------------------------
 // plm (high-level interface) implementation
 
+typedef struct plm_audio_worker_t plm_audio_worker_t;
+
+// Ring sizes picked for a stream by plm_analyze_stream()
+typedef struct {
+	int width;
+	int height;
+	size_t vbv_buffer_size;
+	size_t max_audio_packet;
+	size_t video_bytes;        // Payload of the scanned packets
+	size_t audio_bytes;
+	size_t video_std_bound;    // P-STD bounds from the system header, or 0
+	size_t audio_std_bound;
+
+	size_t source_capacity;   // 0 if the source is not a file
+	size_t video_capacity;
+	size_t audio_capacity;
+} plm_stream_analysis_t;
+
 struct plm_t {
+	plm_arena_t *arena;
+	plm_stream_analysis_t ring_sizes;
+	int fast_start;
 	plm_demux_t *demux;
+	double duration;
 	double time;
 	int has_ended;
+	int has_error;
 	int loop;
 	int has_decoders;
 
@@ -988,18 +1532,52 @@ struct plm_t {
 	plm_buffer_t *audio_buffer;
 	plm_audio_t *audio_decoder;
 
+	// Audio worker for plm_decode(); while it runs, demuxed audio is held in
+	// audio_pending instead of audio_buffer
+	plm_audio_worker_t *audio_worker;
+	plm_buffer_t *audio_pending;
+
 	plm_video_decode_callback video_decode_callback;
 	void *video_decode_callback_user_data;
 
+	plm_video_row_callback video_row_callback;
+	void *video_row_callback_user_data;
+	int video_skip_b_pictures;
+	int video_d_pictures_only;
+	int video_fill_planes;
+
 	plm_audio_decode_callback audio_decode_callback;
 	void *audio_decode_callback_user_data;
+
+	// Built by plm_get_keyframes() for a source of keyframes_source_size bytes
+	plm_keyframe_t *keyframes;
+	int keyframe_count;
+	int keyframe_capacity;
+	size_t keyframes_source_size;
 };
 
 int plm_init_decoders(plm_t *self);
+plm_packet_t *plm_seek_keyframe_packet(plm_t *self, double time);
 void plm_handle_end(plm_t *self);
+plm_t *plm_create_with_buffer_ex(plm_buffer_t *buffer, int destroy_when_done, plm_arena_t *arena, int fast_start);
+plm_buffer_t *plm_buffer_create_with_file_ex(PLM_FILE_TYPE fh, int close_when_done, plm_arena_t *arena);
+plm_buffer_t *plm_buffer_create_with_capacity_ex(size_t capacity, plm_arena_t *arena);
+plm_buffer_t *plm_buffer_create_with_memory_ex(uint8_t *bytes, size_t length, int free_when_done, plm_arena_t *arena);
+plm_demux_t *plm_demux_create_ex(plm_buffer_t *buffer, int destroy_when_done, plm_arena_t *arena);
+plm_video_t *plm_video_create_ex(plm_buffer_t *buffer, int destroy_when_done, plm_arena_t *arena);
+plm_audio_t *plm_audio_create_ex(plm_buffer_t *buffer, int destroy_when_done, plm_arena_t *arena);
+int plm_video_peek_sequence_header(plm_buffer_t *buffer, int *width, int *height, size_t *vbv_buffer_size);
+int plm_analyze_stream(plm_buffer_t *buffer, int prescan_packets, plm_stream_analysis_t *analysis);
+int plm_size_rings(plm_demux_t *demux, int prescan_packets, plm_stream_analysis_t *analysis);
+int plm_size_elementary_streams(plm_buffer_t *video_buffer, plm_buffer_t *audio_buffer, plm_stream_analysis_t *analysis);
+int plm_sources_have_ended(plm_t *self);
+int plm_write_packet(plm_t *self, plm_buffer_t *buffer, plm_packet_t *packet);
 void plm_read_video_packet(plm_buffer_t *buffer, void *user);
 void plm_read_audio_packet(plm_buffer_t *buffer, void *user);
 void plm_read_packets(plm_t *self, int requested_type);
+plm_audio_worker_t *plm_audio_worker_create(plm_t *plm);
+void plm_audio_worker_destroy(plm_audio_worker_t *self);
+void plm_audio_worker_decode(plm_t *self, double video_target_time, double audio_target_time);
 
 plm_t *plm_create_with_filename(const char *filename) {
 	plm_buffer_t *buffer = plm_buffer_create_with_filename(filename);
@@ -1026,11 +1604,123 @@ plm_t *plm_create_with_memory(uint8_t *bytes, size_t length, int free_when_done)
 }
 
 plm_t *plm_create_with_buffer(plm_buffer_t *buffer, int destroy_when_done) {
-	if (!buffer) {
+	return plm_create_with_buffer_ex(buffer, destroy_when_done, NULL, FALSE);
+}
+
+plm_t *plm_create_with_elementary_streams(plm_buffer_t *video_buffer, plm_buffer_t *audio_buffer, int destroy_when_done) {
+	if (!video_buffer && !audio_buffer) {
 		return NULL;
 	}
 
 	plm_t *self = (plm_t *)PLM_MALLOC(sizeof(plm_t));
+	if (!self) {
+		fprintf(stderr, "Out of memory for self. [plm_create_with_elementary_streams]\n");
+		goto fail;
+	}
+	PLM_MEMZERO(self, sizeof(plm_t));
+	self->duration = PLM_PACKET_INVALID_TS;
+	self->video_enabled = TRUE;
+	self->audio_enabled = TRUE;
+
+	if (!plm_size_elementary_streams(video_buffer, audio_buffer, &self->ring_sizes)) {
+		goto fail;
+	}
+
+	// Without a demuxer the decoders own their buffers from the start
+	if (video_buffer) {
+		self->video_decoder = plm_video_create_with_buffer(video_buffer, destroy_when_done);
+		if (!self->video_decoder) {
+			goto fail;
+		}
+		self->video_buffer = video_buffer;
+		self->video_packet_type = PLM_DEMUX_PACKET_VIDEO_1;
+		video_buffer = NULL;
+	}
+	if (audio_buffer) {
+		self->audio_decoder = plm_audio_create_with_buffer(audio_buffer, destroy_when_done);
+		if (!self->audio_decoder) {
+			goto fail;
+		}
+		self->audio_buffer = audio_buffer;
+		self->audio_packet_type = PLM_DEMUX_PACKET_AUDIO_1;
+		audio_buffer = NULL;
+	}
+	self->has_decoders = TRUE;
+
+	return self;
+
+fail:
+	if (destroy_when_done) {
+		plm_buffer_destroy(video_buffer);
+		plm_buffer_destroy(audio_buffer);
+	}
+	plm_destroy(self);
+	return NULL;
+}
+
+plm_t *plm_create_with_filename_fast_start(const char *filename) {
+	plm_buffer_t *buffer = plm_buffer_create_with_filename(filename);
+	if (!buffer) {
+		return NULL;
+	}
+	return plm_create_with_buffer_ex(buffer, TRUE, NULL, TRUE);
+}
+
+plm_t *plm_create_with_arena(plm_buffer_t *buffer, int destroy_when_done, void *memory, size_t size) {
+	if (!buffer) {
+		return NULL;
+	}
+
+	plm_arena_t *arena = plm_arena_create(memory, size);
+	if (!arena) {
+		fprintf(stderr, "Arena too small. [plm_create_with_arena]\n");
+		if (destroy_when_done) {
+			plm_buffer_destroy(buffer);
+		}
+		return NULL;
+	}
+	return plm_create_with_buffer_ex(buffer, destroy_when_done, arena, FALSE);
+}
+
+plm_t *plm_create_with_filename_arena(const char *filename, void *memory, size_t size) {
+	plm_arena_t *arena = plm_arena_create(memory, size);
+	if (!arena) {
+		fprintf(stderr, "Arena too small. [plm_create_with_filename_arena]\n");
+		return NULL;
+	}
+
+	PLM_FILE_TYPE fh = PLM_FILE_OPEN(filename);
+	if (fh == PLM_FILE_INVALID_HANDLE) {
+		fprintf(stderr, "Can not open file: %s\n", filename);
+		return NULL;
+	}
+	plm_buffer_t *buffer = plm_buffer_create_with_file_ex(fh, TRUE, arena);
+	if (!buffer) {
+		return NULL;
+	}
+	return plm_create_with_buffer_ex(buffer, TRUE, arena, FALSE);
+}
+
+plm_t *plm_create_with_memory_arena(uint8_t *bytes, size_t length, int free_when_done, void *memory, size_t size) {
+	plm_arena_t *arena = plm_arena_create(memory, size);
+	if (!arena) {
+		fprintf(stderr, "Arena too small. [plm_create_with_memory_arena]\n");
+		return NULL;
+	}
+
+	plm_buffer_t *buffer = plm_buffer_create_with_memory_ex(bytes, length, free_when_done, arena);
+	if (!buffer) {
+		return NULL;
+	}
+	return plm_create_with_buffer_ex(buffer, TRUE, arena, FALSE);
+}
+
+plm_t *plm_create_with_buffer_ex(plm_buffer_t *buffer, int destroy_when_done, plm_arena_t *arena, int fast_start) {
+	if (!buffer) {
+		return NULL;
+	}
+
+	plm_t *self = (plm_t *)PLM_ARENA_MALLOC(arena, sizeof(plm_t));
 	if(!self) {
 		fprintf(stderr, "Out of memory for self. [plm_create_with_buffer]\n");
 		if (destroy_when_done) {
@@ -1039,18 +1729,27 @@ plm_t *plm_create_with_buffer(plm_buffer_t *buffer, int destroy_when_done) {
 		return NULL;
 	}
 	PLM_MEMZERO(self, sizeof(plm_t));
+	self->arena = arena;
+	self->fast_start = fast_start;
+	self->duration = PLM_PACKET_INVALID_TS;
 
-	self->demux = plm_demux_create(buffer, destroy_when_done);
+	self->demux = plm_demux_create_ex(buffer, destroy_when_done, arena);
 	if (!self->demux) {
 		if (destroy_when_done) {
 			plm_buffer_destroy(buffer);
 		}
-		PLM_FREE(self);
+		PLM_ARENA_FREE(arena, self);
 		return NULL;
 	}
 	self->video_enabled = TRUE;
 	self->audio_enabled = TRUE;
-	plm_init_decoders(self);
+
+	// In arena mode a failure to create the decoders means the arena was too
+	// small; report that now rather than failing silently during playback.
+	if (!plm_init_decoders(self) && arena && plm_demux_has_headers(self->demux)) {
+		plm_destroy(self);
+		return NULL;
+	}
 
 	return self;
 }
@@ -1060,45 +1759,61 @@ int plm_init_decoders(plm_t *self) {
 		return TRUE;
 	}
 
-	if (!plm_demux_has_headers(self->demux)) {
+	if (!self->demux || !plm_demux_has_headers(self->demux)) {
 		return FALSE;
 	}
 
-	if (plm_demux_get_num_video_streams(self->demux) > 0) {
-		if (self->video_enabled) {
-			self->video_packet_type = PLM_DEMUX_PACKET_VIDEO_1;
-		}
-		if (!self->video_decoder) {
-			self->video_buffer = plm_buffer_create_with_capacity(PLM_VID_BUFFER_DEFAULT_SIZE);
-			if (!self->video_buffer) {
-				return FALSE;
-			}
-			plm_buffer_set_load_callback(self->video_buffer, plm_read_video_packet, self);
-			self->video_decoder = plm_video_create_with_buffer(self->video_buffer, TRUE);
-			if (!self->video_decoder) {
-				plm_buffer_destroy(self->video_buffer);
-				self->video_buffer = NULL;
-				return FALSE;
-			}
+	// Size all rings once, up front, so they don't have to grow during
+	// playback. Streams that can't be analyzed keep the default sizes.
+	if (!self->video_buffer && !self->audio_buffer) {
+		int prescan_packets = self->fast_start ? 0 : PLM_BUFFER_PRESCAN_PACKETS;
+		if (!plm_size_rings(self->demux, prescan_packets, &self->ring_sizes)) {
+			return FALSE;
 		}
 	}
 
-	if (plm_demux_get_num_audio_streams(self->demux) > 0) {
-		if (self->audio_enabled) {
-			self->audio_packet_type = PLM_DEMUX_PACKET_AUDIO_1 + self->audio_stream_index;
+	// Set up both packet types and rings before creating either decoder.
+	// Creating a decoder reads its first header, which may demux packets of
+	// the other stream; they must not be dropped.
+	int has_video = plm_demux_get_num_video_streams(self->demux) > 0;
+	int has_audio = plm_demux_get_num_audio_streams(self->demux) > 0;
+
+	if (has_video && self->video_enabled) {
+		self->video_packet_type = PLM_DEMUX_PACKET_VIDEO_1;
+	}
+	if (has_audio && self->audio_enabled) {
+		self->audio_packet_type = PLM_DEMUX_PACKET_AUDIO_1 + self->audio_stream_index;
+	}
+
+	if (has_video && !self->video_buffer) {
+		self->video_buffer = plm_buffer_create_with_capacity_ex(self->ring_sizes.video_capacity, self->arena);
+		if (!self->video_buffer) {
+			return FALSE;
 		}
-		if (!self->audio_decoder) {
-			self->audio_buffer = plm_buffer_create_with_capacity(PLM_BUFFER_DEFAULT_SIZE);
-			if (!self->audio_buffer) {
-				return FALSE;
-			}
-			plm_buffer_set_load_callback(self->audio_buffer, plm_read_audio_packet, self);
-			self->audio_decoder = plm_audio_create_with_buffer(self->audio_buffer, TRUE);
-			if (!self->audio_decoder) {
-				plm_buffer_destroy(self->audio_buffer);
-				self->audio_buffer = NULL;
-				return FALSE;
-			}
+		plm_buffer_set_load_callback(self->video_buffer, plm_read_video_packet, self);
+	}
+	if (has_audio && !self->audio_buffer) {
+		self->audio_buffer = plm_buffer_create_with_capacity_ex(self->ring_sizes.audio_capacity, self->arena);
+		if (!self->audio_buffer) {
+			return FALSE;
+		}
+		plm_buffer_set_load_callback(self->audio_buffer, plm_read_audio_packet, self);
+	}
+
+	if (has_video && !self->video_decoder) {
+		self->video_decoder = plm_video_create_ex(self->video_buffer, TRUE, self->arena);
+		if (!self->video_decoder) {
+			return FALSE;
+		}
+		plm_video_set_row_callback(self->video_decoder, self->video_row_callback, self->video_row_callback_user_data);
+		plm_video_set_skip_b_pictures(self->video_decoder, self->video_skip_b_pictures);
+		plm_video_set_d_pictures_only(self->video_decoder, self->video_d_pictures_only);
+		plm_video_set_fill_planes(self->video_decoder, self->video_fill_planes);
+	}
+	if (has_audio && !self->audio_decoder) {
+		self->audio_decoder = plm_audio_create_ex(self->audio_buffer, TRUE, self->arena);
+		if (!self->audio_decoder) {
+			return FALSE;
 		}
 	}
 
@@ -1110,6 +1825,8 @@ void plm_destroy(plm_t *self) {
 	if(!self)
 		return;
 
+	plm_set_threaded(self, FALSE);
+
 	if (self->video_decoder) {
 		plm_video_destroy(self->video_decoder);
 		self->video_decoder = NULL;
@@ -1130,7 +1847,8 @@ void plm_destroy(plm_t *self) {
 	}
 
 	plm_demux_destroy(self->demux);
-	PLM_FREE(self);
+	PLM_ARENA_FREE(self->arena, self->keyframes);
+	PLM_ARENA_FREE(self->arena, self);
 }
 
 int plm_get_audio_enabled(plm_t *self) {
@@ -1138,7 +1856,7 @@ int plm_get_audio_enabled(plm_t *self) {
 }
 
 int plm_has_headers(plm_t *self) {
-	if (!plm_demux_has_headers(self->demux)) {
+	if (self->demux && !plm_demux_has_headers(self->demux)) {
 		return FALSE;
 	}
 
@@ -1157,6 +1875,10 @@ int plm_has_headers(plm_t *self) {
 }
 
 int plm_probe(plm_t *self, size_t probesize) {
+	if (!self->demux) {
+		return TRUE;
+	}
+
 	int found_streams = plm_demux_probe(self->demux, probesize);
 	if (!found_streams) {
 		return FALSE;
@@ -1210,6 +1932,9 @@ void plm_set_video_enabled(plm_t *self, int enabled) {
 }
 
 int plm_get_num_video_streams(plm_t *self) {
+	if (!self->demux) {
+		return self->video_decoder ? 1 : 0;
+	}
 	return plm_demux_get_num_video_streams(self->demux);
 }
 
@@ -1231,6 +1956,12 @@ double plm_get_framerate(plm_t *self) {
 		: 0;
 }
 
+int plm_get_picture_type(plm_t *self) {
+	return self->video_decoder
+		? plm_video_get_picture_type(self->video_decoder)
+		: 0;
+}
+
 double plm_get_pixel_aspect_ratio(plm_t *self) {
 	return (plm_init_decoders(self) && self->video_decoder)
 		? plm_video_get_pixel_aspect_ratio(self->video_decoder)
@@ -1238,6 +1969,9 @@ double plm_get_pixel_aspect_ratio(plm_t *self) {
 }
 
 int plm_get_num_audio_streams(plm_t *self) {
+	if (!self->demux) {
+		return self->audio_decoder ? 1 : 0;
+	}
 	return plm_demux_get_num_audio_streams(self->demux);
 }
 
@@ -1260,9 +1994,33 @@ double plm_get_time(plm_t *self) {
 }
 
 double plm_get_duration(plm_t *self) {
+	if (!self->demux) {
+		return self->duration;
+	}
+	if (self->fast_start) {
+		double estimate = plm_get_duration_estimate(self);
+		if (estimate != PLM_PACKET_INVALID_TS) {
+			plm_demux_set_duration(self->demux, estimate);
+			return estimate;
+		}
+	}
 	return plm_demux_get_duration(self->demux, PLM_DEMUX_PACKET_VIDEO_1);
 }
 
+double plm_get_duration_estimate(plm_t *self) {
+	if (!self->demux) {
+		return self->duration;
+	}
+	return plm_demux_get_duration_estimate(self->demux);
+}
+
+void plm_set_duration(plm_t *self, double duration) {
+	self->duration = duration;
+	if (self->demux) {
+		plm_demux_set_duration(self->demux, duration);
+	}
+}
+
 void plm_rewind(plm_t *self) {
 	if (self->video_decoder) {
 		plm_video_rewind(self->video_decoder);
@@ -1272,9 +2030,12 @@ void plm_rewind(plm_t *self) {
 		plm_audio_rewind(self->audio_decoder);
 	}
 
-	plm_demux_rewind(self->demux);
+	if (self->demux) {
+		plm_demux_rewind(self->demux);
+	}
 	self->time = 0;
 	self->has_ended = FALSE;
+	self->has_error = FALSE;
 }
 
 int plm_get_loop(plm_t *self) {
@@ -1289,16 +2050,67 @@ int plm_has_ended(plm_t *self) {
 	return self->has_ended;
 }
 
+int plm_has_error(plm_t *self) {
+	return self->has_error;
+}
+
 void plm_set_video_decode_callback(plm_t *self, plm_video_decode_callback fp, void *user) {
 	self->video_decode_callback = fp;
 	self->video_decode_callback_user_data = user;
 }
 
+void plm_set_video_row_callback(plm_t *self, plm_video_row_callback fp, void *user) {
+	self->video_row_callback = fp;
+	self->video_row_callback_user_data = user;
+
+	if (self->video_decoder) {
+		plm_video_set_row_callback(self->video_decoder, fp, user);
+	}
+}
+
+void plm_set_video_skip_b_pictures(plm_t *self, int skip) {
+	self->video_skip_b_pictures = skip;
+
+	if (self->video_decoder) {
+		plm_video_set_skip_b_pictures(self->video_decoder, skip);
+	}
+}
+
+void plm_set_video_d_pictures_only(plm_t *self, int only) {
+	self->video_d_pictures_only = only;
+
+	if (self->video_decoder) {
+		plm_video_set_d_pictures_only(self->video_decoder, only);
+	}
+}
+
+void plm_set_video_fill_planes(plm_t *self, int fill) {
+	self->video_fill_planes = fill;
+
+	if (self->video_decoder) {
+		plm_video_set_fill_planes(self->video_decoder, fill);
+	}
+}
+
 void plm_set_audio_decode_callback(plm_t *self, plm_audio_decode_callback fp, void *user) {
 	self->audio_decode_callback = fp;
 	self->audio_decode_callback_user_data = user;
 }
 
+int plm_get_threaded(plm_t *self) {
+	return self->audio_worker != NULL;
+}
+
+void plm_set_threaded(plm_t *self, int threaded) {
+	if (!threaded && self->audio_worker) {
+		plm_audio_worker_destroy(self->audio_worker);
+		self->audio_worker = NULL;
+	}
+	else if (threaded && !self->audio_worker) {
+		self->audio_worker = plm_audio_worker_create(self);
+	}
+}
+
 void plm_decode(plm_t *self, double tick) {
 	if (!plm_init_decoders(self)) {
 		return;
@@ -1319,6 +2131,12 @@ void plm_decode(plm_t *self, double tick) {
 	double video_target_time = self->time + tick;
 	double audio_target_time = self->time + tick + self->audio_lead_time;
 
+	// Decode both at once first. Whatever the worker couldn't get to, and
+	// the end of the source, is handled by the loop below.
+	if (self->audio_worker && decode_video && decode_audio) {
+		plm_audio_worker_decode(self, video_target_time, audio_target_time);
+	}
+
 	do {
 		did_decode = FALSE;
 
@@ -1349,7 +2167,7 @@ void plm_decode(plm_t *self, double tick) {
 	if (
 		(!decode_video || decode_video_failed) &&
 		(!decode_audio || decode_audio_failed) &&
-		plm_demux_has_ended(self->demux)
+		plm_sources_have_ended(self)
 	) {
 		plm_handle_end(self);
 		return;
@@ -1371,7 +2189,7 @@ plm_frame_t *plm_decode_video(plm_t *self) {
 	if (frame) {
 		self->time = frame->time;
 	}
-	else if (plm_demux_has_ended(self->demux)) {
+	else if (plm_sources_have_ended(self)) {
 		plm_handle_end(self);
 	}
 	return frame;
@@ -1390,14 +2208,14 @@ plm_samples_t *plm_decode_audio(plm_t *self) {
 	if (samples) {
 		self->time = samples->time;
 	}
-	else if (plm_demux_has_ended(self->demux)) {
+	else if (plm_sources_have_ended(self)) {
 		plm_handle_end(self);
 	}
 	return samples;
 }
 
 void plm_handle_end(plm_t *self) {
-	if (self->loop) {
+	if (self->loop && !self->has_error) {
 		plm_rewind(self);
 	}
 	else {
@@ -1405,6 +2223,18 @@ void plm_handle_end(plm_t *self) {
 	}
 }
 
+int plm_sources_have_ended(plm_t *self) {
+	if (self->has_error) {
+		return TRUE;
+	}
+	if (self->demux) {
+		return plm_demux_has_ended(self->demux);
+	}
+	return
+		(!self->video_buffer || plm_buffer_has_ended(self->video_buffer)) &&
+		(!self->audio_buffer || plm_buffer_has_ended(self->audio_buffer));
+}
+
 void plm_read_video_packet(plm_buffer_t *buffer, void *user) {
 	PLM_UNUSED(buffer);
 	plm_t *self = (plm_t *)user;
@@ -1417,18 +2247,29 @@ void plm_read_audio_packet(plm_buffer_t *buffer, void *user) {
 	plm_read_packets(self, self->audio_packet_type);
 }
 
+// Write a demuxed packet to a ring. A packet that doesn't fit is an error:
+// nothing more is demuxed and the decoders get to the end of what they have.
+int plm_write_packet(plm_t *self, plm_buffer_t *buffer, plm_packet_t *packet) {
+	size_t written = plm_buffer_write(buffer, packet->data0, packet->len0);
+	if (packet->data1) {
+		written += plm_buffer_write(buffer, packet->data1, packet->len1);
+	}
+	if (written != packet->length) {
+		self->has_error = TRUE;
+		return FALSE;
+	}
+	return TRUE;
+}
+
 void plm_read_packets(plm_t *self, int requested_type) {
 	plm_packet_t *packet;
-	while ((packet = plm_demux_decode(self->demux))) {
+	while (!self->has_error && (packet = plm_demux_decode(self->demux))) {
 		if (packet->type == self->video_packet_type) {
-			plm_buffer_write(self->video_buffer, packet->data0, packet->len0);
-			if(packet->data1)
-				plm_buffer_write(self->video_buffer, packet->data1, packet->len1);
+			plm_write_packet(self, self->video_buffer, packet);
 		}
 		else if (packet->type == self->audio_packet_type) {
-			plm_buffer_write(self->audio_buffer, packet->data0, packet->len0);
-			if(packet->data1)
-				plm_buffer_write(self->audio_buffer, packet->data1, packet->len1);
+			plm_buffer_t *audio = self->audio_pending ? self->audio_pending : self->audio_buffer;
+			plm_write_packet(self, audio, packet);
 		}
 
 		if (packet->type == requested_type) {
@@ -1436,11 +2277,11 @@ void plm_read_packets(plm_t *self, int requested_type) {
 		}
 	}
 
-	if (plm_demux_has_ended(self->demux)) {
+	if (self->has_error || plm_demux_has_ended(self->demux)) {
 		if (self->video_buffer) {
 			plm_buffer_signal_end(self->video_buffer);
 		}
-		if (self->audio_buffer) {
+		if (self->audio_buffer && !self->audio_pending) {
 			plm_buffer_signal_end(self->audio_buffer);
 		}
 	}
@@ -1455,6 +2296,21 @@ plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact) {
 		return NULL;
 	}
 
+	// Elementary streams have no timestamps to jump to; decode forward from
+	// the start instead
+	if (!self->demux) {
+		plm_video_rewind(self->video_decoder);
+		plm_frame_t *frame = plm_video_decode(self->video_decoder);
+		while (frame && frame->time < time) {
+			frame = plm_video_decode(self->video_decoder);
+		}
+		if (frame) {
+			self->time = frame->time;
+		}
+		self->has_ended = FALSE;
+		return frame;
+	}
+
 	int type = self->video_packet_type;
 
 	double start_time = plm_demux_get_start_time(self->demux, type);
@@ -1467,7 +2323,10 @@ plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact) {
 		time = duration;
 	}
 
-	plm_packet_t *packet = plm_demux_seek(self->demux, time, type, TRUE);
+	plm_packet_t *packet = plm_seek_keyframe_packet(self, time);
+	if (!packet) {
+		packet = plm_demux_seek(self->demux, time, type, TRUE);
+	}
 	if (!packet) {
 		return NULL;
 	}
@@ -1479,9 +2338,7 @@ plm_frame_t *plm_seek_frame(plm_t *self, double time, int seek_exact) {
 	// Clear video buffer and decode the found packet
 	plm_video_rewind(self->video_decoder);
 	plm_video_set_time(self->video_decoder, packet->pts - start_time);
-	plm_buffer_write(self->video_buffer, packet->data0, packet->len0);
-	if(packet->data1)
-		plm_buffer_write(self->video_buffer, packet->data1, packet->len1);
+	plm_write_packet(self, self->video_buffer, packet);
 	plm_frame_t *frame = plm_video_decode(self->video_decoder);
 
 	// If we want to seek to an exact frame, we have to decode all frames
@@ -1519,6 +2376,20 @@ int plm_seek(plm_t *self, double time, int seek_exact) {
 		return TRUE;
 	}
 
+	// Elementary audio is synced by dropping the frames before the current
+	// time, then decoding ahead as usual
+	if (!self->demux) {
+		plm_audio_t *audio = self->audio_decoder;
+		double frame_duration = (double)PLM_AUDIO_SAMPLES_PER_FRAME / plm_audio_get_samplerate(audio);
+		plm_audio_rewind(audio);
+		while (
+			plm_audio_get_time(audio) + frame_duration <= self->time &&
+			plm_audio_decode(audio)
+		);
+		plm_decode(self, 0);
+		return TRUE;
+	}
+
 	// Sync up Audio. This demuxes more packets until the first audio packet
 	// with a PTS greater than the current time is found. plm_decode() is then
 	// called to decode enough audio data to satisfy the audio_lead_time.
@@ -1529,18 +2400,16 @@ int plm_seek(plm_t *self, double time, int seek_exact) {
 	plm_packet_t *packet = NULL;
 	while ((packet = plm_demux_decode(self->demux))) {
 		if (packet->type == self->video_packet_type) {
-			plm_buffer_write(self->video_buffer, packet->data0, packet->len0);
-			if(packet->data1)
-				plm_buffer_write(self->video_buffer, packet->data1, packet->len1);
+			if (!plm_write_packet(self, self->video_buffer, packet)) {
+				break;
+			}
 		}
 		else if (
 			packet->type == self->audio_packet_type &&
 			packet->pts - start_time > self->time
 		) {
 			plm_audio_set_time(self->audio_decoder, packet->pts - start_time);
-			plm_buffer_write(self->audio_buffer, packet->data0, packet->len0);
-			if(packet->data1)
-				plm_buffer_write(self->audio_buffer, packet->data1, packet->len1);
+			plm_write_packet(self, self->audio_buffer, packet);
 			plm_decode(self, 0);
 			break;
 		}
@@ -1579,6 +2448,7 @@ struct plm_buffer_t {
 	void *load_callback_user_data;
 	uint8_t *bytes;
 	enum plm_buffer_mode mode;
+	plm_arena_t *arena;
 };
 
 typedef struct {
@@ -1600,15 +2470,15 @@ void plm_buffer_load_file_callback(plm_buffer_t *self, void *user);
 void plm_buffer_seek_file_callback(plm_buffer_t *self, size_t offset, void *user);
 size_t plm_buffer_tell_file_callback(plm_buffer_t *self, void *user);
 
-inline int plm_buffer_has(plm_buffer_t *self, size_t count);
-inline uint32_t plm_buffer_read(plm_buffer_t *self, int count);
-inline void plm_buffer_align(plm_buffer_t *self);
-inline void plm_buffer_skip(plm_buffer_t *self, size_t count);
-inline int plm_buffer_skip_bytes(plm_buffer_t *self, uint8_t v);
-inline int plm_buffer_next_start_code(plm_buffer_t *self);
-inline int plm_buffer_find_start_code(plm_buffer_t *self, int code);
-inline int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_t *table);
-inline uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_uint_t *table);
+static inline int plm_buffer_has(plm_buffer_t *self, size_t count);
+static inline uint32_t plm_buffer_read(plm_buffer_t *self, int count);
+static inline void plm_buffer_align(plm_buffer_t *self);
+static inline void plm_buffer_skip(plm_buffer_t *self, size_t count);
+static inline int plm_buffer_skip_bytes(plm_buffer_t *self, uint8_t v);
+static inline int plm_buffer_next_start_code(plm_buffer_t *self);
+static inline int plm_buffer_find_start_code(plm_buffer_t *self, int code);
+static inline int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_t *table);
+static inline uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_uint_t *table);
 
 plm_buffer_t *plm_buffer_create_with_filename(const char *filename) {
 	PLM_FILE_TYPE fh = PLM_FILE_OPEN(filename);
@@ -1620,7 +2490,11 @@ plm_buffer_t *plm_buffer_create_with_filename(const char *filename) {
 }
 
 plm_buffer_t *plm_buffer_create_with_file(PLM_FILE_TYPE fh, int close_when_done) {
-	plm_buffer_t *self = plm_buffer_create_with_capacity(PLM_BUFFER_DEFAULT_SIZE);
+	return plm_buffer_create_with_file_ex(fh, close_when_done, NULL);
+}
+
+plm_buffer_t *plm_buffer_create_with_file_ex(PLM_FILE_TYPE fh, int close_when_done, plm_arena_t *arena) {
+	plm_buffer_t *self = plm_buffer_create_with_capacity_ex(PLM_BUFFER_DEFAULT_SIZE, arena);
 	if (!self) {
 		if (close_when_done && fh != PLM_FILE_INVALID_HANDLE) {
 			PLM_FILE_CLOSE(fh);
@@ -1632,8 +2506,8 @@ plm_buffer_t *plm_buffer_create_with_file(PLM_FILE_TYPE fh, int close_when_done)
 	self->mode = PLM_BUFFER_MODE_FILE;
 	self->discard_read_bytes = TRUE;
 
-	PLM_FILE_SEEK(self->fh, 0, SEEK_END);
-	self->total_size = PLM_FILE_TELL(self->fh);
+	// The file size is only looked up when first asked for, see
+	// plm_buffer_get_size(). Seeking to the end is slow on optical media.
 	PLM_FILE_SEEK(self->fh, 0, SEEK_SET);
 
 	self->load_callback = plm_buffer_load_file_callback;
@@ -1644,13 +2518,18 @@ plm_buffer_t *plm_buffer_create_with_file(PLM_FILE_TYPE fh, int close_when_done)
 }
 
 plm_buffer_t *plm_buffer_create_with_memory(uint8_t *bytes, size_t length, int free_when_done) {
-	plm_buffer_t *self = (plm_buffer_t *)PLM_MALLOC(sizeof(plm_buffer_t));
+	return plm_buffer_create_with_memory_ex(bytes, length, free_when_done, NULL);
+}
+
+plm_buffer_t *plm_buffer_create_with_memory_ex(uint8_t *bytes, size_t length, int free_when_done, plm_arena_t *arena) {
+	plm_buffer_t *self = (plm_buffer_t *)PLM_ARENA_MALLOC(arena, sizeof(plm_buffer_t));
 	if(!self) {
 		fprintf(stderr, "Out of memory for self. [plm_buffer_create_with_memory]\n");
 		return NULL;
 	}
 
 	PLM_MEMZERO(self, sizeof(plm_buffer_t));
+	self->arena = arena;
 	self->capacity = length;
 	self->length = length;
 	self->total_size = length;
@@ -1662,20 +2541,25 @@ plm_buffer_t *plm_buffer_create_with_memory(uint8_t *bytes, size_t length, int f
 }
 
 plm_buffer_t *plm_buffer_create_with_capacity(size_t capacity) {
-	plm_buffer_t *self = (plm_buffer_t *)PLM_MALLOC(sizeof(plm_buffer_t));
+	return plm_buffer_create_with_capacity_ex(capacity, NULL);
+}
+
+plm_buffer_t *plm_buffer_create_with_capacity_ex(size_t capacity, plm_arena_t *arena) {
+	plm_buffer_t *self = (plm_buffer_t *)PLM_ARENA_MALLOC(arena, sizeof(plm_buffer_t));
 	if(!self) {
 		fprintf(stderr, "Out of memory for self. [plm_buffer_create_with_capacity]\n");
 		return NULL;
 	}
 
 	PLM_MEMZERO(self, sizeof(plm_buffer_t));
+	self->arena = arena;
 	self->capacity = capacity;
 	self->free_when_done = TRUE;
 	self->total_size = 0;
-	self->bytes = (uint8_t *)PLM_MEMALIGN(32, capacity + PLM_PEEK_SIZE);
+	self->bytes = (uint8_t *)PLM_ARENA_MEMALIGN(arena, 32, capacity + PLM_PEEK_SIZE);
 	if(!self->bytes) {
 		fprintf(stderr, "Out of memory for bytes. [plm_buffer_create_with_capacity]\n");
-		PLM_FREE(self);
+		PLM_ARENA_FREE(arena, self);
 		return NULL;
 	}
 	self->mode = PLM_BUFFER_MODE_RING;
@@ -1701,34 +2585,48 @@ void plm_buffer_destroy(plm_buffer_t *self) {
 		PLM_FILE_CLOSE(self->fh);
 	}
 	if (self->free_when_done) {
-		PLM_FREE(self->bytes);
+		// Memory passed in by the caller never comes from the arena
+		if (self->mode == PLM_BUFFER_MODE_FIXED_MEM) {
+			PLM_FREE(self->bytes);
+		}
+		else {
+			PLM_ARENA_FREE(self->arena, self->bytes);
+		}
 		self->bytes = NULL;
 	}
-	PLM_FREE(self);
+	PLM_ARENA_FREE(self->arena, self);
 }
 
 size_t plm_buffer_get_size(plm_buffer_t *self) {
-	return (self->mode == PLM_BUFFER_MODE_FILE)
-		? self->total_size
-		: self->length;
+	if (self->mode != PLM_BUFFER_MODE_FILE) {
+		return self->length;
+	}
+
+	if (!self->total_size) {
+		long previous_pos = PLM_FILE_TELL(self->fh);
+		PLM_FILE_SEEK(self->fh, 0, SEEK_END);
+		self->total_size = PLM_FILE_TELL(self->fh);
+		PLM_FILE_SEEK(self->fh, previous_pos, SEEK_SET);
+	}
+	return self->total_size;
 }
 
 size_t plm_buffer_get_remaining(plm_buffer_t *self) {
 	return self->length - (self->bit_index >> 3);
 }
 
-inline size_t plm_buffer_get_space(plm_buffer_t *self) {
+static inline size_t plm_buffer_get_space(plm_buffer_t *self) {
     return self->capacity - self->length;
 }
 
 // How many bytes are contiguous from pos until end of buffer
-inline size_t plm_buffer_bytes_until_wrap(plm_buffer_t *self, size_t pos) {
+static inline size_t plm_buffer_bytes_until_wrap(plm_buffer_t *self, size_t pos) {
     return self->capacity - pos;
 }
 
 // (self->capacity - 1) is mod[%] trick that can only be used with capacity that are
 // powers of 2.
-inline uint8_t *plm_buffer_ptr_from_read(const plm_buffer_t *self, size_t byte_off) {
+static inline uint8_t *plm_buffer_ptr_from_read(const plm_buffer_t *self, size_t byte_off) {
     size_t pos = (self->read_byte_pos + byte_off) & (self->capacity - 1);
     return &self->bytes[pos]; // Safe for bytes[0..3] because of guard bytes
 }
@@ -1736,14 +2634,14 @@ inline uint8_t *plm_buffer_ptr_from_read(const plm_buffer_t *self, size_t byte_o
 // Keep a 4-byte guard at the end of the allocation in sync with bytes[0..3].
 // This lets hot-path bit reads grab a 32-bit window (s[0..3]) without needing
 // any ring wrap checks when the read crosses the end of the buffer.
-inline void plm_buffer_ring_sync_guard(plm_buffer_t *self) {
+static inline void plm_buffer_ring_sync_guard(plm_buffer_t *self) {
     self->bytes[self->capacity + 0] = self->bytes[0];
     self->bytes[self->capacity + 1] = self->bytes[1];
     self->bytes[self->capacity + 2] = self->bytes[2];
     self->bytes[self->capacity + 3] = self->bytes[3];
 }
 
-inline void plm_sq_copy_bytes(void *dest, const void *src, size_t length) {
+static inline void plm_sq_copy_bytes(void *dest, const void *src, size_t length) {
     uint8_t *d = (uint8_t *)dest;
     const uint8_t *s = (const uint8_t *)src;
 
@@ -1761,11 +2659,16 @@ inline void plm_sq_copy_bytes(void *dest, const void *src, size_t length) {
 
     if (length >= 32 && (((uintptr_t)s & 7) == 0)) {
         size_t block_bytes = length & ~(size_t)31;
+
+#ifdef _arch_dreamcast
         size_t blocks = block_bytes >> 5;
 
         sq_lock(d);
         sq_fast_cpy(SQ_MASK_DEST(d), s, blocks);
         sq_unlock();
+#else
+        memcpy(d, s, block_bytes);
+#endif
 
         d += block_bytes;
         s += block_bytes;
@@ -1779,7 +2682,7 @@ inline void plm_sq_copy_bytes(void *dest, const void *src, size_t length) {
 
 int plm_buffer_ring_grow_memalign(plm_buffer_t *self, size_t new_capacity) {
     uint8_t *old_bytes = self->bytes;
-    uint8_t *new_bytes = (uint8_t *)PLM_MEMALIGN(32, new_capacity + PLM_PEEK_SIZE);
+    uint8_t *new_bytes = (uint8_t *)PLM_ARENA_MEMALIGN(self->arena, 32, new_capacity + PLM_PEEK_SIZE);
 	if (!new_bytes) {
         fprintf(stderr,
             "PLM_MEMALIGN failed when trying to resize to %zu bytes [plm_buffer_ring_grow_memalign]\n",
@@ -1794,7 +2697,7 @@ int plm_buffer_ring_grow_memalign(plm_buffer_t *self, size_t new_capacity) {
         plm_sq_copy_bytes(new_bytes + first, old_bytes, self->length - first);
     }
 
-    PLM_FREE(old_bytes);
+    PLM_ARENA_FREE(self->arena, old_bytes);
     self->bytes = new_bytes;
     self->capacity = new_capacity;
     self->read_byte_pos = 0;
@@ -1833,7 +2736,7 @@ int plm_buffer_ring_grow_realloc(plm_buffer_t *self, size_t new_capacity) {
 }
 
 // Copy up to len bytes into plm_buffer_t. Returns bytes written.
-inline size_t plm_buffer_ring_write(plm_buffer_t *self, uint8_t *bytes, size_t length) {
+static inline size_t plm_buffer_ring_write(plm_buffer_t *self, uint8_t *bytes, size_t length) {
     size_t first = PLM_MIN(length, plm_buffer_bytes_until_wrap(self, self->write_byte_pos));
 
     plm_sq_copy_bytes(&self->bytes[self->write_byte_pos], bytes, first);
@@ -1859,7 +2762,7 @@ inline size_t plm_buffer_ring_write(plm_buffer_t *self, uint8_t *bytes, size_t l
     return length;
 }
 
-inline int plm_buffer_ring_fs_read_into(plm_buffer_t *self, size_t want) {
+static inline int plm_buffer_ring_fs_read_into(plm_buffer_t *self, size_t want) {
     // One contiguous span until we wrap
     size_t bytes_until_wrap = plm_buffer_bytes_until_wrap(self, self->write_byte_pos);
     size_t first_chunk_want = (want < bytes_until_wrap) ? want : bytes_until_wrap;
@@ -1912,6 +2815,13 @@ size_t plm_buffer_write(plm_buffer_t *self, uint8_t *bytes, size_t length) {
 	// Do we have to resize to fit the new data?
 	size_t bytes_available = plm_buffer_get_space(self);
 	if (bytes_available < length) {
+		// A bump arena can't take the old block back, so every growth would
+		// leak it; arena rings keep the capacity they were created with
+		if (self->arena) {
+			fprintf(stderr, "Ring full, %zu bytes don't fit. [plm_buffer_write]\n", length);
+			return 0;
+		}
+
 		size_t new_size = self->capacity;
 		do {
 			new_size *= 2;
@@ -1976,6 +2886,13 @@ void plm_buffer_discard_read_bytes(plm_buffer_t *self) {
     size_t byte_pos = self->bit_index >> 3;
     if (byte_pos == 0) return;
 
+    // A decoder that ran into the end of a truncated stream has read past
+    // what was written; there is nothing beyond to keep
+    if (byte_pos > self->length) {
+        byte_pos = self->length;
+        self->bit_index = byte_pos << 3;
+    }
+
     // Advance read position with wrap
 	self->read_byte_pos = (self->read_byte_pos + byte_pos) & (self->capacity - 1);
 
@@ -2022,15 +2939,22 @@ inline int plm_buffer_has_ended(plm_buffer_t *self) {
 	return self->has_ended;
 }
 
-inline int plm_buffer_has(plm_buffer_t *self, size_t count) {
-	if (((self->length << 3) - self->bit_index) >= count) {
+// Bits left to read. A decoder can read past the end of a truncated picture,
+// which leaves none rather than wrapping around.
+static inline size_t plm_buffer_bits_left(plm_buffer_t *self) {
+	size_t bits = self->length << 3;
+	return bits > self->bit_index ? bits - self->bit_index : 0;
+}
+
+static inline int plm_buffer_has(plm_buffer_t *self, size_t count) {
+	if (plm_buffer_bits_left(self) >= count) {
 		return TRUE;
 	}
 
 	if (self->load_callback) {
 		self->load_callback(self, self->load_callback_user_data);
 
-		if (((self->length << 3) - self->bit_index) >= count) {
+		if (plm_buffer_bits_left(self) >= count) {
 			return TRUE;
 		}
 	}
@@ -2041,7 +2965,7 @@ inline int plm_buffer_has(plm_buffer_t *self, size_t count) {
 	return FALSE;
 }
 
-inline uint32_t plm_buffer_load_u32be(const uint8_t *s) {
+static inline uint32_t plm_buffer_load_u32be(const uint8_t *s) {
 	return
 		((uint32_t)s[0] << 24) |
 		((uint32_t)s[1] << 16) |
@@ -2050,7 +2974,7 @@ inline uint32_t plm_buffer_load_u32be(const uint8_t *s) {
 }
 
 // Gain 12%: https://github.com/bitbank2/pl_mpeg/blob/master/pl_mpeg.h
-inline uint32_t plm_buffer_read(plm_buffer_t *self, int count) {
+static inline uint32_t plm_buffer_read(plm_buffer_t *self, int count) {
 	uint32_t value = 0;
     uint32_t bit_index = (uint32_t)self->bit_index;
     size_t byte_off = (size_t)(bit_index >> 3);
@@ -2067,22 +2991,22 @@ inline uint32_t plm_buffer_read(plm_buffer_t *self, int count) {
     return value;
 }
 
-inline void plm_buffer_align(plm_buffer_t *self) {
+static inline void plm_buffer_align(plm_buffer_t *self) {
 	self->bit_index = ((self->bit_index + 7) >> 3) << 3; // Align to next byte
 }
 
-inline void plm_buffer_skip(plm_buffer_t *self, size_t count) {
+static inline void plm_buffer_skip(plm_buffer_t *self, size_t count) {
 	if (plm_buffer_has(self, count)) {
 		self->bit_index += count;
 	}
 }
 
-inline int plm_buffer_skip_bytes(plm_buffer_t *self, uint8_t v) {
+static inline int plm_buffer_skip_bytes(plm_buffer_t *self, uint8_t v) {
     plm_buffer_align(self);
 
     int skipped = 0;
     while (TRUE) {
-        size_t avail_bits = (self->length << 3) - self->bit_index;
+        size_t avail_bits = plm_buffer_bits_left(self);
         if (avail_bits < 8 && !plm_buffer_has(self, 8)) {
             break;
         }
@@ -2101,11 +3025,11 @@ inline int plm_buffer_skip_bytes(plm_buffer_t *self, uint8_t v) {
     return skipped;
 }
 
-inline int plm_buffer_next_start_code(plm_buffer_t *self) {
+static inline int plm_buffer_next_start_code(plm_buffer_t *self) {
     plm_buffer_align(self);
 
     while (TRUE) {
-        size_t avail_bits = (self->length << 3) - self->bit_index;
+        size_t avail_bits = plm_buffer_bits_left(self);
         if (avail_bits < (5u << 3) && !plm_buffer_has(self, (5u << 3))) {
             return -1;
         }
@@ -2123,7 +3047,7 @@ inline int plm_buffer_next_start_code(plm_buffer_t *self) {
     }
 }
 
-inline int plm_buffer_find_start_code(plm_buffer_t *self, int code) {
+static inline int plm_buffer_find_start_code(plm_buffer_t *self, int code) {
 	int current = 0;
 	while (TRUE) {
 		current = plm_buffer_next_start_code(self);
@@ -2134,7 +3058,7 @@ inline int plm_buffer_find_start_code(plm_buffer_t *self, int code) {
 	return -1;
 }
 
-inline int plm_buffer_has_start_code(plm_buffer_t *self, int code) {
+static inline int plm_buffer_has_start_code(plm_buffer_t *self, int code) {
 	size_t previous_bit_index = self->bit_index;
 	int previous_discard_read_bytes = self->discard_read_bytes;
 
@@ -2146,8 +3070,8 @@ inline int plm_buffer_has_start_code(plm_buffer_t *self, int code) {
 	return current;
 }
 
-inline int plm_buffer_peek_non_zero(plm_buffer_t *self, int bit_count) {
-	size_t avail_bits = (self->length << 3) - self->bit_index;
+static inline int plm_buffer_peek_non_zero(plm_buffer_t *self, int bit_count) {
+	size_t avail_bits = plm_buffer_bits_left(self);
 	if (avail_bits < (size_t)bit_count && !plm_buffer_has(self, bit_count)) {
 		return FALSE;
 	}
@@ -2160,7 +3084,7 @@ inline int plm_buffer_peek_non_zero(plm_buffer_t *self, int bit_count) {
 	return val != 0;
 }
 
-inline int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_t *table) {
+static inline int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_t *table) {
 	plm_vlc_t state = {0, 0};
 	uint32_t bit_index = (uint32_t)self->bit_index;
 	size_t byte_off = (size_t)(bit_index >> 3);
@@ -2189,7 +3113,7 @@ inline int16_t plm_buffer_read_vlc(plm_buffer_t *self, const plm_vlc_t *table) {
 	return state.value;
 }
 
-inline uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_uint_t *table) {
+static inline uint16_t plm_buffer_read_vlc_uint(plm_buffer_t *self, const plm_vlc_uint_t *table) {
 	return (uint16_t)plm_buffer_read_vlc(self, (const plm_vlc_t *)table);
 }
 
@@ -2203,6 +3127,7 @@ static const int PLM_START_END = 0xB9;
 static const int PLM_START_SYSTEM = 0xBB;
 
 struct plm_demux_t {
+	plm_arena_t *arena;
 	plm_buffer_t *buffer;
 	int destroy_buffer_when_done;
 	double system_clock_ref;
@@ -2219,6 +3144,10 @@ struct plm_demux_t {
 
 	int num_audio_streams;
 	int num_video_streams;
+	int mux_rate;
+	int rate_bound;
+	size_t video_std_bound;
+	size_t audio_std_bound;
 	plm_packet_t current_packet;
 	plm_packet_t next_packet;
 };
@@ -2230,12 +3159,17 @@ plm_packet_t *plm_demux_decode_packet(plm_demux_t *self, int type);
 plm_packet_t *plm_demux_get_packet(plm_demux_t *self);
 
 plm_demux_t *plm_demux_create(plm_buffer_t *buffer, int destroy_when_done) {
-	plm_demux_t *self = (plm_demux_t *)PLM_MALLOC(sizeof(plm_demux_t));
+	return plm_demux_create_ex(buffer, destroy_when_done, NULL);
+}
+
+plm_demux_t *plm_demux_create_ex(plm_buffer_t *buffer, int destroy_when_done, plm_arena_t *arena) {
+	plm_demux_t *self = (plm_demux_t *)PLM_ARENA_MALLOC(arena, sizeof(plm_demux_t));
 	if(!self) {
 		fprintf(stderr, "Out of memory for self. [plm_demux_create]\n");
 		return NULL;
 	}
 	PLM_MEMZERO(self, sizeof(plm_demux_t));
+	self->arena = arena;
 
 	self->buffer = buffer;
 	self->destroy_buffer_when_done = destroy_when_done;
@@ -2255,7 +3189,7 @@ void plm_demux_destroy(plm_demux_t *self) {
 	if (self->destroy_buffer_when_done) {
 		plm_buffer_destroy(self->buffer);
 	}
-	PLM_FREE(self);
+	PLM_ARENA_FREE(self->arena, self);
 }
 
 int plm_demux_has_headers(plm_demux_t *self) {
@@ -2284,7 +3218,7 @@ int plm_demux_has_headers(plm_demux_t *self) {
 
 		self->system_clock_ref = plm_demux_decode_time(self);
 		plm_buffer_skip(self->buffer, 1);
-		plm_buffer_skip(self->buffer, 22); // mux_rate * 50
+		self->mux_rate = plm_buffer_read(self->buffer, 22) * 50;
 		plm_buffer_skip(self->buffer, 1);
 
 		self->has_pack_header = TRUE;
@@ -2300,16 +3234,45 @@ int plm_demux_has_headers(plm_demux_t *self) {
 		}
 
 		self->start_code = PLM_START_SYSTEM;
-		if (!plm_buffer_has(self->buffer, 56)) {
+		if (!plm_buffer_has(self->buffer, 16)) {
+			return FALSE;
+		}
+
+		// Wait for the whole header, with the stream bounds at its end
+		size_t header_length = plm_buffer_read(self->buffer, 16);
+		self->buffer->bit_index -= 16;
+		if (!plm_buffer_has(self->buffer, (2 + PLM_MAX(header_length, 6)) << 3)) {
 			return FALSE;
 		}
 		self->start_code = -1;
 
 		plm_buffer_skip(self->buffer, 16); // header_length
-		plm_buffer_skip(self->buffer, 24); // rate bound
+		plm_buffer_skip(self->buffer, 1); // marker
+		self->rate_bound = plm_buffer_read(self->buffer, 22) * 50;
+		plm_buffer_skip(self->buffer, 1); // marker
 		self->num_audio_streams = plm_buffer_read(self->buffer, 6);
 		plm_buffer_skip(self->buffer, 5); // misc flags
 		self->num_video_streams = plm_buffer_read(self->buffer, 5);
+		plm_buffer_skip(self->buffer, 8); // reserved
+
+		// P-STD bounds of single streams, or of all audio (0xB8) or all
+		// video (0xB9) streams; keep the largest of each kind
+		for (size_t i = 6; i + 3 <= header_length; i += 3) {
+			int stream_id = plm_buffer_read(self->buffer, 8);
+			if (!(stream_id & 0x80)) {
+				break;
+			}
+			plm_buffer_skip(self->buffer, 2); // '11'
+			int scale = plm_buffer_read(self->buffer, 1);
+			size_t bound = plm_buffer_read(self->buffer, 13) * (scale ? 1024 : 128);
+
+			if (stream_id == 0xB9 || (stream_id & 0xF0) == PLM_DEMUX_PACKET_VIDEO_1) {
+				self->video_std_bound = PLM_MAX(self->video_std_bound, bound);
+			}
+			else if (stream_id == 0xB8 || (stream_id & 0xE0) == PLM_DEMUX_PACKET_AUDIO_1) {
+				self->audio_std_bound = PLM_MAX(self->audio_std_bound, bound);
+			}
+		}
 
 		self->has_system_header = TRUE;
 	}
@@ -2363,6 +3326,31 @@ int plm_demux_get_num_audio_streams(plm_demux_t *self) {
 		: 0;
 }
 
+int plm_demux_get_mux_rate(plm_demux_t *self) {
+	return plm_demux_has_headers(self)
+		? self->mux_rate
+		: 0;
+}
+
+int plm_demux_get_rate_bound(plm_demux_t *self) {
+	return plm_demux_has_headers(self)
+		? self->rate_bound
+		: 0;
+}
+
+size_t plm_demux_get_std_buffer_bound(plm_demux_t *self, int type) {
+	if (!plm_demux_has_headers(self)) {
+		return 0;
+	}
+	if (type == PLM_DEMUX_PACKET_VIDEO_1) {
+		return self->video_std_bound;
+	}
+	if (type >= PLM_DEMUX_PACKET_AUDIO_1 && type <= PLM_DEMUX_PACKET_AUDIO_4) {
+		return self->audio_std_bound;
+	}
+	return 0;
+}
+
 void plm_demux_rewind(plm_demux_t *self) {
 	plm_buffer_rewind(self->buffer);
 	self->current_packet.length = 0;
@@ -2451,6 +3439,27 @@ double plm_demux_get_duration(plm_demux_t *self, int type) {
 	return self->duration;
 }
 
+double plm_demux_get_duration_estimate(plm_demux_t *self) {
+	size_t file_size = plm_buffer_get_size(self->buffer);
+	if (
+		self->duration != PLM_PACKET_INVALID_TS &&
+		self->last_file_size == file_size
+	) {
+		return self->duration;
+	}
+
+	int mux_rate = plm_demux_get_mux_rate(self);
+	if (mux_rate <= 0 || file_size == 0) {
+		return PLM_PACKET_INVALID_TS;
+	}
+	return (double)file_size / mux_rate;
+}
+
+void plm_demux_set_duration(plm_demux_t *self, double duration) {
+	self->duration = duration;
+	self->last_file_size = plm_buffer_get_size(self->buffer);
+}
+
 plm_packet_t *plm_demux_seek(plm_demux_t *self, double seek_time, int type, int force_intra) {
 	if (!plm_demux_has_headers(self)) {
 		return NULL;
@@ -2772,11 +3781,16 @@ plm_packet_t *plm_demux_get_packet(plm_demux_t *self) {
 static const int PLM_VIDEO_PICTURE_TYPE_INTRA = 1;
 static const int PLM_VIDEO_PICTURE_TYPE_PREDICTIVE = 2;
 static const int PLM_VIDEO_PICTURE_TYPE_B = 3;
+static const int PLM_VIDEO_PICTURE_TYPE_D = 4;
+
+// vbv_buffer_size is coded in units of 16 kbit
+#define PLM_VIDEO_VBV_UNIT 2048
 
 static const int PLM_START_SEQUENCE = 0xB3;
 static const int PLM_START_SLICE_FIRST = 0x01;
 static const int PLM_START_SLICE_LAST = 0xAF;
 static const int PLM_START_PICTURE = 0x00;
+static const int PLM_START_GOP = 0xB8;
 static const int PLM_START_EXTENSION = 0xB5;
 static const int PLM_START_USER_DATA = 0xB2;
 
@@ -2912,11 +3926,16 @@ static const float PLM_VIDEO_PIXEL_ASPECT_RATIO[] = {
 	{       0, 0x16}, {       0, 0x1a},  //  10: 0000 1x
 };
 
+ __attribute__((aligned(32))) static const plm_vlc_t PLM_VIDEO_MACROBLOCK_TYPE_D[] = {
+	{      -1,    0}, {       0, 0x01},  //   0: x
+};
+
  __attribute__((aligned(32))) static const plm_vlc_t *PLM_VIDEO_MACROBLOCK_TYPE[] = {
 	NULL,
 	PLM_VIDEO_MACROBLOCK_TYPE_INTRA,
 	PLM_VIDEO_MACROBLOCK_TYPE_PREDICTIVE,
-	PLM_VIDEO_MACROBLOCK_TYPE_B
+	PLM_VIDEO_MACROBLOCK_TYPE_B,
+	PLM_VIDEO_MACROBLOCK_TYPE_D
 };
 
  __attribute__((aligned(32))) static const plm_vlc_t PLM_VIDEO_CODE_BLOCK_PATTERN[] = {
@@ -3213,8 +4232,10 @@ struct plm_video_t {
 
 	// --- Large arrays ---
 	int block_data[64];
-	uint8_t intra_quant_matrix[64] __attribute__((aligned(32)));
-	uint8_t non_intra_quant_matrix[64] __attribute__((aligned(32)));
+
+	// Point at the shared default tables unless the stream sends its own
+	const uint8_t *intra_quant_matrix;
+	const uint8_t *non_intra_quant_matrix;
 
 	// --- Cold: accessed once per frame or during init only ---
 	double framerate;
@@ -3231,6 +4252,35 @@ struct plm_video_t {
 	uint8_t *frames_data;
 	int has_reference_frame;
 	int assume_no_b_frames;
+	int skip_b_pictures;
+	int fill_planes;
+
+	// Trick play: skip pictures that aren't D-pictures once one was seen, and
+	// after that mode ends, skip P and B until the next I-picture.
+	int has_d_pictures;
+	int d_pictures_only;
+	int awaiting_intra;
+	int picture_skipped;
+	uint8_t *custom_quant_matrices;
+	plm_arena_t *arena;
+
+	// Row streaming: rows_done counts the rows already reported for the
+	// current picture, or is -1 when this picture isn't streamed.
+	plm_video_row_callback row_callback;
+	void *row_callback_user_data;
+	int rows_done;
+
+	// Macroblocks of the picture waiting to be copied from the
+	// display buffer to the planes, a run of scatter_count from scatter_first
+	int scatter_first;
+	int scatter_count;
+
+	// Reference rows still to prefetch for an upcoming macroblock; see
+	// plm_video_plan_prefetch()
+	const uint8_t *prefetch_y;
+	const uint8_t *prefetch_cb;
+	const uint8_t *prefetch_cr;
+	int prefetch_rows;
 };
 
 // DCL Gives 6% speedup...(https://github.com/bitbank2/pl_mpeg/blob/master/pl_mpeg.h)
@@ -3261,6 +4311,7 @@ static inline uint8_t plm_clamp(int n) {
 }
 
 int plm_video_decode_sequence_header(plm_video_t *self);
+uint8_t *plm_video_custom_quant_matrix(plm_video_t *self, int non_intra);
 void plm_video_init_frame(plm_video_t *self, plm_frame_t *frame, uint8_t *base);
 void plm_video_decode_picture(plm_video_t *self);
 void plm_video_decode_slice(plm_video_t *self, int slice);
@@ -3269,10 +4320,122 @@ void plm_video_decode_motion_vectors(plm_video_t *self);
 void plm_video_predict_macroblock(plm_video_t *self);
 void plm_video_copy_macroblock(uint32_t *dest, plm_frame_t *reference, int motion_h, int motion_v);
 void plm_video_interpolate_macroblock(uint32_t *dest, plm_frame_t *reference, int motion_h, int motion_v);
-void plm_video_scatter_macroblock(plm_video_t *self);
+void plm_video_scatter_run(plm_video_t *self, int first, int count);
+void plm_video_finish_rows(plm_video_t *self, int rows);
 void plm_video_decode_block(plm_video_t *self, int block, uint32_t *mb_display);
 void plm_video_idct(int *block);
 
+static inline void plm_video_flush_scatter(plm_video_t *self) {
+	if (self->scatter_count) {
+		plm_video_scatter_run(self, self->scatter_first, self->scatter_count);
+		self->scatter_count = 0;
+	}
+}
+
+// Queue the current macroblock for the planes. A run is written once its row
+// is complete, or before a macroblock that doesn't continue it.
+// Only references are predicted from, so only they need the Y/Cb/Cr planes,
+// unless the caller reads them. They are written a row at a time.
+static inline int plm_video_writes_planes(plm_video_t *self) {
+	return self->fill_planes || (
+		self->picture_type != PLM_VIDEO_PICTURE_TYPE_B &&
+		self->picture_type != PLM_VIDEO_PICTURE_TYPE_D
+	);
+}
+
+static inline void plm_video_queue_scatter(plm_video_t *self) {
+	if (
+		self->scatter_count &&
+		self->macroblock_address != self->scatter_first + self->scatter_count
+	) {
+		plm_video_flush_scatter(self);
+	}
+	if (!self->scatter_count) {
+		self->scatter_first = self->macroblock_address;
+	}
+	self->scatter_count++;
+	if (self->mb_col == self->mb_width - 1) {
+		plm_video_flush_scatter(self);
+	}
+}
+
+#if PLM_PREFETCH_DISTANCE > 0
+
+// Plan the prefetches for the reference area of the macroblock
+// PLM_PREFETCH_DISTANCE ahead. Its motion vector isn't decoded yet, but
+// neighbouring macroblocks mostly move alike, so the current vector is the
+// guess. B-pictures prefetch from the forward reference unless only the
+// backward one is used.
+static inline void plm_video_plan_prefetch(plm_video_t *self) {
+	plm_video_motion_t *motion = &self->motion_forward;
+	plm_frame_t *reference = &self->frame_forward;
+	if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_B && !motion->is_set) {
+		motion = &self->motion_backward;
+		reference = &self->frame_backward;
+	}
+
+	int col = self->mb_col + PLM_PREFETCH_DISTANCE;
+	int row = self->mb_row + col / self->mb_width;
+	col %= self->mb_width;
+	if (row >= self->mb_height) {
+		self->prefetch_rows = 0;
+		return;
+	}
+
+	int motion_h = motion->h;
+	int motion_v = motion->v;
+	if (motion->full_px) {
+		motion_h <<= 1;
+		motion_v <<= 1;
+	}
+
+	// Clamp to the plane; a 16x16 half-pel block reads 17 rows of 17 bytes
+	int dw = self->luma_width;
+	int x = (col << 4) + (motion_h >> 1);
+	int y = (row << 4) + (motion_v >> 1);
+	x = x < 0 ? 0 : (x > dw - 17 ? dw - 17 : x);
+	y = y < 0 ? 0 : (y > self->luma_height - 17 ? self->luma_height - 17 : y);
+
+	int chroma_offset = (y >> 1) * self->chroma_width + (x >> 1);
+	self->prefetch_y = reference->y.data + y * dw + x;
+	self->prefetch_cb = reference->cb.data + chroma_offset;
+	self->prefetch_cr = reference->cr.data + chroma_offset;
+	self->prefetch_rows = 17;
+}
+
+// Issue the next few planned rows. Called after each decoded block, so the
+// fetches overlap the IDCT instead of stalling one after another.
+static inline void plm_video_prefetch_step(plm_video_t *self) {
+	for (int i = 0; i < 3 && self->prefetch_rows; i++) {
+		PLM_PREFETCH(self->prefetch_y);
+		PLM_PREFETCH(self->prefetch_y + 16);
+		self->prefetch_y += self->luma_width;
+
+		// 9 chroma rows of 9 bytes alongside the 17 luma rows
+		if (self->prefetch_rows & 1) {
+			PLM_PREFETCH(self->prefetch_cb);
+			PLM_PREFETCH(self->prefetch_cb + 8);
+			PLM_PREFETCH(self->prefetch_cr);
+			PLM_PREFETCH(self->prefetch_cr + 8);
+			self->prefetch_cb += self->chroma_width;
+			self->prefetch_cr += self->chroma_width;
+		}
+		self->prefetch_rows--;
+	}
+}
+
+#else
+
+static inline void plm_video_plan_prefetch(plm_video_t *self) {
+	PLM_UNUSED(self);
+}
+
+static inline void plm_video_prefetch_step(plm_video_t *self) {
+	PLM_UNUSED(self);
+}
+
+#endif
+
 static inline void plm_video_advance_macroblock(plm_video_t *self) {
 	self->macroblock_address++;
 	self->mb_col++;
@@ -3283,12 +4446,18 @@ static inline void plm_video_advance_macroblock(plm_video_t *self) {
 }
 
 plm_video_t * plm_video_create_with_buffer(plm_buffer_t *buffer, int destroy_when_done) {
-	plm_video_t *self = (plm_video_t *)PLM_MALLOC(sizeof(plm_video_t));
+	return plm_video_create_ex(buffer, destroy_when_done, NULL);
+}
+
+plm_video_t *plm_video_create_ex(plm_buffer_t *buffer, int destroy_when_done, plm_arena_t *arena) {
+	plm_video_t *self = (plm_video_t *)PLM_ARENA_MALLOC(arena, sizeof(plm_video_t));
 	if(!self) {
 		fprintf(stderr, "Out of memory for self. [plm_video_create_with_buffer]\n");
 		return NULL;
 	}
 	PLM_MEMZERO(self, sizeof(plm_video_t));
+	self->arena = arena;
+	self->rows_done = -1;
 
 	self->buffer = buffer;
 	self->destroy_buffer_when_done = destroy_when_done;
@@ -3310,11 +4479,33 @@ void plm_video_destroy(plm_video_t *self) {
 	}
 
 	if (self->has_sequence_header) {
-		PLM_FREE(self->frames_data);
+		PLM_ARENA_FREE(self->arena, self->frames_data);
 		self->frames_data = NULL;
 	}
 
-	PLM_FREE(self);
+	if (self->custom_quant_matrices) {
+		PLM_ARENA_FREE(self->arena, self->custom_quant_matrices);
+		self->custom_quant_matrices = NULL;
+	}
+
+	PLM_ARENA_FREE(self->arena, self);
+}
+
+// Read the frame size and vbv_buffer_size from the next sequence header
+// without setting up a decoder. Moves the buffer's read position.
+int plm_video_peek_sequence_header(plm_buffer_t *buffer, int *width, int *height, size_t *vbv_buffer_size) {
+	int found = FALSE;
+	if (
+		plm_buffer_find_start_code(buffer, PLM_START_SEQUENCE) != -1 &&
+		plm_buffer_has(buffer, 24 + 8 + 18 + 1 + 10)
+	) {
+		*width = plm_buffer_read(buffer, 12);
+		*height = plm_buffer_read(buffer, 12);
+		plm_buffer_skip(buffer, 4 + 4 + 18 + 1); // aspect, rate, bit_rate, marker
+		*vbv_buffer_size = plm_buffer_read(buffer, 10) * PLM_VIDEO_VBV_UNIT;
+		found = (*width > 0 && *height > 0);
+	}
+	return found;
 }
 
 double plm_video_get_framerate(plm_video_t *self) {
@@ -3341,10 +4532,40 @@ int plm_video_get_height(plm_video_t *self) {
 		: 0;
 }
 
+int plm_video_get_picture_type(plm_video_t *self) {
+	return self->picture_type;
+}
+
 void plm_video_set_no_delay(plm_video_t *self, int no_delay) {
 	self->assume_no_b_frames = no_delay;
 }
 
+void plm_video_set_row_callback(plm_video_t *self, plm_video_row_callback fp, void *user) {
+	self->row_callback = fp;
+	self->row_callback_user_data = user;
+}
+
+void plm_video_set_skip_b_pictures(plm_video_t *self, int skip) {
+	self->skip_b_pictures = skip;
+}
+
+void plm_video_set_fill_planes(plm_video_t *self, int fill) {
+	self->fill_planes = fill;
+}
+
+void plm_video_set_d_pictures_only(plm_video_t *self, int only) {
+	if (self->d_pictures_only && !only && self->has_d_pictures) {
+		// The references are as old as the last picture before D-only mode
+		self->awaiting_intra = TRUE;
+		self->has_reference_frame = FALSE;
+	}
+	self->d_pictures_only = only;
+}
+
+int plm_video_has_d_pictures(plm_video_t *self) {
+	return self->has_d_pictures;
+}
+
 double plm_video_get_time(plm_video_t *self) {
 	return self->time;
 }
@@ -3411,7 +4632,18 @@ plm_frame_t *plm_video_decode(plm_video_t *self) {
 
 		plm_video_decode_picture(self);
 
-		if (self->assume_no_b_frames) {
+		if (self->picture_skipped) {
+			// Dropped; account for its time and look for the next picture
+			self->frames_decoded++;
+			self->time = (double)self->frames_decoded / self->framerate;
+			continue;
+		}
+
+		if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_D) {
+			// Never a reference, so shown right away
+			frame = &self->frame_current;
+		}
+		else if (self->assume_no_b_frames) {
 			frame = &self->frame_backward;
 		}
 		else if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_B) {
@@ -3451,6 +4683,19 @@ int plm_video_has_header(plm_video_t *self) {
 	return TRUE;
 }
 
+// Storage for quant matrices sent in the sequence header. Only streams that
+// override the defaults pay for it.
+uint8_t *plm_video_custom_quant_matrix(plm_video_t *self, int non_intra) {
+	if (!self->custom_quant_matrices) {
+		self->custom_quant_matrices = (uint8_t *)PLM_ARENA_MEMALIGN(self->arena, 32, 64 * 2);
+		if (!self->custom_quant_matrices) {
+			fprintf(stderr, "Out of memory for self->custom_quant_matrices. [plm_video_decode_sequence_header]\n");
+			return NULL;
+		}
+	}
+	return self->custom_quant_matrices + (non_intra ? 64 : 0);
+}
+
 int plm_video_decode_sequence_header(plm_video_t *self) {
 	int max_header_size = 64 + 2 * 64 * 8; // 64 bit header + 2x 64 byte matrix
 	if (!plm_buffer_has(self->buffer, max_header_size)) {
@@ -3486,24 +4731,34 @@ int plm_video_decode_sequence_header(plm_video_t *self) {
 
 	// Load custom intra quant matrix?
 	if (plm_buffer_read(self->buffer, 1)) {
+		uint8_t *matrix = plm_video_custom_quant_matrix(self, FALSE);
+		if (!matrix) {
+			return FALSE;
+		}
 		for (int i = 0; i < 64; i++) {
 			int idx = PLM_VIDEO_ZIG_ZAG[i];
-			self->intra_quant_matrix[idx] = plm_buffer_read(self->buffer, 8);
+			matrix[idx] = plm_buffer_read(self->buffer, 8);
 		}
+		self->intra_quant_matrix = matrix;
 	}
 	else {
-		plm_sq_copy_bytes(self->intra_quant_matrix, PLM_VIDEO_INTRA_QUANT_MATRIX, 64);
+		self->intra_quant_matrix = PLM_VIDEO_INTRA_QUANT_MATRIX;
 	}
 
 	// Load custom non intra quant matrix?
 	if (plm_buffer_read(self->buffer, 1)) {
+		uint8_t *matrix = plm_video_custom_quant_matrix(self, TRUE);
+		if (!matrix) {
+			return FALSE;
+		}
 		for (int i = 0; i < 64; i++) {
 			int idx = PLM_VIDEO_ZIG_ZAG[i];
-			self->non_intra_quant_matrix[idx] = plm_buffer_read(self->buffer, 8);
+			matrix[idx] = plm_buffer_read(self->buffer, 8);
 		}
+		self->non_intra_quant_matrix = matrix;
 	}
 	else {
-		plm_sq_copy_bytes(self->non_intra_quant_matrix, PLM_VIDEO_NON_INTRA_QUANT_MATRIX, 64);
+		self->non_intra_quant_matrix = PLM_VIDEO_NON_INTRA_QUANT_MATRIX;
 	}
 
 	self->mb_width = (self->width + 15) >> 4;
@@ -3523,7 +4778,7 @@ int plm_video_decode_sequence_header(plm_video_t *self) {
 	size_t frame_data_size = (luma_plane_size + 2 * chroma_plane_size);
 
 	// DCL DIFF
-	self->frames_data = (uint8_t *)PLM_MEMALIGN(32, frame_data_size * 3 * 2);
+	self->frames_data = (uint8_t *)PLM_ARENA_MEMALIGN(self->arena, 32, frame_data_size * 3 * 2);
 	if(!self->frames_data) {
 		fprintf(stderr, "Out of memory for self->frames_data. [plm_video_decode_sequence_header]\n");
 		return FALSE;
@@ -3564,8 +4819,29 @@ void plm_video_decode_picture(plm_video_t *self) {
 	self->picture_type = plm_buffer_read(self->buffer, 3);
 	plm_buffer_skip(self->buffer, 16); // skip vbv_delay
 
-	// D frames or unknown coding type
-	if (self->picture_type <= 0 || self->picture_type > PLM_VIDEO_PICTURE_TYPE_B) {
+	if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_D) {
+		self->has_d_pictures = TRUE;
+	}
+	else if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA) {
+		self->awaiting_intra = FALSE;
+	}
+
+	// Leave the slices of a dropped picture for plm_video_decode() to skip
+	self->picture_skipped = (
+		(self->skip_b_pictures && self->picture_type == PLM_VIDEO_PICTURE_TYPE_B) ||
+		(self->d_pictures_only && self->has_d_pictures && self->picture_type != PLM_VIDEO_PICTURE_TYPE_D) ||
+		(self->awaiting_intra && (
+			self->picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE ||
+			self->picture_type == PLM_VIDEO_PICTURE_TYPE_B
+		))
+	);
+	if (self->picture_skipped) {
+		self->start_code = -1;
+		return;
+	}
+
+	// Unknown coding type
+	if (self->picture_type <= 0 || self->picture_type > PLM_VIDEO_PICTURE_TYPE_D) {
 		return;
 	}
 
@@ -3602,6 +4878,15 @@ void plm_video_decode_picture(plm_video_t *self) {
 		self->frame_forward = self->frame_backward;
 	}
 
+	// Only stream the rows of a picture that is returned right away
+	self->rows_done = (
+		self->row_callback && (
+			self->assume_no_b_frames ||
+			self->picture_type == PLM_VIDEO_PICTURE_TYPE_B ||
+			self->picture_type == PLM_VIDEO_PICTURE_TYPE_D
+		)
+	) ? 0 : -1;
+
 	// Find first slice start code; skip extension and user data
 	do {
 		self->start_code = plm_buffer_next_start_code(self->buffer);
@@ -3610,14 +4895,23 @@ void plm_video_decode_picture(plm_video_t *self) {
 		self->start_code == PLM_START_USER_DATA
 	);
 
-	// Decode all slices
+	// Decode all slices, but none below the picture
 	while (PLM_START_IS_SLICE(self->start_code)) {
+		if ((self->start_code & 0x000000FF) > self->mb_height) {
+			break;
+		}
 		plm_video_decode_slice(self, self->start_code & 0x000000FF);
 		if (self->macroblock_address >= self->mb_size - 1) {
 			break;
 		}
 		self->start_code = plm_buffer_next_start_code(self->buffer);
 	}
+	plm_video_flush_scatter(self);
+
+	// Report rows that no slice reached
+	if (self->rows_done >= 0) {
+		plm_video_finish_rows(self, self->mb_height);
+	}
 
 	// If this is a reference picture rotate the prediction pointers
 	if (
@@ -3687,6 +4981,9 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 		if (self->macroblock_address + increment >= self->mb_size) {
 			return; // invalid
 		}
+		if (increment > 1 && self->picture_type == PLM_VIDEO_PICTURE_TYPE_D) {
+			return; // invalid, D-pictures code every macroblock
+		}
 		if (increment > 1) {
 			// Skipped macroblocks reset DC predictors
 			self->dc_predictor[0] = 128;
@@ -3704,8 +5001,8 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 		while (increment > 1) {
 			plm_video_advance_macroblock(self);
 			plm_video_predict_macroblock(self);
-			if (self->picture_type != PLM_VIDEO_PICTURE_TYPE_B) {
-				plm_video_scatter_macroblock(self);
+			if (plm_video_writes_planes(self)) {
+				plm_video_queue_scatter(self);
 			}
 			increment--;
 		}
@@ -3721,6 +5018,11 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 		return; // corrupt stream;
 	}
 
+	// Rows above the current macroblock are done
+	if (self->rows_done >= 0 && self->mb_row > self->rows_done) {
+		plm_video_finish_rows(self, self->mb_row);
+	}
+
 	// Process the current macroblock
 	const plm_vlc_t *table = PLM_VIDEO_MACROBLOCK_TYPE[self->picture_type];
 	self->macroblock_type = plm_buffer_read_vlc(self->buffer, table);
@@ -3729,6 +5031,10 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 	self->motion_forward.is_set = (self->macroblock_type & 0x08);
 	self->motion_backward.is_set = (self->macroblock_type & 0x04);
 
+	if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_D && !self->macroblock_intra) {
+		return; // corrupt stream, D-pictures only have intra macroblocks
+	}
+
 	// Quantizer scale
 	if ((self->macroblock_type & 0x10) != 0) {
 		self->quantizer_scale = plm_buffer_read(self->buffer, 5);
@@ -3756,17 +5062,33 @@ void plm_video_decode_macroblock(plm_video_t *self) {
 
 	if (cbp != 0) {
 		uint32_t *mb_display = self->frame_current.display + self->macroblock_address * 96;
+		int predicted = (
+			self->picture_type == PLM_VIDEO_PICTURE_TYPE_PREDICTIVE ||
+			self->picture_type == PLM_VIDEO_PICTURE_TYPE_B
+		);
+		if (predicted) {
+			plm_video_plan_prefetch(self);
+		}
 		for (int block = 0, mask = 0x20; block < 6; block++) {
 			if ((cbp & mask) != 0) {
 				plm_video_decode_block(self, block, mb_display);
+				if (predicted) {
+					plm_video_prefetch_step(self);
+				}
 			}
 			mask >>= 1;
 		}
 	}
 
-	// Scatter display buffer to Y/Cb/Cr planes while data is cache-hot
-	if (self->picture_type != PLM_VIDEO_PICTURE_TYPE_B) {
-		plm_video_scatter_macroblock(self);
+	if (self->picture_type == PLM_VIDEO_PICTURE_TYPE_D) {
+		plm_buffer_skip(self->buffer, 1); // end_of_macroblock
+	}
+	if (plm_video_writes_planes(self)) {
+		plm_video_queue_scatter(self);
+	}
+
+	if (self->rows_done >= 0 && self->mb_col == self->mb_width - 1) {
+		plm_video_finish_rows(self, self->mb_row + 1);
 	}
 }
 
@@ -3876,7 +5198,7 @@ void plm_video_copy_macroblock(
 
 	// Y block
 	dest += 32;
-	__asm__("pref @%0" : : "r"(dest));
+	PLM_PREFETCH(dest);
 
 	if (odd_h && odd_v)
 	{
@@ -3888,8 +5210,8 @@ void plm_video_copy_macroblock(
 		{
 			for (int j = 8; j; j--)
 			{
-				__asm__("pref @%0" : : "r"(s1 + scan));
-				__asm__("pref @%0" : : "r"(s2 + scan));
+				PLM_PREFETCH(s1 + scan);
+				PLM_PREFETCH(s2 + scan);
 				d[0] = (s1[0] + s1[1] + s2[0] + s2[1] + 2) >> 2;
 				d[1] = (s1[1] + s1[2] + s2[1] + s2[2] + 2) >> 2;
 				d[2] = (s1[2] + s1[3] + s2[2] + s2[3] + 2) >> 2;
@@ -3923,8 +5245,8 @@ void plm_video_copy_macroblock(
 		{
 			for (int j = 8; j; j--)
 			{
-				__asm__("pref @%0" : : "r"(s1 + scan));
-				__asm__("pref @%0" : : "r"(s2 + scan));
+				PLM_PREFETCH(s1 + scan);
+				PLM_PREFETCH(s2 + scan);
 				d[0] = (s1[0] + s2[0] + 1) >> 1;
 				d[1] = (s1[1] + s2[1] + 1) >> 1;
 				d[2] = (s1[2] + s2[2] + 1) >> 1;
@@ -3957,7 +5279,7 @@ void plm_video_copy_macroblock(
 		{
 			for (int j = 8; j; j--)
 			{
-				__asm__("pref @%0" : : "r"(s + scan));
+				PLM_PREFETCH(s + scan);
 				d[0] = (s[0] + s[1] + 1) >> 1;
 				d[1] = (s[1] + s[2] + 1) >> 1;
 				d[2] = (s[2] + s[3] + 1) >> 1;
@@ -3991,7 +5313,7 @@ void plm_video_copy_macroblock(
 			{
 				for (int j = 8; j; j--)
 				{
-					__asm__("pref @%0" : : "r"(s + scan));
+					PLM_PREFETCH(s + scan);
 					d[0] = s[0];
 					d[1] = s[1];
 					d[2] = s[2];
@@ -4023,7 +5345,7 @@ void plm_video_copy_macroblock(
 			{
 				for (int j = 8; j; j--)
 				{
-					__asm__("pref @%0" : : "r"(s + scan));
+					PLM_PREFETCH(s + scan);
 					d[0] = s[0];
 					d[1] = s[1];
 					d[2] = s[2];
@@ -4047,7 +5369,7 @@ void plm_video_copy_macroblock(
 			{
 				for (int j = 8; j; j--)
 				{
-					__asm__("pref @%0" : : "r"(s + scan));
+					PLM_PREFETCH(s + scan);
 					d[0] = s[0];
 					d[1] = s[1];
 					d[16] = s[2];
@@ -4062,7 +5384,7 @@ void plm_video_copy_macroblock(
 
 	// Cb, Cr blocks
 	dest -= 32;
-	__asm__("pref @%0" : : "r"(dest));
+	PLM_PREFETCH(dest);
 	src = reference->cb.data;
 	dw >>= 1;
 	dh >>= 1;
@@ -4084,8 +5406,8 @@ void plm_video_copy_macroblock(
 			int scan = dw;
 			for (int j = 8; j; j--)
 			{
-				__asm__("pref @%0" : : "r"(s1 + scan));
-				__asm__("pref @%0" : : "r"(s2 + scan));
+				PLM_PREFETCH(s1 + scan);
+				PLM_PREFETCH(s2 + scan);
 				d[0] = (s1[0] + s1[1] + s2[0] + s2[1] + 2) >> 2;
 				d[1] = (s1[1] + s1[2] + s2[1] + s2[2] + 2) >> 2;
 				d[2] = (s1[2] + s1[3] + s2[2] + s2[3] + 2) >> 2;
@@ -4107,8 +5429,8 @@ void plm_video_copy_macroblock(
 			int scan = dw;
 			for (int j = 8; j; j--)
 			{
-				__asm__("pref @%0" : : "r"(s1 + scan));
-				__asm__("pref @%0" : : "r"(s2 + scan));
+				PLM_PREFETCH(s1 + scan);
+				PLM_PREFETCH(s2 + scan);
 				d[0] = (s1[0] + s2[0] + 1) >> 1;
 				d[1] = (s1[1] + s2[1] + 1) >> 1;
 				d[2] = (s1[2] + s2[2] + 1) >> 1;
@@ -4129,7 +5451,7 @@ void plm_video_copy_macroblock(
 			int scan = dw;
 			for (int j = 8; j; j--)
 			{
-				__asm__("pref @%0" : : "r"(s + scan));
+				PLM_PREFETCH(s + scan);
 				d[0] = (s[0] + s[1] + 1) >> 1;
 				d[1] = (s[1] + s[2] + 1) >> 1;
 				d[2] = (s[2] + s[3] + 1) >> 1;
@@ -4151,7 +5473,7 @@ void plm_video_copy_macroblock(
 				int scan = dw;
 				for (int j = 8; j; j--)
 				{
-					__asm__("pref @%0" : : "r"(s + scan));
+					PLM_PREFETCH(s + scan);
 					d[0] = s[0];
 					d[1] = s[1];
 					d[2] = s[2];
@@ -4171,7 +5493,7 @@ void plm_video_copy_macroblock(
 				int scan = dw >> 1;
 				for (int j = 8; j; j--)
 				{
-					__asm__("pref @%0" : : "r"(s + scan));
+					PLM_PREFETCH(s + scan);
 					d[0] = s[0];
 					d[1] = s[1];
 					d[2] = s[2];
@@ -4187,7 +5509,7 @@ void plm_video_copy_macroblock(
 				int scan = dw >> 2;
 				for (int j = 8; j; j--)
 				{
-					__asm__("pref @%0" : : "r"(s + scan));
+					PLM_PREFETCH(s + scan);
 					d[0] = s[0];
 					d[1] = s[1];
 					d += 2;
@@ -4196,7 +5518,7 @@ void plm_video_copy_macroblock(
 			}
 		}
 		dest += 16;
-		__asm__("pref @%0" : : "r"(dest));
+		PLM_PREFETCH(dest);
 		src = reference->cr.data;
 	}
 }
@@ -4205,14 +5527,15 @@ void plm_video_copy_macroblock(
 void plm_video_interpolate_macroblock(
 	uint32_t *dest, plm_frame_t *reference, int motion_h, int motion_v
 ) {
-	__attribute__((aligned(8))) static uint32_t buffer[96];
+	// On the stack, so decoders running on different threads don't share it
+	__attribute__((aligned(8))) uint32_t buffer[96];
 
 	plm_video_copy_macroblock(buffer, reference, motion_h, motion_v);
-	__asm__("pref @%0" : : "r"(dest));
-	__asm__("pref @%0" : : "r"(buffer));
+	PLM_PREFETCH(dest);
+	PLM_PREFETCH(buffer);
 	for (int i = 0; i < 96; i += 8) {
-		__asm__("pref @%0" : : "r"(dest + i + 8));
-		__asm__("pref @%0" : : "r"(buffer + i + 8));
+		PLM_PREFETCH(dest + i + 8);
+		PLM_PREFETCH(buffer + i + 8);
 		dest[i + 0] = (((dest[i + 0] >> 1) & 0x7f7f7f7f) + ((buffer[i + 0] >> 1) & 0x7f7f7f7f));
 		dest[i + 1] = (((dest[i + 1] >> 1) & 0x7f7f7f7f) + ((buffer[i + 1] >> 1) & 0x7f7f7f7f));
 		dest[i + 2] = (((dest[i + 2] >> 1) & 0x7f7f7f7f) + ((buffer[i + 2] >> 1) & 0x7f7f7f7f));
@@ -4224,62 +5547,64 @@ void plm_video_interpolate_macroblock(
 	}
 }
 
-void plm_video_scatter_macroblock(plm_video_t *self) {
-	int scan = self->luma_width >> 2;
-	int scan_half = self->chroma_width >> 2;
+// 64-bit view of the display buffer and the planes. Both are 8-byte aligned:
+// a macroblock is 384 bytes and plane rows are a multiple of 8 bytes.
+typedef uint64_t plm_wide_t __attribute__((may_alias, aligned(8)));
 
-	uint32_t *s = self->frame_current.display + self->macroblock_address * 96;
+// Copy a run of macroblocks in one row from the display buffer (macroblock
+// order) to the Y/Cb/Cr planes. Each plane line of the run is written front
+// to back with 64-bit stores, instead of 8 or 16 short rows per macroblock
+// spread over the frame.
+void plm_video_scatter_run(plm_video_t *self, int first, int count) {
+	int row = first / self->mb_width;
+	int col = first % self->mb_width;
+	int scan = self->luma_width >> 3;
+	int scan_half = self->chroma_width >> 3;
 
-	uint32_t *d_cb = (uint32_t *)self->frame_current.cb.data
-		+ self->mb_row * 8 * scan_half + self->mb_col * 2;
-	uint32_t *d_cr = (uint32_t *)self->frame_current.cr.data
-		+ self->mb_row * 8 * scan_half + self->mb_col * 2;
-	uint32_t *d_y = (uint32_t *)self->frame_current.y.data
-		+ self->mb_row * 16 * scan + self->mb_col * 4;
+	// Per macroblock in 64-bit words: Cb 0-7, Cr 8-15, Y0 16-23, Y1 24-31,
+	// Y2 32-39, Y3 40-47; one word per line of each block
+	const plm_wide_t *s = (const plm_wide_t *)(self->frame_current.display + first * 96);
 
-	__asm__("pref @%0" : : "r"(s));
+	plm_wide_t *d_cb = (plm_wide_t *)self->frame_current.cb.data
+		+ row * 8 * scan_half + col;
+	plm_wide_t *d_cr = (plm_wide_t *)self->frame_current.cr.data
+		+ row * 8 * scan_half + col;
+	plm_wide_t *d_y = (plm_wide_t *)self->frame_current.y.data
+		+ row * 16 * scan + col * 2;
 
-	// Cb and Cr blocks (display offsets 0-15 and 16-31)
-	__asm__("pref @%0" : : "r"(s + 16));
+	PLM_PREFETCH(s);
 	for (int y = 0; y < 8; y++) {
-		d_cb[0] = s[0];
-		d_cb[1] = s[1];
-		d_cr[0] = s[16];
-		d_cr[1] = s[17];
+		const plm_wide_t *m = s + y;
+		for (int mb = 0; mb < count; mb++, m += 48) {
+			d_cb[mb] = m[0];
+			d_cr[mb] = m[8];
+		}
 		d_cb += scan_half;
 		d_cr += scan_half;
-		s += 2;
 	}
-	s += 16; // skip Cr block, advance to Y0
 
-	// Y upper half: Y0 (offsets 32-47) and Y1 (48-63)
-	__asm__("pref @%0" : : "r"(s + 16));
-	for (int y = 0; y < 8; y++) {
-		d_y[0] = s[0];
-		d_y[1] = s[1];
-		d_y[2] = s[16];
-		d_y[3] = s[17];
+	for (int y = 0; y < 16; y++) {
+		const plm_wide_t *m = s + 16 + (y & 7) + (y >> 3) * 16;
+		plm_wide_t *d = d_y;
+		for (int mb = 0; mb < count; mb++, m += 48, d += 2) {
+			d[0] = m[0];
+			d[1] = m[8];
+		}
 		d_y += scan;
-		s += 2;
 	}
-	s += 16; // skip Y1 block, advance to Y2
+}
 
-	// Y lower half: Y2 (offsets 64-79) and Y3 (80-95)
-	__asm__("pref @%0" : : "r"(s + 16));
-	for (int y = 0; y < 8; y++) {
-		d_y[0] = s[0];
-		d_y[1] = s[1];
-		d_y[2] = s[16];
-		d_y[3] = s[17];
-		d_y += scan;
-		s += 2;
+void plm_video_finish_rows(plm_video_t *self, int rows) {
+	while (self->rows_done < rows) {
+		self->row_callback(self, &self->frame_current, self->rows_done, self->row_callback_user_data);
+		self->rows_done++;
 	}
 }
 
 void plm_video_decode_block(plm_video_t *self, int block, uint32_t *mb_display) {
 
 	int n = 0;
-	uint8_t *quant_matrix;
+	const uint8_t *quant_matrix;
 
 	// Decode DC coefficient of intra-coded blocks
 	if (self->macroblock_intra) {
@@ -4322,9 +5647,13 @@ void plm_video_decode_block(plm_video_t *self, int block, uint32_t *mb_display)
 	int quantizer_scale = self->quantizer_scale;
 	int non_intra = !self->macroblock_intra;
 
+	// D-pictures code the DC coefficient only, with no end_of_block, and take
+	// the flat fill below without IDCT
+	int dc_only = (self->picture_type == PLM_VIDEO_PICTURE_TYPE_D);
+
 	// Decode AC coefficients (+DC for non-intra)
 	int level = 0;
-	while (TRUE) {
+	while (!dc_only) {
 		int run = 0;
 		uint16_t coeff = plm_buffer_read_vlc_uint(self->buffer, PLM_VIDEO_DCT_COEFF);
 
@@ -4388,7 +5717,7 @@ void plm_video_decode_block(plm_video_t *self, int block, uint32_t *mb_display)
 
 	int *s = self->block_data;
 	const uint8_t *clamp = clamp_table;
-	__asm__("pref @%0" : : "r"(s));
+	PLM_PREFETCH(s);
 
 	if (self->macroblock_intra) {
 		// Overwrite (no prediction)
@@ -4833,7 +6162,7 @@ struct plm_audio_t {
 	int scale_factor[2][32][3];
 	int sample[2][32][3];
 	plm_samples_t samples;
-	float D[1024];
+	const float *D;
 	float V[2][1024];
 
 	double time;
@@ -4843,6 +6172,7 @@ struct plm_audio_t {
 	int next_frame_data_size;
 	int has_header;
 	int destroy_buffer_when_done;
+	plm_arena_t *arena;
 };
 
 int plm_audio_find_frame_sync(plm_audio_t *self);
@@ -4906,24 +6236,16 @@ static inline int plm_audio_decode_scalefactor_value(int sf) {
 	return PLM_AUDIO_SCALEFACTOR_TABLE[sf];
 }
 
-plm_audio_t *plm_audio_create_with_buffer(plm_buffer_t *buffer, int destroy_when_done) {
-	plm_audio_t *self = (plm_audio_t *)PLM_MALLOC(sizeof(plm_audio_t));
-	if(!self) {
-		fprintf(stderr, "Out of memory for self. [plm_audio_create_with_buffer]\n");
-		return NULL;
-	}
-	PLM_MEMZERO(self, sizeof(plm_audio_t));
-
-	self->samples.count = PLM_AUDIO_SAMPLES_PER_FRAME;
-	self->buffer = buffer;
-	self->destroy_buffer_when_done = destroy_when_done;
-	self->samplerate_index = 3; // Indicates 0
+// Synthesis window shared by all audio decoders, built on first use
+static float plm_audio_window[1024] __attribute__((aligned(32)));
+static PLM_ONCE_TYPE plm_audio_window_once = PLM_ONCE_INIT;
 
+static void plm_audio_build_window(void) {
 	// Build a window table in a layout that's faster for the Dreamcast.
-	// We write the synthesis window into self->D in the exact order the
+	// We write the synthesis window into D in the exact order the
 	// decoder will read it (grab every 32nd value), and we write each chunk
 	// twice so later code can read straight through without wrap-around.
-	float *d = self->D;
+	float *d = plm_audio_window;
 	float *s = (float *)PLM_AUDIO_SYNTHESIS_WINDOW;
 	for (int i = 0; i < 32; i++)
 	{
@@ -4948,6 +6270,29 @@ plm_audio_t *plm_audio_create_with_buffer(plm_buffer_t *buffer, int destroy_when
 		}
 		s++;
 	}
+}
+
+plm_audio_t *plm_audio_create_with_buffer(plm_buffer_t *buffer, int destroy_when_done) {
+	return plm_audio_create_ex(buffer, destroy_when_done, NULL);
+}
+
+plm_audio_t *plm_audio_create_ex(plm_buffer_t *buffer, int destroy_when_done, plm_arena_t *arena) {
+	plm_audio_t *self = (plm_audio_t *)PLM_ARENA_MALLOC(arena, sizeof(plm_audio_t));
+	if(!self) {
+		fprintf(stderr, "Out of memory for self. [plm_audio_create_with_buffer]\n");
+		return NULL;
+	}
+	PLM_MEMZERO(self, sizeof(plm_audio_t));
+	self->arena = arena;
+
+	self->samples.count = PLM_AUDIO_SAMPLES_PER_FRAME;
+	self->buffer = buffer;
+	self->destroy_buffer_when_done = destroy_when_done;
+	self->samplerate_index = 3; // Indicates 0
+
+	// The reordered window is read-only, so all instances share one copy
+	PLM_ONCE(&plm_audio_window_once, plm_audio_build_window);
+	self->D = plm_audio_window;
 
 	// Attempt to decode first header
 	self->next_frame_data_size = plm_audio_decode_header(self);
@@ -4962,7 +6307,7 @@ void plm_audio_destroy(plm_audio_t *self) {
 	if (self->destroy_buffer_when_done) {
 		plm_buffer_destroy(self->buffer);
 	}
-	PLM_FREE(self);
+	PLM_ARENA_FREE(self->arena, self);
 }
 
 int plm_audio_has_header(plm_audio_t *self) {
@@ -5261,7 +6606,7 @@ void plm_audio_decode_frame(plm_audio_t *self) {
 
 					int d_index = (512 - (self->v_pos[ch] >> 1)) >> 5;
 					int v_index = (self->v_pos[ch] & 127) >> 1;
-					float *d = &self->D[d_index];
+					const float *d = &self->D[d_index];
 					float *v1 = &self->V[ch][v_index];
 					float *v2 = &self->V[ch][96 - v_index];
 					/* KOS stream splitter expects stereo pairs as L, R in memory. */
@@ -5481,4 +6826,1058 @@ void plm_audio_idct36(int s[32][3], int ss, float *d, int dp) {
 	d[dp + 15] = t02; d[dp + 16] = 0.0;
 }
 
+
+
+// -----------------------------------------------------------------------------
+// plm stream analysis and memory sizing
+// Needs the complete struct definitions above, so it lives at the end.
+
+// Number of packets plm_query_memory_requirements() looks at
+#define PLM_MEMORY_QUERY_PACKETS 64
+
+// Largest PES packet payload the 16 bit length field allows
+#define PLM_PACKET_MAX_SIZE 65535
+
+// Largest MPEG-1 Layer II frame: 384 kbit/s at 32 kHz, plus a padding byte
+#define PLM_AUDIO_MAX_FRAME_SIZE (144 * 384000 / 32000 + 1)
+
+static size_t plm_next_power_of_two(size_t n) {
+	size_t p = 4096;
+	while (p < n) {
+		p *= 2;
+	}
+	return p;
+}
+
+// A ring must hold the packet being read plus the one being written. Returns
+// the capacity a ring starting at `capacity` ends up with after growing.
+static size_t plm_ring_capacity_for_packets(size_t capacity, size_t max_packet) {
+	while (capacity < max_packet * 2) {
+		capacity *= 2;
+	}
+	return capacity;
+}
+
+static size_t plm_ring_growth(size_t capacity, size_t initial_capacity) {
+	return capacity > initial_capacity ? capacity - initial_capacity : 0;
+}
+
+static uint8_t plm_packet_byte_at(plm_packet_t *packet, size_t i) {
+	return i < packet->len0 ? packet->data0[i] : packet->data1[i - packet->len0];
+}
+
+// Read the buffer bounds of the system header and walk the first packets of
+// a buffer for their sizes. The buffer must be at the start of the stream,
+// where the pack and system headers are.
+static void plm_scan_packets(plm_buffer_t *buffer, int count, plm_stream_analysis_t *analysis) {
+	plm_demux_t *demux = plm_demux_create(buffer, FALSE);
+	if (demux) {
+		analysis->video_std_bound = plm_demux_get_std_buffer_bound(demux, PLM_DEMUX_PACKET_VIDEO_1);
+		analysis->audio_std_bound = plm_demux_get_std_buffer_bound(demux, PLM_DEMUX_PACKET_AUDIO_1);
+		for (int i = 0; i < count; i++) {
+			plm_packet_t *packet = plm_demux_decode(demux);
+			if (!packet) {
+				break;
+			}
+			if (packet->type == PLM_DEMUX_PACKET_VIDEO_1) {
+				analysis->video_bytes += packet->length;
+			}
+			else if (
+				packet->type >= PLM_DEMUX_PACKET_AUDIO_1 &&
+				packet->type <= PLM_DEMUX_PACKET_AUDIO_4
+			) {
+				if (packet->length > analysis->max_audio_packet) {
+					analysis->max_audio_packet = packet->length;
+				}
+				analysis->audio_bytes += packet->length;
+			}
+		}
+		plm_demux_destroy(demux);
+	}
+}
+
+int plm_analyze_stream(plm_buffer_t *buffer, int prescan_packets, plm_stream_analysis_t *analysis) {
+	PLM_MEMZERO(analysis, sizeof(plm_stream_analysis_t));
+	analysis->source_capacity = buffer->mode == PLM_BUFFER_MODE_FILE ? buffer->capacity : 0;
+	analysis->video_capacity = PLM_VID_BUFFER_DEFAULT_SIZE;
+	analysis->audio_capacity = PLM_BUFFER_DEFAULT_SIZE;
+
+	// Only sources we can read ahead in and rewind can be analyzed
+	if (
+		buffer->mode != PLM_BUFFER_MODE_FILE &&
+		buffer->mode != PLM_BUFFER_MODE_FIXED_MEM
+	) {
+		return FALSE;
+	}
+
+	size_t previous_pos = plm_buffer_tell(buffer);
+	plm_buffer_seek(buffer, 0);
+	int found = plm_video_peek_sequence_header(
+		buffer, &analysis->width, &analysis->height, &analysis->vbv_buffer_size
+	);
+	if (found) {
+		plm_buffer_seek(buffer, 0);
+		plm_scan_packets(buffer, prescan_packets, analysis);
+	}
+	plm_buffer_seek(buffer, previous_pos);
+
+	if (!found) {
+		return FALSE;
+	}
+
+	// The video decoder waits for a whole picture before decoding it. The VBV
+	// model bounds a picture by vbv_buffer_size, and one more packet may be
+	// written while the last one is still unread. A P-STD bound in the
+	// system header also bounds what the muxer lets pile up, and a packet,
+	// which has to fit that buffer; without one, a packet may be as large as
+	// its length field allows. The scanned packets say nothing about those
+	// that follow, so they aren't used here.
+	size_t video_packet = analysis->video_std_bound
+		? PLM_MIN(analysis->video_std_bound, PLM_PACKET_MAX_SIZE)
+		: PLM_PACKET_MAX_SIZE;
+	size_t video_buffered = PLM_MAX(analysis->vbv_buffer_size, analysis->video_std_bound);
+	if (video_buffered > 0) {
+		analysis->video_capacity = plm_next_power_of_two(
+			video_buffered + video_packet + PLM_PEEK_SIZE
+		);
+	}
+
+	// The audio decoder needs one frame plus the incoming packet on top of
+	// what the muxer lets pile up, which the P-STD bound declares. Without
+	// one there is only the prescan to go by: allow twice the audio that came
+	// with a full video ring in the scanned packets, for the muxer's jitter.
+	// Without a prescan either, keep the default. A stream that exceeds
+	// these stops with plm_has_error() in an arena.
+	if (analysis->audio_std_bound) {
+		size_t audio_packet = PLM_MIN(analysis->audio_std_bound, PLM_PACKET_MAX_SIZE);
+		analysis->audio_capacity = plm_next_power_of_two(
+			PLM_AUDIO_MAX_FRAME_SIZE + analysis->audio_std_bound + audio_packet + PLM_PEEK_SIZE
+		);
+	}
+	else if (analysis->max_audio_packet) {
+		size_t ahead = 0;
+		if (analysis->video_bytes) {
+			ahead = (size_t)(
+				(double)analysis->audio_bytes / analysis->video_bytes *
+				analysis->video_capacity * 2
+			);
+		}
+		analysis->audio_capacity = plm_next_power_of_two(
+			PLM_AUDIO_MAX_FRAME_SIZE + analysis->max_audio_packet + ahead + PLM_PEEK_SIZE
+		);
+	}
+
+	// A file source ring must fit whole packets for the demuxer. It doesn't
+	// grow during playback, and a packet later in the stream may be larger
+	// than any scanned, so size it for the largest the length field allows.
+	if (buffer->mode == PLM_BUFFER_MODE_FILE) {
+		analysis->source_capacity = plm_ring_capacity_for_packets(buffer->capacity, PLM_PACKET_MAX_SIZE);
+	}
+
+	return TRUE;
+}
+
+// Analyze the demuxer's source and grow the file source ring right away if
+// the packets need it. Returns FALSE only if that allocation fails.
+int plm_size_rings(plm_demux_t *demux, int prescan_packets, plm_stream_analysis_t *analysis) {
+	plm_buffer_t *source = demux->buffer;
+	plm_analyze_stream(source, prescan_packets, analysis);
+	if (analysis->source_capacity > source->capacity) {
+		if (plm_buffer_ring_grow_memalign(source, analysis->source_capacity) < 0) {
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+// A file buffer feeding the video decoder directly doesn't grow, but it must
+// hold a whole picture. Size it from vbv_buffer_size like the video ring and
+// record the capacities the decoders start with. Returns FALSE only if that
+// allocation fails.
+int plm_size_elementary_streams(plm_buffer_t *video_buffer, plm_buffer_t *audio_buffer, plm_stream_analysis_t *analysis) {
+	PLM_MEMZERO(analysis, sizeof(plm_stream_analysis_t));
+
+	if (video_buffer && video_buffer->mode == PLM_BUFFER_MODE_FILE) {
+		size_t previous_pos = plm_buffer_tell(video_buffer);
+		plm_buffer_seek(video_buffer, 0);
+		plm_video_peek_sequence_header(
+			video_buffer, &analysis->width, &analysis->height, &analysis->vbv_buffer_size
+		);
+		plm_buffer_seek(video_buffer, previous_pos);
+
+		size_t capacity = plm_next_power_of_two(
+			analysis->vbv_buffer_size + PLM_BUFFER_DEFAULT_SIZE + PLM_PEEK_SIZE
+		);
+		if (analysis->vbv_buffer_size > 0 && capacity > video_buffer->capacity) {
+			if (plm_buffer_ring_grow_memalign(video_buffer, capacity) < 0) {
+				return FALSE;
+			}
+		}
+	}
+
+	analysis->video_capacity = video_buffer ? video_buffer->capacity : 0;
+	analysis->audio_capacity = audio_buffer ? audio_buffer->capacity : 0;
+	return TRUE;
+}
+
+int plm_query_memory_requirements(plm_buffer_t *buffer, plm_memory_requirements_t *req) {
+	PLM_MEMZERO(req, sizeof(plm_memory_requirements_t));
+	if (!buffer) {
+		return FALSE;
+	}
+
+	// The ring sizes plm_init_decoders() will pick, and what a longer scan
+	// tells about the packets that follow.
+	plm_stream_analysis_t init, seen;
+	if (!plm_analyze_stream(buffer, PLM_BUFFER_PRESCAN_PACKETS, &init)) {
+		return FALSE;
+	}
+	plm_analyze_stream(buffer, PLM_MEMORY_QUERY_PACKETS, &seen);
+
+	size_t luma_plane_size = ((init.width + 15) & ~15) * ((init.height + 15) & ~15);
+	size_t frame_data_size = luma_plane_size + luma_plane_size / 2;
+	req->width = init.width;
+	req->height = init.height;
+
+	req->frame_buffers = frame_data_size * 3 * 2;
+	req->demux_ring = init.source_capacity ? init.source_capacity + PLM_PEEK_SIZE : 0;
+	req->video_ring = init.video_capacity + PLM_PEEK_SIZE;
+	req->audio_ring = init.audio_capacity + PLM_PEEK_SIZE;
+	req->ring_growth =
+		plm_ring_growth(seen.video_capacity, init.video_capacity) +
+		plm_ring_growth(seen.audio_capacity, init.audio_capacity) +
+		plm_ring_growth(seen.source_capacity, init.source_capacity);
+	req->audio_tables = sizeof(plm_audio_t);
+	req->structs =
+		sizeof(plm_t) + sizeof(plm_demux_t) +
+		3 * sizeof(plm_buffer_t) + sizeof(plm_video_t);
+	req->total =
+		req->frame_buffers + req->demux_ring + req->video_ring +
+		req->audio_ring + req->ring_growth + req->audio_tables + req->structs;
+
+	req->small_ring_savings =
+		plm_ring_growth(init.video_capacity, seen.video_capacity) +
+		plm_ring_growth(init.audio_capacity, seen.audio_capacity);
+	return TRUE;
+}
+
+void plm_get_memory_footprint(plm_t *self, plm_memory_requirements_t *req) {
+	PLM_MEMZERO(req, sizeof(plm_memory_requirements_t));
+
+	plm_buffer_t *source = self->demux ? self->demux->buffer : NULL;
+	req->structs = sizeof(plm_t);
+	if (source) {
+		req->structs += sizeof(plm_demux_t) + sizeof(plm_buffer_t);
+	}
+	if (source && source->mode == PLM_BUFFER_MODE_FILE) {
+		req->demux_ring = source->capacity + PLM_PEEK_SIZE;
+		req->ring_growth += plm_ring_growth(source->capacity, self->ring_sizes.source_capacity);
+	}
+
+	if (self->video_buffer) {
+		req->structs += sizeof(plm_buffer_t);
+		req->video_ring = self->video_buffer->capacity + PLM_PEEK_SIZE;
+		req->ring_growth += plm_ring_growth(self->video_buffer->capacity, self->ring_sizes.video_capacity);
+	}
+	if (self->video_decoder) {
+		plm_video_t *video = self->video_decoder;
+		req->structs += sizeof(plm_video_t);
+		if (video->has_sequence_header) {
+			req->width = video->width;
+			req->height = video->height;
+			size_t frame_data_size =
+				video->luma_width * video->luma_height +
+				2 * video->chroma_width * video->chroma_height;
+			req->frame_buffers = frame_data_size * 3 * 2;
+		}
+	}
+
+	if (self->audio_buffer) {
+		req->structs += sizeof(plm_buffer_t);
+		req->audio_ring = self->audio_buffer->capacity + PLM_PEEK_SIZE;
+		req->ring_growth += plm_ring_growth(self->audio_buffer->capacity, self->ring_sizes.audio_capacity);
+	}
+	if (self->audio_decoder) {
+		req->audio_tables = sizeof(plm_audio_t);
+	}
+
+	// The ring sizes above already include any growth
+	req->total =
+		req->frame_buffers + req->demux_ring + req->video_ring +
+		req->audio_ring + req->audio_tables + req->structs;
+}
+
+void plm_get_buffer_levels(plm_t *self, plm_buffer_levels_t *levels) {
+	PLM_MEMZERO(levels, sizeof(plm_buffer_levels_t));
+
+	if (self->demux) {
+		plm_buffer_t *source = self->demux->buffer;
+		levels->demux_fill = plm_buffer_get_remaining(source);
+		levels->demux_capacity = source->capacity;
+	}
+
+	if (self->video_buffer) {
+		levels->video_fill = plm_buffer_get_remaining(self->video_buffer);
+		levels->video_capacity = self->video_buffer->capacity;
+	}
+	if (self->audio_buffer) {
+		levels->audio_fill = plm_buffer_get_remaining(self->audio_buffer);
+		levels->audio_capacity = self->audio_buffer->capacity;
+	}
+}
+
+size_t plm_get_arena_size(plm_buffer_t *buffer) {
+	plm_stream_analysis_t analysis;
+	if (!buffer || !plm_analyze_stream(buffer, PLM_BUFFER_PRESCAN_PACKETS, &analysis)) {
+		return 0;
+	}
+
+	size_t luma_plane_size = ((analysis.width + 15) & ~15) * ((analysis.height + 15) & ~15);
+	size_t frame_data_size = luma_plane_size + luma_plane_size / 2;
+
+	size_t size = PLM_ARENA_SIZEOF(sizeof(plm_arena_t));
+	size += PLM_ARENA_SIZEOF(sizeof(plm_t));
+	size += PLM_ARENA_SIZEOF(sizeof(plm_demux_t));
+
+	// Source, video and audio ring buffers. A file source ring is created
+	// before the analysis runs and replaced if it turns out too small.
+	size += 3 * PLM_ARENA_SIZEOF(sizeof(plm_buffer_t));
+	size += PLM_ARENA_SIZEOF(PLM_BUFFER_DEFAULT_SIZE + PLM_PEEK_SIZE);
+	if (analysis.source_capacity > PLM_BUFFER_DEFAULT_SIZE) {
+		size += PLM_ARENA_SIZEOF(analysis.source_capacity + PLM_PEEK_SIZE);
+	}
+	size += PLM_ARENA_SIZEOF(analysis.video_capacity + PLM_PEEK_SIZE);
+	size += PLM_ARENA_SIZEOF(analysis.audio_capacity + PLM_PEEK_SIZE);
+
+	// Decoders and 3 reference frames, each with a display copy
+	size += PLM_ARENA_SIZEOF(sizeof(plm_video_t));
+	size += PLM_ARENA_SIZEOF(frame_data_size * 3 * 2);
+	size += PLM_ARENA_SIZEOF(64 * 2); // Custom quant matrices, if any
+	size += PLM_ARENA_SIZEOF(sizeof(plm_audio_t));
+
+	// Headroom for the keyframe index, which is built on first use. The
+	// rings never grow in an arena.
+	size += PLM_ARENA_SIZEOF(2 * PLM_BUFFER_DEFAULT_SIZE + PLM_PEEK_SIZE);
+
+	return size;
+}
+
+size_t plm_get_arena_used(plm_t *self) {
+	return self->arena ? self->arena->used : 0;
+}
+
+
+
+// -----------------------------------------------------------------------------
+// plm keyframe index
+// Needs the packet helpers of the stream analysis above.
+
+static void plm_keyframes_add(plm_t *self, plm_keyframe_t *keyframe) {
+	if (self->keyframe_count == self->keyframe_capacity && !self->arena) {
+		int capacity = self->keyframe_capacity ? self->keyframe_capacity * 2 : 64;
+		plm_keyframe_t *keyframes = (plm_keyframe_t *)PLM_REALLOC(
+			self->keyframes, capacity * sizeof(plm_keyframe_t)
+		);
+		if (keyframes) {
+			self->keyframes = keyframes;
+			self->keyframe_capacity = capacity;
+		}
+	}
+
+	// Keep counting when there is no room, so plm_build_keyframes() knows how
+	// much an arena instance needs
+	if (self->keyframe_count < self->keyframe_capacity) {
+		self->keyframes[self->keyframe_count] = *keyframe;
+	}
+	self->keyframe_count++;
+}
+
+// Walk all packets of the video stream for GOP and picture headers. Like
+// plm_demux_seek(), only a packet with a PTS whose first picture is an intra
+// picture counts as a keyframe. The payload is never handed to the decoder.
+static void plm_scan_keyframes(plm_t *self, int type, double start_time) {
+	plm_demux_t *demux = self->demux;
+	plm_buffer_t *buffer = demux->buffer;
+	plm_keyframe_t keyframe;
+	PLM_MEMZERO(&keyframe, sizeof(plm_keyframe_t));
+
+	self->keyframe_count = 0;
+	plm_demux_buffer_seek(demux, 0);
+	while (plm_buffer_find_start_code(buffer, type) != -1) {
+		size_t position = plm_buffer_tell(buffer) - 4;
+		plm_packet_t *packet = plm_demux_decode_packet(demux, type);
+		if (!packet) {
+			continue;
+		}
+
+		int first_picture = TRUE;
+		for (size_t i = 0; i + 5 < packet->length; i++) {
+			if (
+				plm_packet_byte_at(packet, i) != 0x00 ||
+				plm_packet_byte_at(packet, i + 1) != 0x00 ||
+				plm_packet_byte_at(packet, i + 2) != 0x01
+			) {
+				continue;
+			}
+
+			int code = plm_packet_byte_at(packet, i + 3);
+			if (code == PLM_START_GOP && i + 8 <= packet->length) {
+				// drop_frame(1) hours(5) minutes(6) marker(1) seconds(6)
+				// pictures(6) closed_gop(1) broken_link(1)
+				uint32_t bits =
+					((uint32_t)plm_packet_byte_at(packet, i + 4) << 24) |
+					((uint32_t)plm_packet_byte_at(packet, i + 5) << 16) |
+					((uint32_t)plm_packet_byte_at(packet, i + 6) << 8) |
+					(uint32_t)plm_packet_byte_at(packet, i + 7);
+				keyframe.has_gop = TRUE;
+				keyframe.drop_frame = (bits >> 31) & 0x01;
+				keyframe.hours = (bits >> 26) & 0x1f;
+				keyframe.minutes = (bits >> 20) & 0x3f;
+				keyframe.seconds = (bits >> 13) & 0x3f;
+				keyframe.pictures = (bits >> 7) & 0x3f;
+				keyframe.closed_gop = (bits >> 6) & 0x01;
+				keyframe.broken_link = (bits >> 5) & 0x01;
+			}
+			else if (code == PLM_START_PICTURE) {
+				int picture_type = (plm_packet_byte_at(packet, i + 5) >> 3) & 0x07;
+				if (
+					first_picture &&
+					picture_type == PLM_VIDEO_PICTURE_TYPE_INTRA &&
+					packet->pts != PLM_PACKET_INVALID_TS
+				) {
+					keyframe.time = packet->pts - start_time;
+					keyframe.position = position;
+					plm_keyframes_add(self, &keyframe);
+				}
+
+				// A GOP header only belongs to the picture right after it
+				PLM_MEMZERO(&keyframe, sizeof(plm_keyframe_t));
+				first_picture = FALSE;
+			}
+		}
+
+		// Skip the payload instead of searching it for the next packet
+		plm_buffer_skip(buffer, packet->length << 3);
+		demux->current_packet.length = 0;
+	}
+}
+
+static int plm_build_keyframes(plm_t *self) {
+	if (!plm_init_decoders(self) || !self->demux || !self->video_packet_type) {
+		return FALSE;
+	}
+
+	plm_demux_t *demux = self->demux;
+	plm_buffer_t *buffer = demux->buffer;
+	if (buffer->mode == PLM_BUFFER_MODE_RING) {
+		return FALSE;
+	}
+
+	size_t size = plm_buffer_get_size(buffer);
+	if (size && self->keyframes_source_size == size) {
+		return TRUE;
+	}
+
+	int type = self->video_packet_type;
+	double start_time = plm_demux_get_start_time(demux, type);
+
+	size_t previous_pos = plm_buffer_tell(buffer);
+	int previous_start_code = demux->start_code;
+	double previous_pts = demux->last_decoded_pts;
+
+	plm_scan_keyframes(self, type, start_time);
+
+	// An arena can't grow an allocation; take the counted size and scan again
+	if (self->arena && self->keyframe_count > self->keyframe_capacity) {
+		plm_keyframe_t *keyframes = (plm_keyframe_t *)PLM_ARENA_MALLOC(
+			self->arena, self->keyframe_count * sizeof(plm_keyframe_t)
+		);
+		if (keyframes) {
+			self->keyframes = keyframes;
+			self->keyframe_capacity = self->keyframe_count;
+			plm_scan_keyframes(self, type, start_time);
+		}
+	}
+
+	plm_demux_buffer_seek(demux, previous_pos);
+	demux->start_code = previous_start_code;
+	demux->last_decoded_pts = previous_pts;
+
+	if (self->keyframe_count > self->keyframe_capacity) {
+		fprintf(stderr, "Out of memory for keyframes. [plm_build_keyframes]\n");
+		self->keyframe_count = 0;
+		self->keyframes_source_size = 0;
+		return FALSE;
+	}
+
+	self->keyframes_source_size = size;
+	return TRUE;
+}
+
+static int plm_keyframe_index(plm_t *self, double time) {
+	int lo = 0;
+	int hi = self->keyframe_count;
+	while (lo < hi) {
+		int mid = (lo + hi) / 2;
+		if (self->keyframes[mid].time <= time) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	return lo - 1;
+}
+
+plm_keyframe_t *plm_get_keyframes(plm_t *self, int *count) {
+	if (!plm_build_keyframes(self) || !self->keyframe_count) {
+		*count = 0;
+		return NULL;
+	}
+	*count = self->keyframe_count;
+	return self->keyframes;
+}
+
+int plm_find_keyframe(plm_t *self, double time) {
+	if (!plm_build_keyframes(self)) {
+		return -1;
+	}
+	return plm_keyframe_index(self, time);
+}
+
+// Position the demuxer on the keyframe packet plm_seek_frame() should decode
+// from. Returns NULL if the index hasn't been built or is out of date.
+plm_packet_t *plm_seek_keyframe_packet(plm_t *self, double time) {
+	if (
+		!self->keyframe_count ||
+		self->keyframes_source_size != plm_buffer_get_size(self->demux->buffer)
+	) {
+		return NULL;
+	}
+
+	int index = plm_keyframe_index(self, time);
+	if (index < 0) {
+		index = 0;
+	}
+
+	// The demuxer expects to be right after the packet start code
+	plm_demux_buffer_seek(self->demux, self->keyframes[index].position + 4);
+	return plm_demux_decode_packet(self->demux, self->video_packet_type);
+}
+
+
+
+// -----------------------------------------------------------------------------
+// plm stream scanner
+// Needs the packet helpers of the stream analysis above.
+
+// Collects the bytes after the sequence, GOP and picture start codes of the
+// video stream, across packet boundaries
+typedef struct {
+	plm_scan_info_t *info;
+	uint32_t window;
+	int code;
+	int want;
+	int have;
+	uint8_t header[8];
+	int gop_length;
+	int pictures;
+	int picture_type;
+} plm_scan_video_t;
+
+static void plm_scan_video_header(plm_scan_video_t *v) {
+	plm_scan_info_t *info = v->info;
+	uint8_t *h = v->header;
+
+	if (v->code == PLM_START_SEQUENCE) {
+		if (!info->width) {
+			info->width = (h[0] << 4) | (h[1] >> 4);
+			info->height = ((h[1] & 0x0f) << 8) | h[2];
+			info->framerate = PLM_VIDEO_PICTURE_RATE[h[3] & 0x0f];
+			info->video_bitrate = ((h[4] << 10) | (h[5] << 2) | (h[6] >> 6)) * 400;
+			info->vbv_buffer_size = (((h[6] & 0x1f) << 5) | (h[7] >> 3)) * PLM_VIDEO_VBV_UNIT;
+		}
+	}
+	else if (v->code == PLM_START_GOP) {
+		info->gops++;
+		info->closed_gops += (h[3] >> 6) & 0x01;
+		v->gop_length = 0;
+	}
+	else {
+		int type = (h[1] >> 3) & 0x07;
+		if (type < 5) {
+			info->frames_by_type[type]++;
+		}
+		if (!v->pictures++) {
+			v->picture_type = type;
+		}
+		info->frames++;
+		v->gop_length++;
+		if (v->gop_length > info->max_gop_length) {
+			info->max_gop_length = v->gop_length;
+		}
+	}
+}
+
+static void plm_scan_video_bytes(plm_scan_video_t *v, const uint8_t *bytes, size_t length) {
+	for (size_t i = 0; i < length; i++) {
+		if (v->want) {
+			v->header[v->have++] = bytes[i];
+			if (v->have == v->want) {
+				plm_scan_video_header(v);
+				v->want = 0;
+			}
+			continue;
+		}
+
+		v->window = (v->window << 8) | bytes[i];
+		if ((v->window >> 8) != 0x000001) {
+			continue;
+		}
+
+		v->code = v->window & 0xff;
+		v->have = 0;
+		if (v->code == PLM_START_SEQUENCE) {
+			v->want = 8;
+		}
+		else if (v->code == PLM_START_GOP) {
+			v->want = 4;
+		}
+		else if (v->code == PLM_START_PICTURE) {
+			v->want = 2;
+		}
+	}
+}
+
+static void plm_scan_audio_header(plm_scan_audio_t *audio, plm_packet_t *packet) {
+	for (size_t i = 0; i + 4 <= packet->length; i++) {
+		// Sync word, MPEG-1, Layer II
+		if (
+			plm_packet_byte_at(packet, i) != 0xff ||
+			(plm_packet_byte_at(packet, i + 1) & 0xfe) != 0xfc
+		) {
+			continue;
+		}
+
+		int b2 = plm_packet_byte_at(packet, i + 2);
+		int bitrate_index = (b2 >> 4) - 1;
+		int samplerate_index = (b2 >> 2) & 0x03;
+		if (bitrate_index < 0 || bitrate_index > 13 || samplerate_index == 3) {
+			continue;
+		}
+
+		int mode = plm_packet_byte_at(packet, i + 3) >> 6;
+		audio->samplerate = PLM_AUDIO_SAMPLE_RATE[samplerate_index];
+		audio->bitrate = PLM_AUDIO_BIT_RATE[bitrate_index] * 1000;
+		audio->channels = mode == PLM_AUDIO_MODE_MONO ? 1 : 2;
+		return;
+	}
+}
+
+int plm_scan_stream(plm_buffer_t *buffer, plm_scan_info_t *info, plm_scan_packet_callback callback, void *user) {
+	PLM_MEMZERO(info, sizeof(plm_scan_info_t));
+
+	plm_scan_video_t video;
+	PLM_MEMZERO(&video, sizeof(plm_scan_video_t));
+	video.info = info;
+	video.window = 0xffffffff;
+
+	// A demuxer that is never asked for headers, just to parse the PES headers
+	plm_demux_t demux;
+	PLM_MEMZERO(&demux, sizeof(plm_demux_t));
+	demux.buffer = buffer;
+	demux.start_code = -1;
+
+	int seekable =
+		buffer->mode == PLM_BUFFER_MODE_FILE ||
+		buffer->mode == PLM_BUFFER_MODE_FIXED_MEM ||
+		buffer->mode == PLM_BUFFER_MODE_APPEND;
+	size_t previous_pos = plm_buffer_tell(buffer);
+	if (seekable) {
+		plm_buffer_seek(buffer, 0);
+	}
+
+	double scr = 0;
+	double first_scr = PLM_PACKET_INVALID_TS;
+	int mux_rate = 0;
+	int second = 0;
+	size_t second_bytes = 0;
+
+	int code;
+	while ((code = plm_buffer_next_start_code(buffer)) != -1) {
+		size_t position = plm_buffer_tell(buffer) - 4;
+		size_t size = 0;
+
+		if (code == PLM_START_PACK) {
+			if (!plm_buffer_has(buffer, 64) || plm_buffer_read(buffer, 4) != 0x02) {
+				continue;
+			}
+			scr = plm_demux_decode_time(&demux);
+			plm_buffer_skip(buffer, 1);
+			mux_rate = plm_buffer_read(buffer, 22) * 50;
+			plm_buffer_skip(buffer, 1);
+
+			if (first_scr == PLM_PACKET_INVALID_TS) {
+				first_scr = scr;
+			}
+			if (mux_rate > info->mux_rate) {
+				info->mux_rate = mux_rate;
+			}
+			info->packs++;
+			size = 12;
+		}
+		else if (
+			code == PLM_DEMUX_PACKET_VIDEO_1 ||
+			code == PLM_DEMUX_PACKET_PRIVATE || (
+				code >= PLM_DEMUX_PACKET_AUDIO_1 &&
+				code <= PLM_DEMUX_PACKET_AUDIO_4
+			)
+		) {
+			plm_packet_t *packet = plm_demux_decode_packet(&demux, code);
+			if (!packet) {
+				break;
+			}
+			size = plm_buffer_tell(buffer) - position + packet->length;
+
+			plm_scan_packet_t scanned;
+			scanned.type = code;
+			scanned.position = position;
+			scanned.size = size;
+			scanned.length = packet->length;
+			scanned.pts = packet->pts;
+			scanned.scr = scr;
+			scanned.mux_rate = mux_rate;
+			scanned.pictures = 0;
+			scanned.picture_type = 0;
+
+			if (code == PLM_DEMUX_PACKET_VIDEO_1) {
+				video.pictures = 0;
+				video.picture_type = 0;
+				plm_scan_video_bytes(&video, packet->data0, packet->len0);
+				if (packet->data1) {
+					plm_scan_video_bytes(&video, packet->data1, packet->len1);
+				}
+				scanned.pictures = video.pictures;
+				scanned.picture_type = video.picture_type;
+				info->video_bytes += packet->length;
+			}
+			else if (code != PLM_DEMUX_PACKET_PRIVATE) {
+				plm_scan_audio_t *audio = &info->audio[code - PLM_DEMUX_PACKET_AUDIO_1];
+				if (!audio->samplerate) {
+					plm_scan_audio_header(audio, packet);
+				}
+				audio->bytes += packet->length;
+			}
+
+			info->packets++;
+			if (callback) {
+				callback(&scanned, user);
+			}
+
+			// Skip the payload by the packet length
+			plm_buffer_skip(buffer, packet->length << 3);
+			demux.current_packet.length = 0;
+		}
+		else if (code == PLM_START_SYSTEM || code >= 0xbc) {
+			// System header, padding and other streams: length and payload
+			if (!plm_buffer_has(buffer, 16)) {
+				break;
+			}
+			size_t length = plm_buffer_read(buffer, 16);
+			plm_buffer_skip(buffer, length << 3);
+			size = 6 + length;
+		}
+		else {
+			size = 4;
+		}
+
+		// Bits per second of SCR, counted where each piece arrived
+		if (first_scr != PLM_PACKET_INVALID_TS && (int)(scr - first_scr) != second) {
+			if (second_bytes * 8 > (size_t)info->peak_bitrate) {
+				info->peak_bitrate = second_bytes * 8;
+			}
+			second = (int)(scr - first_scr);
+			second_bytes = 0;
+		}
+		second_bytes += size;
+		info->size += size;
+	}
+	if (second_bytes * 8 > (size_t)info->peak_bitrate) {
+		info->peak_bitrate = second_bytes * 8;
+	}
+
+	if (seekable) {
+		plm_buffer_seek(buffer, previous_pos);
+	}
+
+	if (info->framerate > 0) {
+		info->video_duration = info->frames / info->framerate;
+	}
+	info->duration = info->video_duration;
+
+	for (int i = 0; i < 4; i++) {
+		plm_scan_audio_t *audio = &info->audio[i];
+		if (!audio->bytes) {
+			continue;
+		}
+		info->num_audio_streams++;
+		if (audio->bitrate) {
+			// A Layer II frame is 144 * bitrate / samplerate bytes on average
+			audio->frames = (int)(audio->bytes * (double)audio->samplerate / (144.0 * audio->bitrate) + 0.5);
+			audio->duration = (double)audio->frames * PLM_AUDIO_SAMPLES_PER_FRAME / audio->samplerate;
+		}
+		if (audio->duration > info->duration) {
+			info->duration = audio->duration;
+		}
+	}
+
+	return info->frames > 0 || info->num_audio_streams > 0;
+}
+
+
+
+// -----------------------------------------------------------------------------
+// plm_decode audio worker
+// Needs the complete struct definitions above, so it lives at the end.
+
+#ifndef _arch_dreamcast
+
+// Decoded audio frames the worker may get ahead of the video
+#define PLM_AUDIO_WORKER_QUEUE 8
+
+struct plm_audio_worker_t {
+	plm_t *plm;
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	int quit;
+
+	// The current job: decode audio up to target_time. next_time is the time
+	// of the next frame the worker will put into the queue.
+	int running;
+	double target_time;
+	double next_time;
+
+	plm_samples_t queue[PLM_AUDIO_WORKER_QUEUE];
+	int head;
+	int count;
+
+	plm_buffer_t *pending;
+};
+
+static void *plm_audio_worker_main(void *arg) {
+	plm_audio_worker_t *self = (plm_audio_worker_t *)arg;
+
+	pthread_mutex_lock(&self->lock);
+	while (TRUE) {
+		while (!self->running && !self->quit) {
+			pthread_cond_wait(&self->cond, &self->lock);
+		}
+		if (self->quit) {
+			break;
+		}
+
+		// The decoder and its buffer belong to this thread until the job ends
+		plm_audio_t *audio = self->plm->audio_decoder;
+		while (!self->quit) {
+			if (self->count == PLM_AUDIO_WORKER_QUEUE) {
+				pthread_cond_wait(&self->cond, &self->lock);
+				continue;
+			}
+			if (plm_audio_get_time(audio) >= self->target_time) {
+				break;
+			}
+
+			pthread_mutex_unlock(&self->lock);
+			plm_samples_t *samples = plm_audio_decode(audio);
+			pthread_mutex_lock(&self->lock);
+
+			if (!samples) {
+				break;
+			}
+			int tail = (self->head + self->count) % PLM_AUDIO_WORKER_QUEUE;
+			memcpy(&self->queue[tail], samples, sizeof(plm_samples_t));
+			self->count++;
+			self->next_time = plm_audio_get_time(audio);
+			pthread_cond_broadcast(&self->cond);
+		}
+
+		self->running = FALSE;
+		pthread_cond_broadcast(&self->cond);
+	}
+	pthread_mutex_unlock(&self->lock);
+	return NULL;
+}
+
+plm_audio_worker_t *plm_audio_worker_create(plm_t *plm) {
+	plm_audio_worker_t *self = (plm_audio_worker_t *)PLM_MEMALIGN(32, sizeof(plm_audio_worker_t));
+	if (!self) {
+		fprintf(stderr, "Out of memory for self. [plm_audio_worker_create]\n");
+		return NULL;
+	}
+	PLM_MEMZERO(self, sizeof(plm_audio_worker_t));
+	self->plm = plm;
+
+	self->pending = plm_buffer_create_with_capacity(PLM_BUFFER_DEFAULT_SIZE);
+	if (!self->pending) {
+		PLM_FREE(self);
+		return NULL;
+	}
+
+	pthread_mutex_init(&self->lock, NULL);
+	pthread_cond_init(&self->cond, NULL);
+	if (pthread_create(&self->thread, NULL, plm_audio_worker_main, self) != 0) {
+		pthread_cond_destroy(&self->cond);
+		pthread_mutex_destroy(&self->lock);
+		plm_buffer_destroy(self->pending);
+		PLM_FREE(self);
+		return NULL;
+	}
+	return self;
+}
+
+void plm_audio_worker_destroy(plm_audio_worker_t *self) {
+	pthread_mutex_lock(&self->lock);
+	self->quit = TRUE;
+	pthread_cond_broadcast(&self->cond);
+	pthread_mutex_unlock(&self->lock);
+	pthread_join(self->thread, NULL);
+
+	pthread_cond_destroy(&self->cond);
+	pthread_mutex_destroy(&self->lock);
+	plm_buffer_destroy(self->pending);
+	PLM_FREE(self);
+}
+
+// Hand the queued audio up to the given time to the callback, waiting for
+// the worker where it hasn't got that far yet. The slot being delivered stays
+// in the queue until the callback returns, so the worker can't overwrite it.
+static void plm_audio_worker_deliver(plm_t *plm, double time) {
+	plm_audio_worker_t *self = plm->audio_worker;
+
+	pthread_mutex_lock(&self->lock);
+	while (TRUE) {
+		if (self->count == 0) {
+			if (!self->running || self->next_time > time) {
+				break;
+			}
+			pthread_cond_wait(&self->cond, &self->lock);
+			continue;
+		}
+
+		plm_samples_t *samples = &self->queue[self->head];
+		if (samples->time > time) {
+			break;
+		}
+
+		pthread_mutex_unlock(&self->lock);
+		plm->audio_decode_callback(plm, samples, plm->audio_decode_callback_user_data);
+		pthread_mutex_lock(&self->lock);
+
+		self->head = (self->head + 1) % PLM_AUDIO_WORKER_QUEUE;
+		self->count--;
+		pthread_cond_broadcast(&self->cond);
+	}
+	pthread_mutex_unlock(&self->lock);
+}
+
+void plm_audio_worker_decode(plm_t *self, double video_target_time, double audio_target_time) {
+	plm_audio_worker_t *worker = self->audio_worker;
+	plm_audio_t *audio = self->audio_decoder;
+	plm_buffer_t *audio_buffer = self->audio_buffer;
+
+	if (!plm_audio_has_header(audio)) {
+		return;
+	}
+
+	// The worker must not demux, that would write to the video buffer under
+	// the video decoder's feet. Demux the audio it needs for this call up
+	// front; audio the video side demuxes meanwhile goes to the pending
+	// buffer. Elementary streams have a buffer of their own and load freely.
+	plm_buffer_load_callback load_callback = audio_buffer->load_callback;
+	if (self->demux) {
+		double frame_duration = (double)PLM_AUDIO_SAMPLES_PER_FRAME / plm_audio_get_samplerate(audio);
+		double frames = (audio_target_time - plm_audio_get_time(audio)) / frame_duration + 1;
+		size_t frame_bytes =
+			144000 * PLM_AUDIO_BIT_RATE[audio->bitrate_index] /
+			PLM_AUDIO_SAMPLE_RATE[audio->samplerate_index] + 1;
+		size_t needed = frames > 0 ? (size_t)frames * frame_bytes : 0;
+
+		while (
+			plm_buffer_get_remaining(audio_buffer) < needed &&
+			!plm_demux_has_ended(self->demux) &&
+			!self->has_error
+		) {
+			plm_read_packets(self, self->audio_packet_type);
+		}
+
+		audio_buffer->load_callback = NULL;
+		self->audio_pending = worker->pending;
+	}
+
+	pthread_mutex_lock(&worker->lock);
+	worker->target_time = audio_target_time;
+	worker->next_time = plm_audio_get_time(audio);
+	worker->running = TRUE;
+	pthread_cond_broadcast(&worker->cond);
+	pthread_mutex_unlock(&worker->lock);
+
+	plm_video_t *video = self->video_decoder;
+	while (plm_video_get_time(video) < video_target_time) {
+		plm_frame_t *frame = plm_video_decode(video);
+		if (!frame) {
+			break;
+		}
+		plm_audio_worker_deliver(self, frame->time);
+		self->video_decode_callback(self, frame, self->video_decode_callback_user_data);
+	}
+
+	// Everything else the worker decodes comes after the last frame
+	plm_audio_worker_deliver(self, audio_target_time);
+	pthread_mutex_lock(&worker->lock);
+	while (worker->running) {
+		pthread_cond_wait(&worker->cond, &worker->lock);
+	}
+	pthread_mutex_unlock(&worker->lock);
+
+	if (self->demux) {
+		audio_buffer->load_callback = load_callback;
+		self->audio_pending = NULL;
+
+		plm_buffer_t *pending = worker->pending;
+		while (plm_buffer_get_remaining(pending)) {
+			size_t length = plm_buffer_bytes_until_wrap(pending, pending->read_byte_pos);
+			length = PLM_MIN(length, pending->length);
+			if (plm_buffer_write(audio_buffer, pending->bytes + pending->read_byte_pos, length) != length) {
+				self->has_error = TRUE;
+				break;
+			}
+			pending->bit_index = length << 3;
+			plm_buffer_discard_read_bytes(pending);
+		}
+		if (self->has_error || plm_demux_has_ended(self->demux)) {
+			plm_buffer_signal_end(audio_buffer);
+		}
+	}
+}
+
+#else
+
+plm_audio_worker_t *plm_audio_worker_create(plm_t *plm) {
+	PLM_UNUSED(plm);
+	return NULL;
+}
+
+void plm_audio_worker_destroy(plm_audio_worker_t *self) {
+	PLM_UNUSED(self);
+}
+
+void plm_audio_worker_decode(plm_t *self, double video_target_time, double audio_target_time) {
+	PLM_UNUSED(self);
+	PLM_UNUSED(video_target_time);
+	PLM_UNUSED(audio_target_time);
+}
+
+#endif // _arch_dreamcast
+
 #endif // PL_MPEG_IMPLEMENTATION
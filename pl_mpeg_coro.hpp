@@ -0,0 +1,428 @@
+/*
+PL_MPEG_CORO - C++20 coroutine front-end for pl_mpeg.h
+SPDX-License-Identifier: MIT
+
+
+-- Synopsis
+
+#include "pl_mpeg_coro.hpp"
+
+plm::async_decoder decoder;
+
+// Called whenever the decoder runs dry. Start a read and return; when it
+// completes, hand the bytes to decoder.feed(). Suspended coroutines resume
+// from inside feed().
+decoder.set_read_callback([](plm::async_decoder &d, size_t want, void *user) {
+	start_async_read(want, user);
+}, my_io);
+
+plm::task play(plm::async_decoder &decoder) {
+	while (plm::frame_handle frame = co_await decoder.next_frame()) {
+		upload(frame->y.data, frame->cr.data, frame->cb.data);
+		plm::audio_block audio = co_await decoder.next_audio(1024);
+		queue_pcm(audio.data(), audio.size());
+	}
+}
+
+
+-- Documentation
+
+The plm_* interface pulls its data synchronously: when a buffer runs dry it
+calls the buffer's load callback and expects the data to be there when the
+callback returns. That blocks the decoding thread on I/O.
+
+async_decoder turns that around. Its source is a ring buffer that you fill
+with feed() whenever a read completes. When the decoder needs more data than
+the buffer has, it asks for it through the read callback and the awaiting
+coroutine suspends instead of blocking. feed() resumes it once the frame or
+audio block it waits for can be decoded. Call feed_end() after the last
+bytes of the stream.
+
+If the read callback calls feed() right away, e.g. because the data is
+already in memory, decoding continues without suspending.
+
+Only one coroutine may wait on a decoder at a time. A frame_handle points
+into the decoder's frame buffers and is only valid until the next frame is
+decoded, so release it before awaiting next_frame() again. Likewise an
+audio_block is only valid until the next next_audio().
+
+Every frame is in both frame->display (macroblock order, as mpeg.c uploads
+it) and the Y, Cr and Cb planes. The decoder only writes the planes of
+reference pictures by itself, so async_decoder turns on
+plm_set_video_fill_planes(). If you only use display, turn it off again with
+plm_set_video_fill_planes(decoder.get(), FALSE) to save a copy per frame.
+
+async_decoder only uses the public plm_* API. The implementation of
+pl_mpeg.h must be compiled into another translation unit, as mpeg.c does.
+
+*/
+
+#ifndef PL_MPEG_CORO_HPP
+#define PL_MPEG_CORO_HPP
+
+#include <algorithm>
+#include <cassert>
+#include <coroutine>
+#include <cstddef>
+#include <cstring>
+#include <exception>
+#include <utility>
+#include <vector>
+
+#include "mpeg.h"
+#include "pl_mpeg.h"
+
+namespace plm {
+
+class async_decoder;
+
+
+// A decoded video frame, or an empty handle at the end of the stream. Its
+// planes and display buffer both hold the frame. Move-only; the frame data
+// stays in the decoder and is not copied.
+
+class frame_handle {
+public:
+	frame_handle() = default;
+	frame_handle(frame_handle &&other) noexcept
+		: decoder_(std::exchange(other.decoder_, nullptr)), frame_(std::exchange(other.frame_, nullptr)) {}
+	frame_handle &operator=(frame_handle &&other) noexcept {
+		if (this != &other) {
+			release();
+			decoder_ = std::exchange(other.decoder_, nullptr);
+			frame_ = std::exchange(other.frame_, nullptr);
+		}
+		return *this;
+	}
+	frame_handle(const frame_handle &) = delete;
+	frame_handle &operator=(const frame_handle &) = delete;
+	~frame_handle() { release(); }
+
+	explicit operator bool() const { return frame_ != nullptr; }
+	plm_frame_t *get() const { return frame_; }
+	plm_frame_t *operator->() const { return frame_; }
+	plm_frame_t &operator*() const { return *frame_; }
+
+	inline void release();
+
+private:
+	friend class async_decoder;
+	frame_handle(async_decoder *decoder, plm_frame_t *frame) : decoder_(decoder), frame_(frame) {}
+
+	async_decoder *decoder_ = nullptr;
+	plm_frame_t *frame_ = nullptr;
+};
+
+
+// Interleaved stereo PCM from next_audio(). Fewer samples than asked for
+// means the stream has ended. Move-only; it views a buffer the decoder reuses.
+
+class audio_block {
+public:
+	audio_block() = default;
+	audio_block(audio_block &&other) noexcept
+		: data_(std::exchange(other.data_, nullptr)), count_(std::exchange(other.count_, 0)), time_(other.time_) {}
+	audio_block &operator=(audio_block &&other) noexcept {
+		data_ = std::exchange(other.data_, nullptr);
+		count_ = std::exchange(other.count_, 0);
+		time_ = other.time_;
+		return *this;
+	}
+	audio_block(const audio_block &) = delete;
+	audio_block &operator=(const audio_block &) = delete;
+
+	explicit operator bool() const { return count_ > 0; }
+
+	// Samples per channel; data() holds twice as many shorts (L, R)
+	size_t size() const { return count_; }
+	const short *data() const { return data_; }
+
+	// Time of the first sample in seconds
+	double time() const { return time_; }
+
+private:
+	friend class async_decoder;
+	audio_block(const short *data, size_t count, double time) : data_(data), count_(count), time_(time) {}
+
+	const short *data_ = nullptr;
+	size_t count_ = 0;
+	double time_ = 0;
+};
+
+
+class async_decoder {
+public:
+	// Called when the decoder needs at least `want` more bytes. Start a read
+	// and feed() the data when it arrives; don't wait for it here.
+	typedef void (*read_callback)(async_decoder &decoder, size_t want, void *user);
+
+	// Called instead of resuming a coroutine directly, e.g. to post it to a
+	// job system. The default resumes it inside feed().
+	typedef void (*resume_callback)(std::coroutine_handle<> handle, void *user);
+
+	explicit async_decoder(size_t capacity = 64 * 1024) {
+		source_ = plm_buffer_create_with_capacity(capacity);
+		if (!source_) {
+			return;
+		}
+		plm_buffer_set_load_callback(source_, &async_decoder::on_underflow, this);
+		plm_ = plm_create_with_buffer(source_, TRUE);
+		if (plm_) {
+			// Handles give out the planes of B-pictures too
+			plm_set_video_fill_planes(plm_, TRUE);
+		}
+	}
+
+	async_decoder(const async_decoder &) = delete;
+	async_decoder &operator=(const async_decoder &) = delete;
+
+	~async_decoder() {
+		if (plm_) {
+			plm_destroy(plm_);
+		}
+		else if (source_) {
+			plm_buffer_destroy(source_);
+		}
+	}
+
+	// The underlying instance, for headers, stream selection and so on.
+	// NULL if it could not be created.
+	plm_t *get() const { return plm_; }
+
+	void set_read_callback(read_callback fp, void *user) {
+		read_callback_ = fp;
+		read_callback_user_ = user;
+	}
+
+	void set_resume_callback(resume_callback fp, void *user) {
+		resume_callback_ = fp;
+		resume_callback_user_ = user;
+	}
+
+	// Append bytes read from the source and resume the waiting coroutine if
+	// what it waits for can now be decoded. Ends the outstanding read.
+	void feed(const void *bytes, size_t length) {
+		plm_buffer_write(source_, (uint8_t *)bytes, length);
+		fed_++;
+		read_pending_ = false;
+		retry();
+	}
+
+	// Mark the end of the source; waiting coroutines get an empty result.
+	void feed_end() {
+		plm_buffer_signal_end(source_);
+		ended_ = true;
+		fed_++;
+		read_pending_ = false;
+		retry();
+	}
+
+	bool has_ended() const { return plm_ && plm_has_ended(plm_); }
+
+
+	// co_await decoder.next_frame() -> frame_handle
+
+	struct frame_awaiter {
+		async_decoder &decoder;
+
+		bool await_ready() {
+			return decoder.begin(op_frame);
+		}
+		void await_suspend(std::coroutine_handle<> handle) {
+			decoder.waiter_ = handle;
+		}
+		frame_handle await_resume() {
+			return decoder.take_frame();
+		}
+	};
+
+	frame_awaiter next_frame() {
+		// The previous frame would be overwritten under its handle
+		assert(!frame_out_);
+		return frame_awaiter{*this};
+	}
+
+
+	// co_await decoder.next_audio(count) -> audio_block of `count` samples
+	// per channel, or fewer at the end of the stream.
+
+	struct audio_awaiter {
+		async_decoder &decoder;
+
+		bool await_ready() {
+			return decoder.begin(op_audio);
+		}
+		void await_suspend(std::coroutine_handle<> handle) {
+			decoder.waiter_ = handle;
+		}
+		audio_block await_resume() {
+			return decoder.take_audio();
+		}
+	};
+
+	audio_awaiter next_audio(size_t count) {
+		audio_wanted_ = count;
+		audio_have_ = 0;
+		audio_time_ = 0;
+		if (audio_.size() < count * 2) {
+			audio_.resize(count * 2);
+		}
+		return audio_awaiter{*this};
+	}
+
+private:
+	friend class frame_handle;
+
+	enum op_t { op_none, op_frame, op_audio };
+
+	static void on_underflow(plm_buffer_t *buffer, void *user) {
+		PLM_UNUSED(buffer);
+		static_cast<async_decoder *>(user)->request_read();
+	}
+
+	void request_read() {
+		if (read_pending_ || ended_ || !read_callback_) {
+			return;
+		}
+		read_pending_ = true;
+		read_callback_(*this, read_size_, read_callback_user_);
+	}
+
+	// Start an operation; TRUE if it's already complete
+	bool begin(op_t op) {
+		assert(op_ == op_none && !waiter_);
+		op_ = op;
+		return advance();
+	}
+
+	// Step until the operation completes or has to wait for a read. A read
+	// callback that feeds right away keeps it going without suspending.
+	bool advance() {
+		busy_ = true;
+		bool done;
+		while (!(done = step())) {
+			unsigned fed = fed_;
+			request_read();
+			if (fed_ == fed) {
+				break;
+			}
+		}
+		busy_ = false;
+		return done;
+	}
+
+	// Decode as far as the buffered data allows; TRUE once the operation
+	// is complete or the stream has ended
+	bool step() {
+		if (!plm_) {
+			return true;
+		}
+		if (op_ == op_frame) {
+			frame_ = plm_decode_video(plm_);
+			return frame_ || plm_has_ended(plm_);
+		}
+
+		while (audio_have_ < audio_wanted_) {
+			if (!samples_left_) {
+				plm_samples_t *samples = plm_decode_audio(plm_);
+				if (!samples) {
+					return plm_has_ended(plm_);
+				}
+				samples_ = samples;
+				samples_left_ = samples->count;
+			}
+
+			size_t offset = samples_->count - samples_left_;
+			size_t n = std::min(samples_left_, audio_wanted_ - audio_have_);
+			if (audio_have_ == 0) {
+				audio_time_ = samples_->time + (double)offset / plm_get_samplerate(plm_);
+			}
+			std::memcpy(&audio_[audio_have_ * 2], &samples_->pcm[offset * 2], n * 2 * sizeof(short));
+			audio_have_ += n;
+			samples_left_ -= n;
+		}
+		return true;
+	}
+
+	// After a feed(): resume the waiting coroutine if it can go on. Feeds
+	// from inside advance() are picked up by its loop instead.
+	void retry() {
+		if (!waiter_ || busy_ || !advance()) {
+			return;
+		}
+		std::coroutine_handle<> handle = std::exchange(waiter_, nullptr);
+		if (resume_callback_) {
+			resume_callback_(handle, resume_callback_user_);
+		}
+		else {
+			handle.resume();
+		}
+	}
+
+	frame_handle take_frame() {
+		op_ = op_none;
+		if (!frame_) {
+			return frame_handle();
+		}
+		frame_out_ = true;
+		return frame_handle(this, std::exchange(frame_, nullptr));
+	}
+
+	audio_block take_audio() {
+		op_ = op_none;
+		return audio_block(audio_.data(), audio_have_, audio_time_);
+	}
+
+	plm_t *plm_ = nullptr;
+	plm_buffer_t *source_ = nullptr;
+	size_t read_size_ = 16 * 1024;
+	bool read_pending_ = false;
+	bool ended_ = false;
+	bool busy_ = false;
+	unsigned fed_ = 0;
+
+	read_callback read_callback_ = nullptr;
+	void *read_callback_user_ = nullptr;
+	resume_callback resume_callback_ = nullptr;
+	void *resume_callback_user_ = nullptr;
+
+	op_t op_ = op_none;
+	std::coroutine_handle<> waiter_;
+
+	plm_frame_t *frame_ = nullptr;
+	bool frame_out_ = false;
+
+	std::vector<short> audio_;
+	size_t audio_wanted_ = 0;
+	size_t audio_have_ = 0;
+	double audio_time_ = 0;
+	plm_samples_t *samples_ = nullptr;
+	size_t samples_left_ = 0;
+};
+
+inline void frame_handle::release() {
+	if (decoder_) {
+		decoder_->frame_out_ = false;
+		decoder_ = nullptr;
+	}
+	frame_ = nullptr;
+}
+
+
+// Minimal fire-and-forget coroutine type for the synopsis above. It starts
+// right away and frees itself when done. Any task type of your own works as
+// well; the awaiters don't depend on it.
+
+struct task {
+	struct promise_type {
+		task get_return_object() { return {}; }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+} // namespace plm
+
+#endif // PL_MPEG_CORO_HPP
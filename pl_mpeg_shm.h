@@ -0,0 +1,616 @@
+/*
+PL_MPEG_SHM - Publish decoded frames and PCM through POSIX shared memory
+SPDX-License-Identifier: MIT
+
+
+-- Synopsis
+
+// Define `PL_MPEG_SHM_IMPLEMENTATION` in *one* C/C++ file before including
+// this library to create the implementation. pl_mpeg.h must be included first.
+
+// Decoder process
+plm_t *plm = plm_create_with_filename("some-file.mpg");
+plm_has_headers(plm);
+plm_shm_writer_t *shm = plm_shm_writer_create("/my-video", plm, 8, 64);
+plm_set_video_decode_callback(plm, plm_shm_video_callback, shm);
+plm_set_audio_decode_callback(plm, plm_shm_audio_callback, shm);
+do {
+	plm_decode(plm, time_since_last_call);
+} while (!plm_has_ended(plm));
+plm_shm_writer_end(shm);
+...
+plm_shm_writer_destroy(shm);
+
+// Any number of reader processes
+plm_shm_reader_t *reader = plm_shm_reader_open("/my-video");
+plm_frame_t frame;
+while (!plm_shm_reader_has_ended(reader)) {
+	if (plm_shm_reader_next_frame(reader, &frame)) {
+		// Use frame.y.data, frame.cr.data, frame.cb.data in place, then
+		// throw away what you did if the writer overwrote it meanwhile
+		if (plm_shm_reader_frame_is_valid(reader)) {
+			...
+		}
+	}
+}
+plm_shm_reader_close(reader);
+
+
+-- Documentation
+
+The writer creates a shared memory object with a fixed number of frame slots
+and audio slots. Each slot holds one frame (the Y, Cr and Cb planes) or one
+plm_samples_t worth of PCM, together with its timestamp and sequence number.
+Frames and audio frames are numbered from 0 in the order they're published.
+
+The writer never waits for readers. Once all slots are used, it overwrites
+the oldest one. Readers never write to the shared memory, so any number of
+them can attach and detach at any time without the writer noticing.
+
+Every slot is protected by a sequence lock. The writer marks the slot as
+being written, fills it, then publishes it under its new sequence number.
+A reader looks at the slot before and after reading; if the sequence
+changed, the data may be torn and must be discarded.
+
+plm_shm_reader_next_frame() hands out the planes in place, without copying.
+Check plm_shm_reader_frame_is_valid() *after* you're done with them. A reader
+that keeps up with the writer never sees an invalid frame; one that falls
+more than the number of slots behind skips ahead to the oldest frame still
+in the ring. Enough slots for the time a reader holds on to a frame keep the
+writer off its slot. plm_shm_reader_next_samples() copies the PCM out and
+only returns samples that passed the check.
+
+Readers poll; there is no wakeup. Compare the frame times against a clock to
+pace them, as you would with plm_decode().
+
+This is a host feature for Linux and other POSIX systems; it is not available
+on Dreamcast. Older glibc versions need -lrt for shm_open().
+
+*/
+
+#ifndef PL_MPEG_SHM_H
+#define PL_MPEG_SHM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct plm_shm_writer_t plm_shm_writer_t;
+typedef struct plm_shm_reader_t plm_shm_reader_t;
+
+
+// Create a shared memory object `name` (see shm_open(), e.g. "/my-video") for
+// the streams of plm, which must have its headers. Replaces an existing object
+// of the same name. Frames are published from their planes, so this turns on
+// plm_set_video_fill_planes() for plm. Returns NULL on error.
+
+plm_shm_writer_t *plm_shm_writer_create(const char *name, plm_t *plm, int frame_slots, int audio_slots);
+
+
+// Unmap and remove the shared memory object. Attached readers keep their
+// mapping until they close it.
+
+void plm_shm_writer_destroy(plm_shm_writer_t *self);
+
+
+// Publish a decoded frame or audio frame. The frame must match the size the
+// writer was created for, and its planes must be filled, as they are for
+// frames of the plm_t it was created for.
+
+void plm_shm_write_frame(plm_shm_writer_t *self, plm_frame_t *frame);
+void plm_shm_write_samples(plm_shm_writer_t *self, plm_samples_t *samples);
+
+
+// Tell readers that nothing more will be published.
+
+void plm_shm_writer_end(plm_shm_writer_t *self);
+
+
+// Decode callbacks that publish everything plm_decode() produces. Pass the
+// writer as user data.
+
+void plm_shm_video_callback(plm_t *plm, plm_frame_t *frame, void *user);
+void plm_shm_audio_callback(plm_t *plm, plm_samples_t *samples, void *user);
+
+
+// Attach to the shared memory object `name` as a reader. Returns NULL if it
+// doesn't exist (yet) or is not a frame ring.
+
+plm_shm_reader_t *plm_shm_reader_open(const char *name);
+
+
+// Detach from the shared memory object.
+
+void plm_shm_reader_close(plm_shm_reader_t *self);
+
+
+// Get the stream properties the writer published.
+
+int plm_shm_reader_get_width(plm_shm_reader_t *self);
+int plm_shm_reader_get_height(plm_shm_reader_t *self);
+double plm_shm_reader_get_framerate(plm_shm_reader_t *self);
+int plm_shm_reader_get_samplerate(plm_shm_reader_t *self);
+
+
+// Get the next frame this reader hasn't seen. Fills in frame with pointers
+// into the shared memory. Returns FALSE if no new frame has been published.
+// The frame's display pointer is NULL.
+
+int plm_shm_reader_next_frame(plm_shm_reader_t *self, plm_frame_t *frame);
+
+
+// Check whether the frame last returned by plm_shm_reader_next_frame() is
+// still intact, i.e. the writer has not started to overwrite it.
+
+int plm_shm_reader_frame_is_valid(plm_shm_reader_t *self);
+
+
+// Get the sequence number of the frame last returned, and how many frames
+// this reader skipped because it fell behind.
+
+uint64_t plm_shm_reader_get_frame_sequence(plm_shm_reader_t *self);
+uint64_t plm_shm_reader_get_frames_skipped(plm_shm_reader_t *self);
+
+
+// Copy the next audio frame this reader hasn't seen into samples. Returns
+// FALSE if no new audio frame has been published.
+
+int plm_shm_reader_next_samples(plm_shm_reader_t *self, plm_samples_t *samples);
+
+
+// Get whether the writer has ended and this reader has seen all frames and
+// audio frames still in the ring.
+
+int plm_shm_reader_has_ended(plm_shm_reader_t *self);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif // PL_MPEG_SHM_H
+
+
+
+// -----------------------------------------------------------------------------
+// -----------------------------------------------------------------------------
+// IMPLEMENTATION
+
+#ifdef PL_MPEG_SHM_IMPLEMENTATION
+
+#ifdef _arch_dreamcast
+	#error "pl_mpeg_shm.h needs POSIX shared memory; it is a host-only feature"
+#endif
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define PLM_SHM_MAGIC 0x534d4c50 // "PLMS"
+#define PLM_SHM_VERSION 1
+#define PLM_SHM_ALIGN 64
+
+#define PLM_SHM_LOAD(p) __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define PLM_SHM_STORE(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+
+// Shared layout. The header is followed by the frame slots, then the audio
+// slots; each slot starts with a plm_shm_slot_t. All offsets are from the
+// start of the mapping and PLM_SHM_ALIGN aligned.
+
+typedef struct {
+	uint32_t magic;             // Stored last, once the layout is complete
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t luma_width;
+	uint32_t luma_height;
+	double framerate;
+	uint32_t samplerate;
+	uint32_t ended;
+
+	uint32_t frame_slots;
+	uint32_t audio_slots;
+	uint64_t frame_slot_size;
+	uint64_t audio_slot_size;
+	uint64_t frame_offset;
+	uint64_t audio_offset;
+	uint64_t size;
+
+	uint64_t frame_head;        // Frames published so far
+	uint64_t audio_head;        // Audio frames published so far
+} plm_shm_header_t;
+
+// Sequence lock: 2 * sequence + 1 while the slot is being written for that
+// sequence, 2 * sequence + 2 once it's published; 0 if never written.
+
+typedef struct {
+	uint64_t lock;
+	double time;
+	uint32_t count;
+} plm_shm_slot_t;
+
+#define PLM_SHM_SLOT_HEADER_SIZE \
+	((sizeof(plm_shm_slot_t) + PLM_SHM_ALIGN - 1) & ~(uint64_t)(PLM_SHM_ALIGN - 1))
+
+#define PLM_SHM_PCM_SIZE (PLM_AUDIO_SAMPLES_PER_FRAME * 2 * sizeof(short))
+
+struct plm_shm_writer_t {
+	char *name;
+	uint8_t *base;
+	plm_shm_header_t *header;
+	size_t luma_size;
+	size_t chroma_size;
+};
+
+struct plm_shm_reader_t {
+	uint8_t *base;
+	size_t size;
+	plm_shm_header_t *header;
+	size_t luma_size;
+	size_t chroma_size;
+
+	uint64_t frame_next;
+	uint64_t frame_lock;        // Lock value of the frame last returned
+	plm_shm_slot_t *frame_slot;
+	uint64_t frames_skipped;
+
+	uint64_t audio_next;
+};
+
+static inline uint64_t plm_shm_align(uint64_t size) {
+	return (size + PLM_SHM_ALIGN - 1) & ~(uint64_t)(PLM_SHM_ALIGN - 1);
+}
+
+static inline plm_shm_slot_t *plm_shm_frame_slot(uint8_t *base, plm_shm_header_t *header, uint64_t seq) {
+	return (plm_shm_slot_t *)(base + header->frame_offset + (seq % header->frame_slots) * header->frame_slot_size);
+}
+
+static inline plm_shm_slot_t *plm_shm_audio_slot(uint8_t *base, plm_shm_header_t *header, uint64_t seq) {
+	return (plm_shm_slot_t *)(base + header->audio_offset + (seq % header->audio_slots) * header->audio_slot_size);
+}
+
+static void plm_shm_slot_begin(plm_shm_slot_t *slot, uint64_t seq) {
+	PLM_SHM_STORE(&slot->lock, seq * 2 + 1);
+	// The odd lock must be visible before any of the data changes
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+}
+
+// The oldest sequence a reader at `next` can still get, given `head`
+static inline uint64_t plm_shm_oldest(uint64_t next, uint64_t head, uint32_t slots) {
+	// The slot of head - slots may already be being overwritten by head
+	uint64_t oldest = head > slots - 1 ? head - (slots - 1) : 0;
+	return next < oldest ? oldest : next;
+}
+
+plm_shm_writer_t *plm_shm_writer_create(const char *name, plm_t *plm, int frame_slots, int audio_slots) {
+	if (!name || !plm || !plm_has_headers(plm) || frame_slots < 2 || audio_slots < 2) {
+		return NULL;
+	}
+
+	plm_shm_writer_t *self = (plm_shm_writer_t *)calloc(1, sizeof(plm_shm_writer_t));
+	if (!self) {
+		return NULL;
+	}
+	self->name = strdup(name);
+	if (!self->name) {
+		free(self);
+		return NULL;
+	}
+
+	unsigned int width = plm_get_width(plm);
+	unsigned int height = plm_get_height(plm);
+	unsigned int luma_width = (width + 15) & ~15u;
+	unsigned int luma_height = (height + 15) & ~15u;
+	self->luma_size = (size_t)luma_width * luma_height;
+	self->chroma_size = self->luma_size / 4;
+
+	int has_video = plm_get_num_video_streams(plm) > 0;
+	int has_audio = plm_get_num_audio_streams(plm) > 0;
+	if (!has_video) {
+		frame_slots = 0;
+	}
+	if (!has_audio) {
+		audio_slots = 0;
+	}
+
+	uint64_t frame_slot_size = plm_shm_align(PLM_SHM_SLOT_HEADER_SIZE + self->luma_size + self->chroma_size * 2);
+	uint64_t audio_slot_size = plm_shm_align(PLM_SHM_SLOT_HEADER_SIZE + PLM_SHM_PCM_SIZE);
+	uint64_t frame_offset = plm_shm_align(sizeof(plm_shm_header_t));
+	uint64_t audio_offset = frame_offset + frame_slot_size * frame_slots;
+	uint64_t size = audio_offset + audio_slot_size * audio_slots;
+
+	// Start from a fresh object; readers of an old one keep their mapping
+	shm_unlink(name);
+	int fd = shm_open(name, O_CREAT | O_EXCL | O_RDWR, 0644);
+	if (fd < 0) {
+		fprintf(stderr, "Can not create shared memory: %s\n", name);
+		free(self->name);
+		free(self);
+		return NULL;
+	}
+	if (ftruncate(fd, (off_t)size) != 0) {
+		close(fd);
+		shm_unlink(name);
+		free(self->name);
+		free(self);
+		return NULL;
+	}
+
+	void *base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		shm_unlink(name);
+		free(self->name);
+		free(self);
+		return NULL;
+	}
+
+	// ftruncate() zero-filled everything: heads and slot locks start at 0
+	self->base = (uint8_t *)base;
+	self->header = (plm_shm_header_t *)base;
+	self->header->version = PLM_SHM_VERSION;
+	self->header->width = width;
+	self->header->height = height;
+	self->header->luma_width = luma_width;
+	self->header->luma_height = luma_height;
+	self->header->framerate = plm_get_framerate(plm);
+	self->header->samplerate = has_audio ? plm_get_samplerate(plm) : 0;
+	self->header->frame_slots = frame_slots;
+	self->header->audio_slots = audio_slots;
+	self->header->frame_slot_size = frame_slot_size;
+	self->header->audio_slot_size = audio_slot_size;
+	self->header->frame_offset = frame_offset;
+	self->header->audio_offset = audio_offset;
+	self->header->size = size;
+	PLM_SHM_STORE(&self->header->magic, PLM_SHM_MAGIC);
+
+	// B- and D-pictures only reach the planes with this
+	plm_set_video_fill_planes(plm, TRUE);
+
+	return self;
+}
+
+void plm_shm_writer_destroy(plm_shm_writer_t *self) {
+	if (!self) {
+		return;
+	}
+	munmap(self->base, self->header->size);
+	shm_unlink(self->name);
+	free(self->name);
+	free(self);
+}
+
+void plm_shm_write_frame(plm_shm_writer_t *self, plm_frame_t *frame) {
+	plm_shm_header_t *header = self->header;
+	if (
+		!header->frame_slots ||
+		frame->y.width * frame->y.height != self->luma_size ||
+		frame->cr.width * frame->cr.height != self->chroma_size
+	) {
+		return;
+	}
+
+	uint64_t seq = header->frame_head;
+	plm_shm_slot_t *slot = plm_shm_frame_slot(self->base, header, seq);
+	uint8_t *planes = (uint8_t *)slot + PLM_SHM_SLOT_HEADER_SIZE;
+
+	plm_shm_slot_begin(slot, seq);
+	slot->time = frame->time;
+	memcpy(planes, frame->y.data, self->luma_size);
+	memcpy(planes + self->luma_size, frame->cr.data, self->chroma_size);
+	memcpy(planes + self->luma_size + self->chroma_size, frame->cb.data, self->chroma_size);
+	PLM_SHM_STORE(&slot->lock, seq * 2 + 2);
+	PLM_SHM_STORE(&header->frame_head, seq + 1);
+}
+
+void plm_shm_write_samples(plm_shm_writer_t *self, plm_samples_t *samples) {
+	plm_shm_header_t *header = self->header;
+	if (!header->audio_slots) {
+		return;
+	}
+
+	uint64_t seq = header->audio_head;
+	plm_shm_slot_t *slot = plm_shm_audio_slot(self->base, header, seq);
+
+	plm_shm_slot_begin(slot, seq);
+	slot->time = samples->time;
+	slot->count = samples->count;
+	memcpy((uint8_t *)slot + PLM_SHM_SLOT_HEADER_SIZE, samples->pcm, PLM_SHM_PCM_SIZE);
+	PLM_SHM_STORE(&slot->lock, seq * 2 + 2);
+	PLM_SHM_STORE(&header->audio_head, seq + 1);
+}
+
+void plm_shm_writer_end(plm_shm_writer_t *self) {
+	PLM_SHM_STORE(&self->header->ended, 1);
+}
+
+void plm_shm_video_callback(plm_t *plm, plm_frame_t *frame, void *user) {
+	PLM_UNUSED(plm);
+	plm_shm_write_frame((plm_shm_writer_t *)user, frame);
+}
+
+void plm_shm_audio_callback(plm_t *plm, plm_samples_t *samples, void *user) {
+	PLM_UNUSED(plm);
+	plm_shm_write_samples((plm_shm_writer_t *)user, samples);
+}
+
+plm_shm_reader_t *plm_shm_reader_open(const char *name) {
+	int fd = shm_open(name, O_RDONLY, 0);
+	if (fd < 0) {
+		return NULL;
+	}
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || (size_t)st.st_size < sizeof(plm_shm_header_t)) {
+		close(fd);
+		return NULL;
+	}
+
+	void *base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (base == MAP_FAILED) {
+		return NULL;
+	}
+
+	plm_shm_header_t *header = (plm_shm_header_t *)base;
+	if (
+		PLM_SHM_LOAD(&header->magic) != PLM_SHM_MAGIC ||
+		header->version != PLM_SHM_VERSION ||
+		header->size != (uint64_t)st.st_size
+	) {
+		munmap(base, st.st_size);
+		return NULL;
+	}
+
+	plm_shm_reader_t *self = (plm_shm_reader_t *)calloc(1, sizeof(plm_shm_reader_t));
+	if (!self) {
+		munmap(base, st.st_size);
+		return NULL;
+	}
+	self->base = (uint8_t *)base;
+	self->size = st.st_size;
+	self->header = header;
+	self->luma_size = (size_t)header->luma_width * header->luma_height;
+	self->chroma_size = self->luma_size / 4;
+
+	// Start with the oldest frames still in the ring
+	self->frame_next = plm_shm_oldest(0, PLM_SHM_LOAD(&header->frame_head), header->frame_slots);
+	self->audio_next = plm_shm_oldest(0, PLM_SHM_LOAD(&header->audio_head), header->audio_slots);
+	return self;
+}
+
+void plm_shm_reader_close(plm_shm_reader_t *self) {
+	if (!self) {
+		return;
+	}
+	munmap(self->base, self->size);
+	free(self);
+}
+
+int plm_shm_reader_get_width(plm_shm_reader_t *self) {
+	return self->header->width;
+}
+
+int plm_shm_reader_get_height(plm_shm_reader_t *self) {
+	return self->header->height;
+}
+
+double plm_shm_reader_get_framerate(plm_shm_reader_t *self) {
+	return self->header->framerate;
+}
+
+int plm_shm_reader_get_samplerate(plm_shm_reader_t *self) {
+	return self->header->samplerate;
+}
+
+int plm_shm_reader_next_frame(plm_shm_reader_t *self, plm_frame_t *frame) {
+	plm_shm_header_t *header = self->header;
+	if (!header->frame_slots) {
+		return FALSE;
+	}
+
+	while (TRUE) {
+		uint64_t head = PLM_SHM_LOAD(&header->frame_head);
+		uint64_t next = plm_shm_oldest(self->frame_next, head, header->frame_slots);
+		if (next >= head) {
+			return FALSE;
+		}
+		self->frames_skipped += next - self->frame_next;
+		self->frame_next = next;
+
+		plm_shm_slot_t *slot = plm_shm_frame_slot(self->base, header, next);
+		uint64_t lock = PLM_SHM_LOAD(&slot->lock);
+		if (lock != next * 2 + 2) {
+			// Overwritten since we read the head; catch up and try again
+			self->frame_next++;
+			self->frames_skipped++;
+			continue;
+		}
+
+		uint8_t *planes = (uint8_t *)slot + PLM_SHM_SLOT_HEADER_SIZE;
+		frame->time = slot->time;
+		frame->width = header->width;
+		frame->height = header->height;
+		frame->y.width = header->luma_width;
+		frame->y.height = header->luma_height;
+		frame->y.data = planes;
+		frame->cr.width = header->luma_width / 2;
+		frame->cr.height = header->luma_height / 2;
+		frame->cr.data = planes + self->luma_size;
+		frame->cb.width = header->luma_width / 2;
+		frame->cb.height = header->luma_height / 2;
+		frame->cb.data = planes + self->luma_size + self->chroma_size;
+		frame->display = NULL;
+
+		self->frame_slot = slot;
+		self->frame_lock = lock;
+		self->frame_next = next + 1;
+		return TRUE;
+	}
+}
+
+int plm_shm_reader_frame_is_valid(plm_shm_reader_t *self) {
+	if (!self->frame_slot) {
+		return FALSE;
+	}
+	// All reads of the frame data must happen before the lock is checked again
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	return __atomic_load_n(&self->frame_slot->lock, __ATOMIC_RELAXED) == self->frame_lock;
+}
+
+uint64_t plm_shm_reader_get_frame_sequence(plm_shm_reader_t *self) {
+	return self->frame_lock ? self->frame_lock / 2 - 1 : 0;
+}
+
+uint64_t plm_shm_reader_get_frames_skipped(plm_shm_reader_t *self) {
+	return self->frames_skipped;
+}
+
+int plm_shm_reader_next_samples(plm_shm_reader_t *self, plm_samples_t *samples) {
+	plm_shm_header_t *header = self->header;
+	if (!header->audio_slots) {
+		return FALSE;
+	}
+
+	while (TRUE) {
+		uint64_t head = PLM_SHM_LOAD(&header->audio_head);
+		uint64_t next = plm_shm_oldest(self->audio_next, head, header->audio_slots);
+		if (next >= head) {
+			return FALSE;
+		}
+		self->audio_next = next + 1;
+
+		plm_shm_slot_t *slot = plm_shm_audio_slot(self->base, header, next);
+		uint64_t lock = PLM_SHM_LOAD(&slot->lock);
+		if (lock != next * 2 + 2) {
+			continue;
+		}
+
+		samples->time = slot->time;
+		samples->count = slot->count;
+		memcpy(samples->pcm, (uint8_t *)slot + PLM_SHM_SLOT_HEADER_SIZE, PLM_SHM_PCM_SIZE);
+
+		__atomic_thread_fence(__ATOMIC_SEQ_CST);
+		if (__atomic_load_n(&slot->lock, __ATOMIC_RELAXED) == lock) {
+			return TRUE;
+		}
+	}
+}
+
+int plm_shm_reader_has_ended(plm_shm_reader_t *self) {
+	plm_shm_header_t *header = self->header;
+	if (!PLM_SHM_LOAD(&header->ended)) {
+		return FALSE;
+	}
+	return
+		(!header->frame_slots || self->frame_next >= PLM_SHM_LOAD(&header->frame_head)) &&
+		(!header->audio_slots || self->audio_next >= PLM_SHM_LOAD(&header->audio_head));
+}
+
+#endif // PL_MPEG_SHM_IMPLEMENTATION
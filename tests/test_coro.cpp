@@ -0,0 +1,135 @@
+/**
+ * \file test_coro.cpp
+ * \brief Host test of the frames and audio of pl_mpeg_coro.hpp
+ *
+ * Feeds the sample clip to an async_decoder in 16 KiB reads that complete
+ * later, like asynchronous I/O would, and awaits every frame in one coroutine
+ * and the audio in another. Every frame handle must hold the frame in its
+ * planes as well as in its display buffer, including B-pictures, which must
+ * also differ from the frame before them.
+ */
+
+#include "../pl_mpeg_coro.hpp"
+#include "test_planes.h"
+
+#include <cstdio>
+
+#define SAMPLE "../romdisk/sample.mpg"
+
+static int failures;
+
+static void check(bool ok, const char *what) {
+    if(!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+struct reader_t {
+    FILE *file = nullptr;
+    bool pending = false;
+    int reads = 0;
+};
+
+/* Complete the outstanding read */
+static void complete_read(plm::async_decoder &decoder, reader_t &reader) {
+    static char buffer[16 * 1024];
+    size_t length = fread(buffer, 1, sizeof(buffer), reader.file);
+
+    reader.pending = false;
+    if(length)
+        decoder.feed(buffer, length);
+    else
+        decoder.feed_end();
+}
+
+struct result_t {
+    bool done = false;
+    int frames = 0;
+    int stale = 0;
+    int repeated = 0;
+    size_t samples = 0;
+};
+
+static plm::task play_video(plm::async_decoder &decoder, result_t &result) {
+    std::vector<uint8_t> previous;
+
+    while(plm::frame_handle frame = co_await decoder.next_frame()) {
+        size_t size = frame->y.width * frame->y.height;
+
+        result.frames++;
+        if(!planes_match_display(frame.get(), frame->display))
+            result.stale++;
+        if(previous.size() == size && !memcmp(previous.data(), frame->y.data, size))
+            result.repeated++;
+        previous.assign(frame->y.data, frame->y.data + size);
+    }
+    result.done = true;
+}
+
+static plm::task play_audio(plm::async_decoder &decoder, result_t &result) {
+    while(plm::audio_block audio = co_await decoder.next_audio(1024))
+        result.samples += audio.size();
+    result.done = true;
+}
+
+/* Decode one stream of the sample, reading whenever the decoder asks */
+static result_t decode(bool video) {
+    plm::async_decoder decoder;
+    reader_t reader;
+    result_t result;
+
+    reader.file = fopen(SAMPLE, "rb");
+    if(!reader.file || !decoder.get()) {
+        check(false, "couldn't open " SAMPLE);
+        if(reader.file)
+            fclose(reader.file);
+        return result;
+    }
+
+    plm_set_video_enabled(decoder.get(), video);
+    plm_set_audio_enabled(decoder.get(), !video);
+    decoder.set_read_callback([](plm::async_decoder &, size_t, void *user) {
+        reader_t *reader = static_cast<reader_t *>(user);
+        reader->pending = true;
+        reader->reads++;
+    }, &reader);
+
+    if(video)
+        play_video(decoder, result);
+    else
+        play_audio(decoder, result);
+
+    while(!result.done) {
+        if(!reader.pending) {
+            check(false, "a coroutine waits without a read outstanding");
+            break;
+        }
+        complete_read(decoder, reader);
+    }
+
+    fclose(reader.file);
+    check(reader.reads > 1, "the decoder never waited for a read");
+    return result;
+}
+
+int main(void) {
+    result_t video = decode(true);
+    printf("%d frames, %d with stale planes, %d repeating the one before\n",
+           video.frames, video.stale, video.repeated);
+    check(video.frames > 0, "no frames decoded");
+    check(video.stale == 0, "a frame's planes don't match its display buffer");
+    check(video.repeated == 0, "a frame repeated the one before it");
+
+    result_t audio = decode(false);
+    printf("%zu samples per channel\n", audio.samples);
+    check(audio.samples > 0, "no audio decoded");
+
+    if(failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+
+    printf("coroutine frames ok\n");
+    return 0;
+}
@@ -0,0 +1,73 @@
+/**
+ * \file test_fill_planes.c
+ * \brief Host test of the Y/Cb/Cr planes against the display buffer
+ *
+ * Decodes the sample clip and compares the planes of every returned frame
+ * with its display buffer, which holds each frame in macroblock order. By
+ * default only reference pictures are written to the planes, so those of
+ * B-pictures hold an older frame; with plm_set_video_fill_planes() every
+ * frame's planes must match its display buffer.
+ */
+
+#include "../mpeg.c"
+#include "test_planes.h"
+
+#include <stdio.h>
+
+#define SAMPLE "../romdisk/sample.mpg"
+
+static int failures;
+
+static void check(int ok, const char *what) {
+    if(!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+/* Decode the whole clip; returns the frames whose planes didn't match */
+static int decode(int fill, int *frames) {
+    plm_t *plm = plm_create_with_filename(SAMPLE);
+    plm_frame_t *frame;
+    int stale = 0;
+
+    *frames = 0;
+    if(!plm) {
+        check(0, "couldn't open " SAMPLE);
+        return 0;
+    }
+
+    plm_set_audio_enabled(plm, FALSE);
+    plm_set_video_fill_planes(plm, fill);
+
+    while((frame = plm_decode_video(plm))) {
+        (*frames)++;
+        if(!planes_match_display(frame, frame->display))
+            stale++;
+    }
+
+    plm_destroy(plm);
+    return stale;
+}
+
+int main(void) {
+    int frames, stale;
+
+    stale = decode(FALSE, &frames);
+    printf("planes only for references: %d of %d frames stale\n", stale, frames);
+    check(frames > 0, "no frames decoded");
+    check(stale > 0 && stale < frames, "only B-pictures should leave the planes stale");
+
+    stale = decode(TRUE, &frames);
+    printf("planes for every picture: %d of %d frames stale\n", stale, frames);
+    check(frames > 0, "no frames decoded");
+    check(stale == 0, "a frame's planes don't match its display buffer");
+
+    if(failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+
+    printf("fill planes ok\n");
+    return 0;
+}
@@ -0,0 +1,45 @@
+/**
+ * \file test_planes.h
+ * \brief Compare Y/Cb/Cr planes with a display buffer, for the host tests
+ */
+
+#ifndef TEST_PLANES_H
+#define TEST_PLANES_H
+
+#include <stdint.h>
+#include <string.h>
+
+/* Whether the planes of `frame` hold the picture in `display`. Per macroblock
+   the display buffer has 8x8 blocks of Cb, Cr and the four of Y, each 64
+   bytes. */
+static inline int planes_match_display(const plm_frame_t *frame, const uint32_t *display) {
+    int mb_width = frame->y.width / 16;
+    int mb_height = frame->y.height / 16;
+    const uint8_t *bytes = (const uint8_t *)display;
+
+    for(int row = 0; row < mb_height; row++)
+        for(int col = 0; col < mb_width; col++) {
+            const uint8_t *mb = bytes + (row * mb_width + col) * 384;
+
+            for(int y = 0; y < 8; y++) {
+                size_t chroma = (row * 8 + y) * frame->cb.width + col * 8;
+
+                if(memcmp(frame->cb.data + chroma, mb + y * 8, 8) ||
+                   memcmp(frame->cr.data + chroma, mb + 64 + y * 8, 8))
+                    return 0;
+            }
+
+            for(int y = 0; y < 16; y++) {
+                const uint8_t *block = mb + 128 + (y >> 3) * 128 + (y & 7) * 8;
+                size_t luma = (row * 16 + y) * frame->y.width + col * 16;
+
+                if(memcmp(frame->y.data + luma, block, 8) ||
+                   memcmp(frame->y.data + luma + 8, block + 64, 8))
+                    return 0;
+            }
+        }
+
+    return 1;
+}
+
+#endif
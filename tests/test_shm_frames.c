@@ -0,0 +1,99 @@
+/**
+ * \file test_shm_frames.c
+ * \brief Host test of the frames published through pl_mpeg_shm.h
+ *
+ * Decodes the sample clip into a shared memory writer and reads each frame
+ * back right after it is published. Every published frame must hold the
+ * picture just decoded, including B-pictures, whose planes the decoder only
+ * fills because the writer asks it to; each B-picture must also differ from
+ * the frame published before it.
+ */
+
+#include "../mpeg.c"
+#include "test_planes.h"
+
+#define PL_MPEG_SHM_IMPLEMENTATION
+#include "../pl_mpeg_shm.h"
+
+#include <stdio.h>
+#include <unistd.h>
+
+#define SAMPLE "../romdisk/sample.mpg"
+
+static int failures;
+
+static void check(int ok, const char *what) {
+    if(!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+int main(void) {
+    char name[64];
+    plm_t *plm = plm_create_with_filename(SAMPLE);
+    plm_shm_writer_t *writer = NULL;
+    plm_shm_reader_t *reader = NULL;
+    uint8_t *previous = NULL;
+    size_t size = 0;
+    int frames = 0, b_pictures = 0;
+
+    snprintf(name, sizeof(name), "/plm-test-%d", (int)getpid());
+
+    if(!plm || !plm_has_headers(plm)) {
+        check(0, "couldn't open " SAMPLE);
+        goto finish;
+    }
+    plm_set_audio_enabled(plm, FALSE);
+
+    writer = plm_shm_writer_create(name, plm, 4, 4);
+    reader = writer ? plm_shm_reader_open(name) : NULL;
+    if(!writer || !reader) {
+        check(0, "couldn't create the shared memory");
+        goto finish;
+    }
+
+    plm_frame_t *decoded, published;
+    while((decoded = plm_decode_video(plm))) {
+        int is_b = plm->video_decoder->picture_type == PLM_VIDEO_PICTURE_TYPE_B;
+
+        plm_shm_write_frame(writer, decoded);
+        frames++;
+
+        if(!plm_shm_reader_next_frame(reader, &published)) {
+            check(0, "a frame wasn't published");
+            break;
+        }
+        check(planes_match_display(&published, decoded->display),
+              "a published frame isn't the picture decoded");
+
+        size = published.y.width * published.y.height * 3 / 2;
+        if(is_b) {
+            b_pictures++;
+            check(previous && memcmp(previous, published.y.data, size),
+                  "a B-picture was published as the frame before it");
+        }
+
+        if(!previous)
+            previous = malloc(size);
+        memcpy(previous, published.y.data, size);
+        check(plm_shm_reader_frame_is_valid(reader), "a frame was overwritten while read");
+    }
+
+    printf("%d frames published, %d of them B-pictures\n", frames, b_pictures);
+    check(b_pictures > 0, "the sample has no B-pictures to check");
+
+finish:
+    free(previous);
+    plm_shm_reader_close(reader);
+    plm_shm_writer_destroy(writer);
+    plm_destroy(plm);
+
+    if(failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+
+    printf("shm frames ok\n");
+    return 0;
+}
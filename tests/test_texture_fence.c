@@ -0,0 +1,259 @@
+/**
+ * \file test_texture_fence.c
+ * \brief Host test of the texture fences against a mocked PVR
+ *
+ * The fence helpers in mpeg.c only work on the frame counts and times they
+ * are given, so this includes mpeg.c and drives them from a mock of the PVR
+ * pipeline instead of pvr_get_stats(). The mock renders each submitted scene
+ * once the one before it has been flipped and flips it on the next vertical
+ * blank, counting flips like the PVR's frame_count. A new scene can only
+ * begin once the previous one has started rendering, as with pvr_wait_ready().
+ *
+ * It checks that no upload overwrites a texture before every scene that drew
+ * it has been rendered, that the player's own scenes are fenced on their
+ * exact flip, so with two textures an upload never waits for the scene that
+ * was just submitted, and that a wait with no scenes coming gives up.
+ */
+
+#include "../mpeg.c"
+
+#include <stdio.h>
+
+#define REFRESH_NS 16666667ULL
+#define POLL_NS 100000ULL
+#define STALL_NS (MPEG_FENCE_STALL_REFRESHES * REFRESH_NS)
+#define FRAMES 300
+#define MAX_SCENES (FRAMES * 2 + 8)
+
+typedef struct mock_scene_t {
+    uint64_t render_start;
+    uint64_t render_end;
+    uint64_t flip;
+    int texture;                /* Texture drawn, or -1 */
+} mock_scene_t;
+
+typedef struct mock_pvr_t {
+    mock_scene_t scenes[MAX_SCENES];
+    int count;
+    uint64_t render_ns;
+} mock_pvr_t;
+
+static int failures;
+
+static void check(int ok, const char *what) {
+    if(!ok) {
+        printf("FAIL: %s\n", what);
+        failures++;
+    }
+}
+
+static size_t mock_frame_count(const mock_pvr_t *pvr, uint64_t now) {
+    size_t flips = 0;
+
+    for(int i = 0; i < pvr->count; i++)
+        if(pvr->scenes[i].flip <= now)
+            flips++;
+
+    return flips;
+}
+
+/* When a new scene may begin, like pvr_wait_ready() returning */
+static uint64_t mock_ready_at(const mock_pvr_t *pvr, uint64_t now) {
+    if(pvr->count && pvr->scenes[pvr->count - 1].render_start > now)
+        return pvr->scenes[pvr->count - 1].render_start;
+
+    return now;
+}
+
+static void mock_submit(mock_pvr_t *pvr, uint64_t now, int texture) {
+    mock_scene_t *scene = &pvr->scenes[pvr->count];
+    const mock_scene_t *prev = pvr->count ? scene - 1 : NULL;
+
+    /* The render goes to the framebuffer that isn't shown, so it starts once
+       the previous one has been flipped to, and flips on the next blank */
+    scene->render_start = now;
+    if(prev && prev->flip > scene->render_start)
+        scene->render_start = prev->flip;
+    scene->render_end = scene->render_start + pvr->render_ns;
+    scene->flip = (scene->render_end / REFRESH_NS + 1) * REFRESH_NS;
+    scene->texture = texture;
+
+    pvr->count++;
+}
+
+/* Whether every scene that drew `texture` has been rendered by `now` */
+static int mock_texture_free(const mock_pvr_t *pvr, int texture, uint64_t now) {
+    for(int i = 0; i < pvr->count; i++)
+        if(pvr->scenes[i].texture == texture && pvr->scenes[i].render_end > now)
+            return 0;
+
+    return 1;
+}
+
+/* Wait for a fence the way mpeg_texture_wait() does, moving the clock */
+static mpeg_fence_state_t wait_fence(const mock_pvr_t *pvr, size_t fence, uint64_t *now) {
+    mpeg_fence_wait_t wait;
+    mpeg_fence_state_t state;
+
+    mpeg_fence_wait_start(&wait, mock_frame_count(pvr, *now), *now);
+    while((state = mpeg_fence_poll(&wait, fence, mock_frame_count(pvr, *now),
+                                   *now, STALL_NS)) == MPEG_FENCE_WAITING)
+        *now += POLL_NS;
+
+    return state;
+}
+
+/* Play FRAMES frames the way mpeg_play_ex() does with `textures` textures,
+   after two scenes of the caller's: with two textures it first waits for
+   those to flip, as kos_video_start() does. Each frame is presented at its
+   time, frame_ns apart, or as soon as possible with 0. A scene is begun once
+   the PVR is ready, draws the frame and is finished; then the next frame is
+   decoded and uploaded to the next texture, waiting on its fence. With
+   own_scenes the fences are tightened after each scene as
+   kos_video_present() does, unless drawn_only. Without, they stay as drawn,
+   as for scenes the caller builds around mpeg_player_get_texture_hdr(), and
+   every other scene is one of the caller's without video. Returns the time
+   spent waiting on fences. */
+static uint64_t play(int textures, uint64_t frame_ns, uint64_t decode_ns, uint64_t render_ns,
+                     int own_scenes, int drawn_only) {
+    static mock_pvr_t pvr;
+    size_t fences[MPEG_MAX_TEXTURES] = { 0 };
+    size_t scene_fence = 0;
+    uint64_t now = 0, waited = 0, start_ns;
+    int index = 0;
+    char what[160];
+
+    memset(&pvr, 0, sizeof(pvr));
+    pvr.render_ns = render_ns;
+    mock_submit(&pvr, now, -1);
+    mock_submit(&pvr, now, -1);
+
+    snprintf(what, sizeof(what), "%d textures, frame %llu us, decode %llu us, render %llu us",
+             textures, (unsigned long long)frame_ns / 1000,
+             (unsigned long long)decode_ns / 1000, (unsigned long long)render_ns / 1000);
+
+    /* kos_video_start() */
+    if(own_scenes && !drawn_only && textures == 2) {
+        check(wait_fence(&pvr, SIZE_MAX, &now) == MPEG_FENCE_STALLED, "a wait for no fence passed");
+        check(mock_frame_count(&pvr, now) == (size_t)pvr.count, "the caller's scenes weren't flipped");
+        scene_fence = mock_frame_count(&pvr, now);
+    }
+    start_ns = now;
+
+    for(int frame = 0; frame < FRAMES; frame++) {
+        if(now < start_ns + frame * frame_ns)
+            now = start_ns + frame * frame_ns;
+
+        if(!own_scenes) {
+            now = mock_ready_at(&pvr, now);
+            mock_submit(&pvr, now, -1);
+        }
+
+        /* Present: begin, draw and finish a scene */
+        now = mock_ready_at(&pvr, now);
+        fences[index] = mpeg_fence_drawn(mock_frame_count(&pvr, now));
+        mock_submit(&pvr, now, index);
+
+        if(own_scenes && !drawn_only) {
+            size_t last_fence = scene_fence;
+
+            scene_fence = mpeg_fence_finished(mock_frame_count(&pvr, now), scene_fence);
+            fences[index] = scene_fence;
+
+            /* Never before the scene's flip, and exact after one that was */
+            check(scene_fence >= (size_t)pvr.count, "a scene was fenced before its flip");
+            if(last_fence && scene_fence != (size_t)pvr.count) {
+                printf("  frame %d (%s)\n", frame, what);
+                check(0, "a scene after a known one wasn't fenced on its flip");
+            }
+        }
+
+        /* Decode the next frame and upload it to the next texture */
+        now += decode_ns;
+        int next = (index + 1) % textures;
+        uint64_t start = now;
+        size_t latest = (size_t)pvr.count;
+
+        check(wait_fence(&pvr, fences[next], &now) == MPEG_FENCE_PASSED,
+              "a wait with scenes in flight stalled");
+        waited += now - start;
+
+        if(!mock_texture_free(&pvr, next, now)) {
+            printf("  frame %d, texture %d (%s)\n", frame, next, what);
+            check(0, "an upload overwrote a texture before its scene rendered");
+        }
+
+        /* With exact fences an upload only waits on older scenes */
+        if(own_scenes && !drawn_only && textures == 2 && now > start)
+            check(mock_frame_count(&pvr, now) < latest, "an upload waited for the latest scene");
+
+        index = next;
+    }
+
+    return waited;
+}
+
+static void test_pipelines(void) {
+    const uint64_t frames[] = { 0, 2 * REFRESH_NS, 40000000 };
+    const uint64_t decodes[] = { 2000000, 8000000, 15000000, 25000000 };
+    const uint64_t renders[] = { 1000000, 6000000, 14000000, 30000000 };
+
+    for(int textures = 2; textures <= MPEG_MAX_TEXTURES; textures++)
+        for(size_t f = 0; f < sizeof(frames) / sizeof(frames[0]); f++)
+            for(size_t d = 0; d < sizeof(decodes) / sizeof(decodes[0]); d++)
+                for(size_t r = 0; r < sizeof(renders) / sizeof(renders[0]); r++) {
+                    play(textures, frames[f], decodes[d], renders[r], 1, 0);
+                    play(textures, frames[f], decodes[d], renders[r], 0, 0);
+                }
+}
+
+/* Two textures at 30 fps: with the fences as drawn, each upload waits for
+   the scene submitted just before it */
+static void test_two_textures_overlap(void) {
+    uint64_t drawn = play(2, 2 * REFRESH_NS, 8000000, 6000000, 1, 1);
+    uint64_t finished = play(2, 2 * REFRESH_NS, 8000000, 6000000, 1, 0);
+
+    printf("two textures, %d frames: %llu ms waiting on fences as drawn, %llu ms on fences of finished scenes\n",
+           FRAMES, (unsigned long long)drawn / 1000000, (unsigned long long)finished / 1000000);
+    check(finished < drawn, "fences of finished scenes waited as long as drawn ones");
+}
+
+static void test_stall(void) {
+    mpeg_fence_wait_t wait;
+    uint64_t now = 1000;
+    mpeg_fence_state_t state;
+
+    /* Fenced on a scene that is never submitted: give up after the stall */
+    mpeg_fence_wait_start(&wait, 10, now);
+    while((state = mpeg_fence_poll(&wait, 12, 10, now, STALL_NS)) == MPEG_FENCE_WAITING)
+        now += POLL_NS;
+    check(state == MPEG_FENCE_STALLED, "a wait without flips didn't stall");
+    check(now - 1000 >= STALL_NS && now - 1000 < STALL_NS + POLL_NS,
+          "a wait without flips stalled at the wrong time");
+
+    /* A slow render that flips just within the stall time is waited for */
+    size_t count = 10;
+    int polls = 0;
+    now = 0;
+    mpeg_fence_wait_start(&wait, count, now);
+    while((state = mpeg_fence_poll(&wait, 14, count, now, STALL_NS)) == MPEG_FENCE_WAITING) {
+        now += POLL_NS;
+        if(++polls % (STALL_NS / POLL_NS - 1) == 0)
+            count++;
+    }
+    check(state == MPEG_FENCE_PASSED, "a slow but steady render stalled");
+}
+
+int main(void) {
+    test_pipelines();
+    test_two_textures_overlap();
+    test_stall();
+
+    if(failures) {
+        printf("%d failures\n", failures);
+        return 1;
+    }
+
+    printf("texture fences ok\n");
+    return 0;
+}